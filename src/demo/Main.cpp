@@ -1,14 +1,41 @@
 #include "MyGame.h"
 
+/**
+* Command line:
+*   -headless    render offscreen without a window or audio device
+*   -audiorender mix audio in step with the game clock instead of on a device
+*   -frames N    exit after N frames
+*   -recordgoldens write golden files instead of comparing with them
+*   +COMMAND     run a console command before the first frame, e.g. "+exec scene.cfg"
+*/
 int main(int argc, char * args[]) {
+	std::vector<std::string> commands;
+	int frames = 0;
+	bool recordGoldens = false;
+	int result = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = args[i];
+		if (arg == "-headless") XCube2Engine::setHeadless(true);
+		else if (arg == "-audiorender") XCube2Engine::setOfflineAudio(true);
+		else if (arg == "-frames" && i + 1 < argc) frames = std::atoi(args[++i]);
+		else if (arg == "-recordgoldens") recordGoldens = true;
+		else if (arg[0] == '+') commands.push_back(arg.substr(1));
+	}
 
 	try {
         MyGame game;
-		game.runMainLoop();
+		game.setRecordGoldens(recordGoldens);
+		for (auto & command : commands)
+			game.exec(command);
+
+		game.setFrameLimit(frames);
+		result = game.runMainLoop();
 	} catch (EngineException & e) {
 		std::cout << e.what() << std::endl;
-		getchar();
+		if (!XCube2Engine::isHeadless()) getchar();
+		result = 1;
 	}
 
-	return 0;
-}
\ No newline at end of file
+	return result;
+}
@@ -1,24 +1,52 @@
 #include "MyGame.h"
 
 MyGame::MyGame() : AbstractGame(), player(0, 0, 33, 56), camera(0, 0, 0, 0) {
-	gameFnt = ResourceManager::loadFont("res/fonts/arial.ttf", 36);
-	gfx->useFont(gameFnt);
+	gfx->useFont(ResourceManager::loadFont("res/fonts/arial.ttf", 36));
+	gameFntRef = ResourceRef<FontHandle>(ResourceManager::getFontHandle("res/fonts/arial.ttf"));
 	gfx->setVerticalSync(true);
 
-	// textures
-	ResourceManager::loadTexture("res/textures/tilesheet.png", magicPink);
-	ResourceManager::loadTexture("res/textures/water.png", SDL_COLOR_BLACK);
-	ResourceManager::loadTexture("res/textures/player.png", magicPink);
-	ResourceManager::loadTexture("res/textures/canonball.png", magicPink);
-	ResourceManager::loadTexture("res/textures/player.png", magicPink);
-	ResourceManager::loadTexture("res/textures/enemy.png", magicPink);
-	ResourceManager::loadTexture("res/textures/enemy_dead.png", magicPink);
-
-	// sounds
-	ResourceManager::loadSound("res/sounds/fire.wav");
-	ResourceManager::loadSound("res/sounds/break.wav");
-	ResourceManager::loadSound("res/sounds/win.wav");
+	// textures and sounds decode in parallel, textures are uploaded here on the main thread
+	ResourceManager::loadTextureAsync("res/textures/tilesheet.png", magicPink, "startup");
+	ResourceManager::loadTextureAsync("res/textures/water.png", SDL_COLOR_BLACK, "startup");
+	ResourceManager::loadTextureAsync("res/textures/player.png", magicPink, "startup");
+	ResourceManager::loadTextureAsync("res/textures/canonball.png", magicPink, "startup");
+	ResourceManager::loadTextureAsync("res/textures/enemy.png", magicPink, "startup");
+	ResourceManager::loadTextureAsync("res/textures/enemy_dead.png", magicPink, "startup");
+
+	ResourceManager::loadSoundAsync("res/sounds/fire.wav", "startup");
+	ResourceManager::loadSoundAsync("res/sounds/break.wav", "startup");
+	ResourceManager::loadSoundAsync("res/sounds/win.wav", "startup");
 	ResourceManager::loadMP3("res/sounds/ambience.mp3");
+	ambienceRef = ResourceRef<MP3Handle>(ResourceManager::getMP3Handle("res/sounds/ambience.mp3"));
+
+	ResourceManager::waitForGroup("startup");
+
+	// most of a frame can now be drawn from a single texture
+	ResourceManager::buildAtlas({
+		"res/textures/tilesheet.png",
+		"res/textures/water.png",
+		"res/textures/player.png",
+		"res/textures/canonball.png",
+		"res/textures/enemy.png",
+		"res/textures/enemy_dead.png"
+	});
+
+	texTilesheet = ResourceManager::getTextureHandle("res/textures/tilesheet.png");
+	texWater = ResourceManager::getTextureHandle("res/textures/water.png");
+	texEnemyDead = ResourceManager::getTextureHandle("res/textures/enemy_dead.png");
+	texCannonball = ResourceManager::getTextureHandle("res/textures/canonball.png");
+
+	sndFire = ResourceManager::getSoundHandle("res/sounds/fire.wav");
+	sndBreak = ResourceManager::getSoundHandle("res/sounds/break.wav");
+	sndWin = ResourceManager::getSoundHandle("res/sounds/win.wav");
+
+	// bursts of breaks and shots are capped so the win jingle always gets a voice
+	SoundSettings breakSettings = { 4, 30, 1 };
+	SoundSettings fireSettings = { 3, 50, 0 };
+	SoundSettings winSettings = { 1, 0, 10 };
+	sfx->setSoundSettings(sndBreak, breakSettings);
+	sfx->setSoundSettings(sndFire, fireSettings);
+	sfx->setSoundSettings(sndWin, winSettings);
 
 	// variables
 	mySystem->variable("window_title", "Sol Williams - Demo game", this, &MyGame::setTitle);
@@ -35,17 +63,23 @@ MyGame::MyGame() : AbstractGame(), player(0, 0, 33, 56), camera(0, 0, 0, 0) {
 	mySystem->variable("player_acceleration", 1);
 	mySystem->variable("bullet_speed", 10);
 
-	mySystem->variableStr("player_tex", "res/textures/player.png");
-	mySystem->variableStr("enemy_tex", "res/textures/enemy.png");
+	mySystem->variable("player_tex", "res/textures/player.png", this, &MyGame::bindTextures);
+	mySystem->variable("enemy_tex", "res/textures/enemy.png", this, &MyGame::bindTextures);
 
 	// functions
 	mySystem->function("fire", this, &MyGame::fire);
 	mySystem->function("spawnship", this, &MyGame::spawnShip);
 	mySystem->function("newworld", this, &MyGame::generateWorld);
 
+	physics->addContactListener(LAYER_BULLET, [this](const ContactEvent * events, size_t count) { onBulletHits(events, count); });
+
 	generateWorld("");
 
-	sfx->playMP3(ResourceManager::getMP3("res/sounds/ambience.mp3"), -1);
+	LoadGroupStats startup = ResourceManager::getGroupStats("startup");
+	mySystem->print("startup assets: decode " + std::to_string((int)startup.decodeMs) + " ms, upload "
+		+ std::to_string((int)startup.uploadMs) + " ms, wall " + std::to_string(startup.endTicks - startup.startTicks) + " ms");
+
+	sfx->playMP3(ResourceManager::getMP3(ambienceRef), -1);
 }
 
 MyGame::~MyGame() {
@@ -58,7 +92,12 @@ void MyGame::setTitle(const std::string& s) {
 
 void MyGame::changeGameWin(const std::string& s) {
 	if(mySystem->getValue<bool>("game_win"))
-		sfx->playSound(ResourceManager::getSound("res/sounds/win.wav"));
+		sfx->playSound(sndWin);
+}
+
+void MyGame::bindTextures(const std::string&) {
+	texPlayer = ResourceManager::getTextureHandle(mySystem->getValue<std::string>("player_tex"));
+	texEnemy = ResourceManager::getTextureHandle(mySystem->getValue<std::string>("enemy_tex"));
 }
 
 void MyGame::generateWorld(const std::string& s) {
@@ -71,6 +110,17 @@ void MyGame::generateWorld(const std::string& s) {
 		}
 	}
 
+	// islands are solid for the physics engine
+	TileLayer & tiles = physics->getTiles();
+	tiles.resize(LEVEL_SIZE, LEVEL_SIZE, TILE_SIZE);
+	for (int x = 0; x < LEVEL_SIZE; x++)
+		for (int y = 0; y < LEVEL_SIZE; y++)
+			tiles.setSolid(x, y, level[x][y] != 0);
+
+	// sunk ships lost their bodies already
+	for (auto ship : enemyShips)
+		if (physics->isBody(ship->body))
+			physics->destroyBody(ship->body);
 	enemyShips.clear();
 	remainingShips = 0;
 	for (int i = 0; i < mySystem->getValue<int>("num_enemies"); i++) {
@@ -110,6 +160,9 @@ void MyGame::spawnShip(const std::string& s) {
 	k->isAlive = true;
 	k->angle = getRandom(0, M_PI * 2);
 	k->rect = Rectangle2f(x, y, 33, 56);
+	k->body = physics->createBody(k->rect.x + k->rect.w / 2, k->rect.y + k->rect.h / 2, k->rect.w / 2, k->rect.h / 2, BODY_STATIC);
+	physics->setCollisionFilter(k->body, LAYER_SHIP, LAYER_BULLET);
+	physics->setUserData(k->body, k.get());
 	enemyShips.push_back(k);
 
 	remainingShips++;
@@ -122,14 +175,49 @@ void MyGame::fire(const std::string& s) {
 	std::shared_ptr<Bullet> k = std::make_shared<Bullet>();
 	k->isAlive = true;
 	k->rect = Rectangle2f(player.x + ((float)player.w / 2), player.y + ((float)player.h / 2), 16, 16);
-	k->velocity = Vector2i(velocity.x + (cos(angle) * -speed), velocity.y + (sin(angle) * -speed));
+
+	// speeds are per frame, the physics engine wants them per second
+	Vector2i perFrame(velocity.x + (cos(angle) * -speed), velocity.y + (sin(angle) * -speed));
+	k->body = physics->createBody(k->rect.x + k->rect.w / 2, k->rect.y + k->rect.h / 2, k->rect.w / 2, k->rect.h / 2, BODY_FAST);
+	physics->setVelocity(k->body, Vector2f(perFrame.x / physics->getStep(), perFrame.y / physics->getStep()));
+	physics->setCollisionFilter(k->body, LAYER_BULLET, LAYER_SHIP);
+	physics->setUserData(k->body, k.get());
 	bullets.push_back(k);
 
-	sfx->playSound(ResourceManager::getSound("res/sounds/fire.wav"));
+	sfx->playSoundAt(sndFire, Vector2f(k->rect.x, k->rect.y));
 
 	mySystem->print("spawned bullet at (x: " + std::to_string(k->rect.x) + ", y: " + std::to_string(k->rect.y) + ")");
 }
 
+void MyGame::onBulletHits(const ContactEvent * events, size_t count) {
+	int hits = 0;
+	Vector2f hitSum;
+
+	for (size_t i = 0; i < count; i++) {
+		const ContactEvent & event = events[i];
+		if (event.type != CONTACT_BEGIN) continue;
+
+		bool bulletIsA = event.layerA == LAYER_BULLET;
+		Bullet * bullet = static_cast<Bullet*>(physics->getUserData(bulletIsA ? event.a : event.b));
+		EnemyShip * ship = static_cast<EnemyShip*>(physics->getUserData(bulletIsA ? event.b : event.a));
+		if (bullet == nullptr || ship == nullptr || !ship->isAlive) continue;
+
+		ship->isAlive = false;
+		bullet->isAlive = false;
+		physics->destroyBody(ship->body);
+
+		hits++;
+		hitSum.x += ship->rect.x + ship->rect.w / 2;
+		hitSum.y += ship->rect.y + ship->rect.h / 2;
+	}
+
+	if (hits == 0) return;
+
+	sfx->playSoundAt(sndBreak, Vector2f(hitSum.x / hits, hitSum.y / hits));
+	mySystem->setValue("score", mySystem->getValue<int>("score") + 200 * hits);
+	remainingShips -= hits;
+}
+
 void MyGame::handleKeyEvents() {
 	float speed = mySystem->getValue<float>("player_speed");
 	float acc = mySystem->getValue<float>("player_acceleration") / 10;
@@ -236,26 +324,26 @@ void MyGame::update() {
 	// fix camera within level
 	camera.x = std::max((float)0, std::min((float)(LEVEL_SIZE * TILE_SIZE) - camera.w, player.x - ((camera.w - player.w) / 2)));
 	camera.y = std::max((float)0, std::min((float)(LEVEL_SIZE * TILE_SIZE) - camera.h, player.y - ((camera.h - player.h) / 2)));
+	sfx->setListener(Vector2f(camera.x + camera.w / 2, camera.y + camera.h / 2));
 
-	// tick bullets (for collision)
+	// bullets are moved and hit ships in the physics update, see onBulletHits()
+	Rectangle2f levelRect(0, 0, LEVEL_SIZE * TILE_SIZE, LEVEL_SIZE * TILE_SIZE);
 	for (auto key : bullets) {
 		if (!key->isAlive) continue;
 
-		for (auto ship : enemyShips) {
-			if (ship->isAlive && ship->rect.intersects(key->rect)) {
-				ship->isAlive = false;
-				key->isAlive = false;
-
-				sfx->playSound(ResourceManager::getSound("res/sounds/break.wav"));
-				mySystem->setValue("score", mySystem->getValue<int>("score") + 200);
-				remainingShips--;
-			}
-		}
-
-		key->rect.x += key->velocity.x;
-		key->rect.y += key->velocity.y;
+		Vector2f position = physics->getPosition(key->body);
+		key->rect.x = position.x - key->rect.w / 2;
+		key->rect.y = position.y - key->rect.h / 2;
+		if (!key->rect.intersects(levelRect))
+			key->isAlive = false;
 	}
 
+	for (auto key : bullets)
+		if (!key->isAlive)
+			physics->destroyBody(key->body);
+	bullets.erase(std::remove_if(bullets.begin(), bullets.end(),
+		[](const std::shared_ptr<Bullet>& key) { return !key->isAlive; }), bullets.end());
+
 	if (remainingShips == 0 && !mySystem->getValue<bool>("game_win"))
 		mySystem->setValue("game_win", true);
 
@@ -267,8 +355,8 @@ void MyGame::render() {
 	if (frame == 11520) frame = 0; // 64 * 180
 
 	// draw world
-	auto tilemap = ResourceManager::getTexture("res/textures/tilesheet.png");
-	auto watermap = ResourceManager::getTexture("res/textures/water.png");
+	TextureRegion tilemap = ResourceManager::getRegion(texTilesheet);
+	TextureRegion watermap = ResourceManager::getRegion(texWater);
 	for (int x = 0; x < LEVEL_SIZE; x++)
 	{
 		for (int y = 0; y < LEVEL_SIZE; y++)
@@ -284,8 +372,7 @@ void MyGame::render() {
 		Rectangle2f shipRect = { key->rect.x, key->rect.y, key->rect.w, key->rect.h };
 		shipRect.x -= camera.x;
 		shipRect.y -= camera.y;
-		gfx->drawTexture(key->isAlive ? ResourceManager::getTexture(mySystem->getValue<std::string>("enemy_tex"))
-			: ResourceManager::getTexture("res/textures/enemy_dead.png")
+		gfx->drawTexture(ResourceManager::getRegion(key->isAlive ? texEnemy : texEnemyDead)
 			, 0, &shipRect.getSDLRect(), toDegrees(key->angle + sin((float)(key->rect.x + frame) / 20) / 10) + 90);
 	}
 
@@ -296,16 +383,16 @@ void MyGame::render() {
 		Rectangle2f bulletRect = { key->rect.x, key->rect.y, key->rect.w, key->rect.h };
 		bulletRect.x -= camera.x;
 		bulletRect.y -= camera.y;
-		gfx->drawTexture(ResourceManager::getTexture("res/textures/canonball.png"), &bulletRect.getSDLRect());
+		gfx->drawTexture(ResourceManager::getRegion(texCannonball), &bulletRect.getSDLRect());
 	}
 
 	// draw player
 	Rectangle2f playerRect = { player.x - camera.x, player.y - camera.y, player.w, player.h };
 	float playerAngle = angle + (sin((float)(player.x + frame) / 20) / 10);
-	gfx->drawTexture(ResourceManager::getTexture(mySystem->getValue<std::string>("player_tex")), 0, &playerRect.getSDLRect(), toDegrees(playerAngle) + 90);
+	gfx->drawTexture(ResourceManager::getRegion(texPlayer), 0, &playerRect.getSDLRect(), toDegrees(playerAngle) + 90);
 }
 
-void MyGame::drawTilemap(int x, int y, SDL_Texture *tilemap, int tile, int scroll_offset) {
+void MyGame::drawTilemap(int x, int y, const TextureRegion &tilemap, int tile, int scroll_offset) {
 	int tx = tile % TILESHEET_X;
 	int ty = tile / TILESHEET_Y;
 	Rect srcRect = { (tx * TILE_SIZE_SRC) + scroll_offset, ty * TILE_SIZE_SRC, TILE_SIZE_SRC, TILE_SIZE_SRC };
@@ -317,7 +404,8 @@ void MyGame::drawTilemap(int x, int y, SDL_Texture *tilemap, int tile, int scrol
 }
 
 void MyGame::renderUI() {
-	gfx->useFont(gameFnt);
+	// looked up every frame so a hot reloaded font shows at once
+	gfx->useFont(ResourceManager::getFont(gameFntRef));
 
 	gfx->setDrawColor(mySystem->getValue<SDL_Color>("gui_color"));
 	std::string scoreStr = mySystem->getValue<std::string>("score");
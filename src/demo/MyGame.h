@@ -3,18 +3,25 @@
 
 #include "../engine/AbstractGame.h"
 
+// bodies stay in the default layer 1 unless they are one of these
+enum CollisionLayer {
+	LAYER_SHIP = 1 << 1,
+	LAYER_BULLET = 1 << 2
+};
+
 struct EnemyShip {
 	Rectangle2f rect;
 	float angle;
 	bool isAlive;
+	BodyId body;
 
 	EnemyShip();
 };
 
 struct Bullet {
 	Rectangle2f rect;
-	Vector2i velocity;
 	bool isAlive;
+	BodyId body;	// moved by the physics engine, rect follows it
 
 	Bullet();
 };
@@ -30,7 +37,9 @@ class MyGame : public AbstractGame {
 	private:
 		SDL_Color magicPink = SDL_Color{ 255, 0, 255, 255 };
 
-		TTF_Font* gameFnt;
+		/* kept across frames, these stop them being evicted */
+		ResourceRef<FontHandle> gameFntRef;
+		ResourceRef<MP3Handle> ambienceRef;
 
 		int level[LEVEL_SIZE][LEVEL_SIZE];
 
@@ -47,15 +56,25 @@ class MyGame : public AbstractGame {
 
 		std::vector<std::shared_ptr<Bullet>> bullets;
 
+		/* resource handles, resolved once at load/bind time */
+		TextureHandle texTilesheet, texWater, texPlayer, texEnemy, texEnemyDead, texCannonball;
+		SoundHandle sndFire, sndBreak, sndWin;
+
 		void handleKeyEvents();
 		void update();
 		void render();
 		void renderUI();
 
-		void drawTilemap(int x, int y, SDL_Texture* tilemap, int tile, int scroll_offset = 0);
+		void drawTilemap(int x, int y, const TextureRegion& tilemap, int tile, int scroll_offset = 0);
 
 		void setTitle(const std::string&);
 		void changeGameWin(const std::string&);
+		void bindTextures(const std::string&);
+
+		/**
+		* All bullet hits of one physics update, the score, ship count and sound change once for all of them
+		*/
+		void onBulletHits(const ContactEvent * events, size_t count);
 
 		void fire(const std::string&);
 		void spawnShip(const std::string&);
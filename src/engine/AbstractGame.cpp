@@ -1,6 +1,6 @@
 #include "AbstractGame.h"
 
-AbstractGame::AbstractGame() : running(true), paused(false), gameTime(0.0) {
+AbstractGame::AbstractGame() : audioGoldenTolerance(0), frameLimit(0), exitCode(0), recordGoldens(false), running(true), paused(false), gameTime(0.0) {
 	std::shared_ptr<XCube2Engine> engine = XCube2Engine::getInstance();
 
 	// engine ready, get subsystems
@@ -9,6 +9,8 @@ AbstractGame::AbstractGame() : running(true), paused(false), gameTime(0.0) {
 	eventSystem = engine->getEventEngine();
 	physics = engine->getPhysicsEngine();
     mySystem = engine->getMyEngineSystem();
+
+	registerConsole();
 }
 
 AbstractGame::~AbstractGame() {
@@ -27,8 +29,10 @@ AbstractGame::~AbstractGame() {
 
 #ifdef __DEBUG
 	debug("AbstractGame::~AbstractGame() finished");
-	debug("The game finished and cleaned up successfully. Press Enter to exit");
-	getchar();
+	if (!XCube2Engine::isHeadless()) {
+		debug("The game finished and cleaned up successfully. Press Enter to exit");
+		getchar();
+	}
 #endif
 }
 
@@ -37,6 +41,7 @@ int AbstractGame::runMainLoop() {
 	debug("Entered Main Loop");
 #endif
 
+	int frames = 0;
 	while (running) {
 		gfx->setFrameStart();
 		eventSystem->pollEvents();
@@ -44,6 +49,9 @@ int AbstractGame::runMainLoop() {
 		if (eventSystem->isPressed(Key::ESC) || eventSystem->isPressed(Key::QUIT))
 			running = false;
 
+		ResourceManager::update();
+		sfx->update();
+
 		handleKeyEvents();
 		handleMouseEvents();
 
@@ -52,21 +60,36 @@ int AbstractGame::runMainLoop() {
 			updatePhysics();
 
 			gameTime += 0.016;	// 60 times a sec
+			sfx->advanceRender(0.016);
 		}
 
 		gfx->clearScreen();
+		gfx->beginWorld();
 		render();
+		gfx->endWorld();
 		renderUI();
+		processCaptures();
 		gfx->showScreen();
 
 		gfx->adjustFPSDelay(16);	// atm hardcoded to ~60 FPS
+
+		if (frameLimit > 0 && ++frames >= frameLimit)
+			running = false;
 	}
 
 #ifdef __DEBUG
 	debug("Exited Main Loop");
 #endif
 
-	return 0;
+	finishAudioCapture();
+	if (sfx->isOffline())
+		cmd_mixStats("");
+
+	return exitCode;
+}
+
+void AbstractGame::exec(const std::string& command) {
+	mySystem->exec(command, false);
 }
 
 void AbstractGame::handleMouseEvents() {
@@ -80,4 +103,484 @@ void AbstractGame::updatePhysics() {
 
 void AbstractGame::onLeftMouseButton() {}
 void AbstractGame::onRightMouseButton() {}
-void AbstractGame::renderUI() {}
\ No newline at end of file
+void AbstractGame::renderUI() {}
+
+/* ENGINE CONSOLE BINDINGS */
+
+void AbstractGame::registerConsole() {
+	mySystem->variable("gfx_textcache_kb", DEFAULT_TEXT_CACHE_BUDGET / 1024, this, &AbstractGame::cvar_textCacheBudget);
+
+	mySystem->variable("r_dynres_target_ms", DEFAULT_DYNRES_TARGET_MS, this, &AbstractGame::cvar_dynamicResolution);
+	mySystem->variable("r_dynres_min", DEFAULT_DYNRES_MIN_SCALE, this, &AbstractGame::cvar_dynamicResolution);
+	mySystem->variable("r_dynres_max", DEFAULT_DYNRES_MAX_SCALE, this, &AbstractGame::cvar_dynamicResolution);
+	mySystem->variable("r_dynres_hysteresis", DEFAULT_DYNRES_HYSTERESIS, this, &AbstractGame::cvar_dynamicResolution);
+	mySystem->variable("r_dynres", 0, this, &AbstractGame::cvar_dynamicResolution);
+
+	mySystem->variable("res_upload_budget_ms", DEFAULT_UPLOAD_BUDGET_MS, this, &AbstractGame::cvar_uploadBudget);
+	mySystem->variable("res_budget_tex_mb", DEFAULT_TEXTURE_BUDGET_MB, this, &AbstractGame::cvar_resourceBudget);
+	mySystem->variable("res_budget_font_mb", DEFAULT_FONT_BUDGET_MB, this, &AbstractGame::cvar_resourceBudget);
+	mySystem->variable("res_budget_snd_mb", DEFAULT_SOUND_BUDGET_MB, this, &AbstractGame::cvar_resourceBudget);
+	mySystem->variable("res_budget_mus_mb", DEFAULT_MUSIC_BUDGET_MB, this, &AbstractGame::cvar_resourceBudget);
+	mySystem->variable("res_texcache_mb", DEFAULT_TEXTURE_CACHE_MB, this, &AbstractGame::cvar_textureCache);
+	mySystem->variable("res_texcache", 1, this, &AbstractGame::cvar_textureCache);
+	mySystem->variable("res_hotreload_debounce_ms", DEFAULT_HOT_RELOAD_DEBOUNCE_MS, this, &AbstractGame::cvar_hotReload);
+	mySystem->variable("res_hotreload", DEFAULT_HOT_RELOAD, this, &AbstractGame::cvar_hotReload);
+
+	mySystem->variable("snd_stream_kb", (int)(DEFAULT_STREAM_THRESHOLD / 1024), this, &AbstractGame::cvar_streamThreshold);
+	mySystem->variable("snd_voices", DEFAULT_VOICES, this, &AbstractGame::cvar_voices);
+	mySystem->variable("snd_atten_min", DEFAULT_ATTENUATION_MIN_DISTANCE, this, &AbstractGame::cvar_attenuation);
+	mySystem->variable("snd_atten_max", DEFAULT_ATTENUATION_MAX_DISTANCE, this, &AbstractGame::cvar_attenuation);
+	mySystem->variable("snd_pan_distance", DEFAULT_PAN_DISTANCE, this, &AbstractGame::cvar_attenuation);
+
+	mySystem->variable("phys_cell_size", DEFAULT_PHYSICS_CELL_SIZE, this, &AbstractGame::cvar_physicsCellSize);
+	mySystem->variable("phys_broadphase", (int)BROADPHASE_GRID, this, &AbstractGame::cvar_physicsBroadphase);
+	mySystem->variable("phys_threads", 0, this, &AbstractGame::cvar_physicsThreads);
+	mySystem->variable("phys_sleep_velocity", DEFAULT_SLEEP_VELOCITY, this, &AbstractGame::cvar_physicsSleepVelocity);
+	mySystem->variable("phys_sleep_steps", DEFAULT_SLEEP_STEPS, this, &AbstractGame::cvar_physicsSleepSteps);
+
+	mySystem->function("textcache", this, &AbstractGame::cmd_textCache, "print text cache stats (textcache clear/reset)");
+	mySystem->function("dynres", this, &AbstractGame::cmd_dynres, "print dynamic resolution scale and frame time");
+	mySystem->function("loadstats", this, &AbstractGame::cmd_loadStats, "print async load timings per group");
+	mySystem->function("resstats", this, &AbstractGame::cmd_resStats, "print resource residency, memory and hit rates (resstats reset)");
+	mySystem->function("texcache", this, &AbstractGame::cmd_textureCache, "print decoded texture cache stats (texcache clear)");
+	mySystem->function("voices", this, &AbstractGame::cmd_voices, "print voice usage per sound and audio command queue depth (voices reset)");
+	mySystem->function("seed", this, &AbstractGame::cmd_seed, "seed the random number generator");
+	mySystem->function("screenshot", this, &AbstractGame::cmd_screenshot, "save the next frame as a BMP file");
+	mySystem->function("golden", this, &AbstractGame::cmd_golden, "compare the next frame with a golden image (golden FILE TOLERANCE)");
+	mySystem->function("audiocapture", this, &AbstractGame::cmd_audioCapture, "record the mixed audio to a WAV file until the game exits (audiocapture FILE)");
+	mySystem->function("audiogolden", this, &AbstractGame::cmd_audioGolden, "compare the audio mixed until the game exits with a golden WAV file (audiogolden FILE TOLERANCE)");
+	mySystem->function("mixstats", this, &AbstractGame::cmd_mixStats, "print audio mixed and mixing throughput (mixstats reset)");
+	mySystem->function("physstats", this, &AbstractGame::cmd_physStats, "print body and contact counts and timings of the last physics update");
+	mySystem->function("physthreads", this, &AbstractGame::cmd_physThreads, "time a physics update with 1 to N threads (physthreads [OBJECTS])");
+	mySystem->function("physbench", this, &AbstractGame::cmd_physBench, "time the physics broadphase against all pairs (physbench [OBJECTS ...])");
+	mySystem->function("physquery", this, &AbstractGame::cmd_physQuery, "time raycasts, region and nearest body queries (physquery [OBJECTS] [QUERIES])");
+}
+
+void AbstractGame::cvar_textCacheBudget(const std::string&) {
+	gfx->setTextCacheBudget((size_t)mySystem->getValue<int>("gfx_textcache_kb") * 1024);
+}
+
+void AbstractGame::cmd_textCache(const std::string& args) {
+	if (args == "clear") gfx->clearTextCache();
+	else if (args == "reset") gfx->resetTextCacheStats();
+
+	TextCacheStats stats = gfx->getTextCacheStats();
+	Uint32 lookups = stats.hits + stats.misses;
+	int hitRate = lookups > 0 ? (int)(100 * stats.hits / lookups) : 0;
+
+	mySystem->print("text cache: " + std::to_string(stats.entries) + " entries (" + std::to_string(stats.pinned) + " pinned), "
+		+ std::to_string(stats.bytes / 1024) + "/" + std::to_string(stats.budget / 1024) + " KB");
+	mySystem->print("hits: " + std::to_string(stats.hits) + " misses: " + std::to_string(stats.misses)
+		+ " evictions: " + std::to_string(stats.evictions) + " (" + std::to_string(hitRate) + "% hit rate)");
+}
+
+float AbstractGame::getFloat(const std::string& variable, float fallback) {
+	return mySystem->hasVariable(variable) ? mySystem->getValue<float>(variable) : fallback;
+}
+
+void AbstractGame::cvar_dynamicResolution(const std::string&) {
+	// shared by all r_dynres* variables, some may not be registered yet
+	DynamicResolutionSettings settings;
+	settings.targetMs = getFloat("r_dynres_target_ms", DEFAULT_DYNRES_TARGET_MS);
+	settings.minScale = getFloat("r_dynres_min", DEFAULT_DYNRES_MIN_SCALE);
+	settings.maxScale = getFloat("r_dynres_max", DEFAULT_DYNRES_MAX_SCALE);
+	settings.hysteresis = getFloat("r_dynres_hysteresis", DEFAULT_DYNRES_HYSTERESIS);
+	gfx->setDynamicResolutionSettings(settings);
+
+	if (mySystem->hasVariable("r_dynres"))
+		gfx->setDynamicResolution(mySystem->getValue<bool>("r_dynres"));
+}
+
+void AbstractGame::cmd_dynres(const std::string&) {
+	std::ostringstream ss;
+	ss << "dynamic resolution: " << (gfx->isDynamicResolution() ? "on" : "off")
+		<< ", scale " << gfx->getRenderScale()
+		<< ", frame time " << gfx->getAverageFrameTime() << " ms"
+		<< " (target " << getFloat("r_dynres_target_ms", DEFAULT_DYNRES_TARGET_MS) << " ms)";
+	mySystem->print(ss.str());
+}
+
+void AbstractGame::cvar_uploadBudget(const std::string&) {
+	ResourceManager::setUploadBudget(mySystem->getValue<int>("res_upload_budget_ms"));
+}
+
+void AbstractGame::cmd_loadStats(const std::string&) {
+	for (auto & group : ResourceManager::getAllGroupStats()) {
+		const LoadGroupStats & stats = group.second;
+		std::ostringstream ss;
+		ss << "'" << group.first << "': " << stats.completed << "/" << stats.requested << " loaded"
+			<< ", decode " << stats.decodeMs << " ms, upload " << stats.uploadMs << " ms"
+			<< ", wall " << (stats.endTicks - stats.startTicks) << " ms";
+		mySystem->print(ss.str());
+	}
+
+	LoadDedupStats dedup = ResourceManager::getDedupStats();
+	mySystem->print("deduplicated loads: " + std::to_string(dedup.cached) + " cached, " + std::to_string(dedup.coalesced)
+		+ " coalesced in flight, " + std::to_string(dedup.conflicts) + " with conflicting parameters");
+}
+
+void AbstractGame::cvar_resourceBudget(const std::string&) {
+	// shared by all res_budget_* variables, some may not be registered yet
+	const size_t MB = 1024 * 1024;
+	ResourceManager::setBudget(RESOURCE_TEXTURE, (size_t)getFloat("res_budget_tex_mb", DEFAULT_TEXTURE_BUDGET_MB) * MB);
+	ResourceManager::setBudget(RESOURCE_FONT, (size_t)getFloat("res_budget_font_mb", DEFAULT_FONT_BUDGET_MB) * MB);
+	ResourceManager::setBudget(RESOURCE_SOUND, (size_t)getFloat("res_budget_snd_mb", DEFAULT_SOUND_BUDGET_MB) * MB);
+	ResourceManager::setBudget(RESOURCE_MUSIC, (size_t)getFloat("res_budget_mus_mb", DEFAULT_MUSIC_BUDGET_MB) * MB);
+}
+
+void AbstractGame::cmd_resStats(const std::string& args) {
+	if (args == "reset") ResourceManager::resetStats();
+
+	const char * names[RESOURCE_CLASS_COUNT] = { "textures", "fonts", "sounds", "music" };
+	for (int i = 0; i < RESOURCE_CLASS_COUNT; i++) {
+		ResourcePoolStats stats = ResourceManager::getStats((ResourceClass)i);
+		Uint32 lookups = stats.hits + stats.misses;
+		int hitRate = lookups > 0 ? (int)(100.0 * stats.hits / lookups) : 0;
+
+		std::ostringstream ss;
+		ss << names[i] << ": " << stats.resident << "/" << stats.count << " resident (" << stats.referenced << " referenced), "
+			<< stats.bytes / 1024 << "/" << (stats.budget > 0 ? std::to_string(stats.budget / 1024) : "unlimited") << " KB, "
+			<< hitRate << "% hit rate, " << stats.evictions << " evictions";
+		mySystem->print(ss.str());
+	}
+
+	mySystem->print("atlas pages: " + std::to_string(ResourceManager::getAtlasBytes() / 1024) + " KB");
+}
+
+void AbstractGame::cvar_textureCache(const std::string&) {
+	size_t capacity = (size_t)getFloat("res_texcache_mb", DEFAULT_TEXTURE_CACHE_MB) * 1024 * 1024;
+	bool enabled = !mySystem->hasVariable("res_texcache") || mySystem->getValue<bool>("res_texcache");
+
+	if (enabled && !ResourceManager::isTextureCacheEnabled())
+		ResourceManager::enableTextureCache(TextureDiskCache::getDefaultDirectory(), capacity);
+	else if (!enabled && ResourceManager::isTextureCacheEnabled())
+		ResourceManager::disableTextureCache();
+	else
+		ResourceManager::setTextureCacheCapacity(capacity);
+}
+
+void AbstractGame::cmd_textureCache(const std::string& args) {
+	if (args == "clear") ResourceManager::clearTextureCache();
+
+	TextureDiskCacheStats stats = ResourceManager::getTextureCacheStats();
+	mySystem->print("texture cache: " + std::string(ResourceManager::isTextureCacheEnabled() ? "on" : "off") + ", "
+		+ std::to_string(stats.entries) + " files, " + std::to_string(stats.bytes / 1024) + "/" + std::to_string(stats.capacity / 1024) + " KB");
+	mySystem->print("hits: " + std::to_string(stats.hits) + " misses: " + std::to_string(stats.misses)
+		+ " (" + std::to_string(stats.stale) + " stale) writes: " + std::to_string(stats.writes));
+}
+
+void AbstractGame::cvar_hotReload(const std::string&) {
+	ResourceManager::setHotReloadDebounce((Uint32)getFloat("res_hotreload_debounce_ms", DEFAULT_HOT_RELOAD_DEBOUNCE_MS));
+	if (mySystem->hasVariable("res_hotreload"))
+		ResourceManager::enableHotReload(mySystem->getValue<bool>("res_hotreload"));
+}
+
+void AbstractGame::cvar_streamThreshold(const std::string&) {
+	AudioEngine::setStreamThreshold((size_t)mySystem->getValue<int>("snd_stream_kb") * 1024);
+}
+
+void AbstractGame::cvar_voices(const std::string&) {
+	sfx->setVoiceCount(mySystem->getValue<int>("snd_voices"));
+}
+
+void AbstractGame::cvar_attenuation(const std::string&) {
+	AttenuationSettings settings;
+	settings.minDistance = getFloat("snd_atten_min", DEFAULT_ATTENUATION_MIN_DISTANCE);
+	settings.maxDistance = getFloat("snd_atten_max", DEFAULT_ATTENUATION_MAX_DISTANCE);
+	settings.panDistance = getFloat("snd_pan_distance", DEFAULT_PAN_DISTANCE);
+	sfx->setAttenuation(settings);
+}
+
+void AbstractGame::cmd_voices(const std::string& args) {
+	if (args == "reset") {
+		sfx->resetVoiceStats();
+		sfx->resetQueueStats();
+	}
+
+	VoiceStats stats = sfx->getVoiceStats();
+	mySystem->print("voices: " + std::to_string(stats.active) + "/" + std::to_string(stats.voices)
+		+ " active, peak " + std::to_string(stats.peak) + ", " + std::to_string(sfx->getActiveStreamCount()) + " streaming");
+	mySystem->print("played: " + std::to_string(stats.played) + " stolen: " + std::to_string(stats.stolen)
+		+ " restarted: " + std::to_string(stats.restarted) + " throttled: " + std::to_string(stats.throttled)
+		+ " dropped: " + std::to_string(stats.dropped));
+
+	PositionalStats positional = sfx->getPositionalStats();
+	mySystem->print("positional: " + std::to_string(positional.audible) + "/" + std::to_string(positional.emitters) + " audible, "
+		+ std::to_string(positional.virtualized) + " virtualized, " + std::to_string(positional.resumed) + " resumed, "
+		+ std::to_string(positional.updates) + " updates");
+
+	AudioQueueStats queue = sfx->getQueueStats();
+	mySystem->print("queue: " + std::to_string(queue.depth) + "/" + std::to_string(queue.capacity) + " commands, peak "
+		+ std::to_string(queue.peakDepth) + ", peak per frame " + std::to_string(queue.peakPerFrame) + ", "
+		+ std::to_string(queue.pushed) + " pushed in " + std::to_string(queue.drains) + " drains, " + std::to_string(queue.stalls) + " stalls");
+
+	for (auto & usage : sfx->getVoiceUsage()) {
+		std::string name = usage.first.isValid() ? ResourceManager::getSoundName(usage.first) : "(unmanaged)";
+		if (name.empty()) name = "(freed)";
+		mySystem->print("  " + name + ": " + std::to_string(usage.second));
+	}
+}
+
+void AbstractGame::cmd_seed(const std::string& args) {
+	if (args.empty()) {
+		mySystem->print("seed [VALUE]");
+		return;
+	}
+
+	srand((unsigned int)std::stoul(args));
+}
+
+void AbstractGame::cmd_screenshot(const std::string& args) {
+	FrameCapture capture = { args.empty() ? "screenshot.bmp" : args, 0, false };
+	pendingCaptures.push_back(capture);
+}
+
+void AbstractGame::cmd_golden(const std::string& args) {
+	if (args.empty()) {
+		mySystem->print("golden [FILE] (TOLERANCE)");
+		return;
+	}
+
+	FrameCapture capture = { args, 0, true };
+	size_t space = args.find(' ');
+	if (space != std::string::npos) {
+		capture.fileName = args.substr(0, space);
+		capture.tolerance = std::atoi(args.substr(space + 1).c_str());
+	}
+	pendingCaptures.push_back(capture);
+}
+
+void AbstractGame::processCaptures() {
+	for (auto & capture : pendingCaptures) {
+		if (!capture.compare) {
+			if (gfx->saveScreenshot(capture.fileName))
+				mySystem->print("saved " + capture.fileName);
+			continue;
+		}
+
+		if (recordGoldens) {
+			if (gfx->saveScreenshot(capture.fileName))
+				mySystem->print("golden image recorded: " + capture.fileName, LINETYPE_WARNING);
+			else
+				exitCode = 1;
+			continue;
+		}
+
+		// goldens are only ever written when asked to, so a test run without them fails
+		SDL_RWops * file = SDL_RWFromFile(capture.fileName.c_str(), "rb");
+		if (nullptr == file) {
+			mySystem->print("golden image missing: " + capture.fileName + " (run with -recordgoldens to create it)", LINETYPE_ERROR);
+			exitCode = 1;
+			continue;
+		}
+		SDL_RWclose(file);
+
+		int mismatches = gfx->compareWithImage(capture.fileName, capture.tolerance);
+		if (mismatches == 0) {
+			mySystem->print("golden image matched: " + capture.fileName, LINETYPE_SUCCESS);
+		}
+		else {
+			mySystem->print("golden image mismatch: " + capture.fileName + " (" + std::to_string(mismatches) + " pixels)", LINETYPE_ERROR);
+
+			std::string failed = capture.fileName + ".fail.bmp";
+			gfx->saveScreenshot(failed);
+			exitCode = 1;
+		}
+	}
+
+	pendingCaptures.clear();
+}
+
+void AbstractGame::cmd_audioCapture(const std::string& args) {
+	if (args.empty()) {
+		mySystem->print("audiocapture [FILE]");
+		return;
+	}
+
+	audioCaptureFile = args;
+	if (!sfx->isCapturing())
+		sfx->startCapture();
+}
+
+void AbstractGame::cmd_audioGolden(const std::string& args) {
+	if (args.empty()) {
+		mySystem->print("audiogolden [FILE] (TOLERANCE)");
+		return;
+	}
+
+	audioGoldenFile = args;
+	audioGoldenTolerance = 0;
+	size_t space = args.find(' ');
+	if (space != std::string::npos) {
+		audioGoldenFile = args.substr(0, space);
+		audioGoldenTolerance = std::atoi(args.substr(space + 1).c_str());
+	}
+
+	if (!sfx->isCapturing())
+		sfx->startCapture();
+}
+
+void AbstractGame::finishAudioCapture() {
+	if (!sfx->isCapturing())
+		return;
+
+	std::vector<Uint8> samples = sfx->stopCapture();
+	if (!audioCaptureFile.empty() && sfx->saveWav(audioCaptureFile, samples))
+		mySystem->print("saved " + audioCaptureFile);
+
+	if (audioGoldenFile.empty())
+		return;
+
+	if (recordGoldens) {
+		if (sfx->saveWav(audioGoldenFile, samples))
+			mySystem->print("golden audio recorded: " + audioGoldenFile, LINETYPE_WARNING);
+		else
+			exitCode = 1;
+		return;
+	}
+
+	SDL_RWops * file = SDL_RWFromFile(audioGoldenFile.c_str(), "rb");
+	if (nullptr == file) {
+		mySystem->print("golden audio missing: " + audioGoldenFile + " (run with -recordgoldens to create it)", LINETYPE_ERROR);
+		exitCode = 1;
+		return;
+	}
+	SDL_RWclose(file);
+
+	int mismatches = sfx->compareWav(audioGoldenFile, samples, audioGoldenTolerance);
+	if (mismatches == 0) {
+		mySystem->print("golden audio matched: " + audioGoldenFile, LINETYPE_SUCCESS);
+	}
+	else {
+		std::string reason = mismatches < 0 ? "unreadable or different format" : std::to_string(mismatches) + " samples";
+		mySystem->print("golden audio mismatch: " + audioGoldenFile + " (" + reason + ")", LINETYPE_ERROR);
+
+		std::string failed = audioGoldenFile + ".fail.wav";
+		sfx->saveWav(failed, samples);
+		exitCode = 1;
+	}
+}
+
+void AbstractGame::cmd_mixStats(const std::string& args) {
+	if (args == "reset") sfx->resetRenderStats();
+
+	AudioRenderStats stats = sfx->getRenderStats();
+	double seconds = stats.frequency > 0 ? (double)stats.frames / stats.frequency : 0.0;
+	double voiceSeconds = stats.frequency > 0 ? (double)stats.voiceFrames / stats.frequency : 0.0;
+
+	std::ostringstream ss;
+	ss.precision(2);
+	ss << std::fixed << "mixed " << seconds << " s of audio, " << voiceSeconds << " voice s";
+	if (stats.mixSeconds > 0.0)
+		ss << " in " << stats.mixSeconds * 1000.0 << " ms: " << voiceSeconds / stats.mixSeconds << " voices mixed per second, "
+			<< seconds / stats.mixSeconds << "x real time";
+	mySystem->print(ss.str());
+}
+
+void AbstractGame::cvar_physicsCellSize(const std::string&) {
+	physics->setCellSize(mySystem->getValue<float>("phys_cell_size"));
+}
+
+void AbstractGame::cvar_physicsBroadphase(const std::string&) {
+	physics->setBroadphase(mySystem->getValue<int>("phys_broadphase") == BROADPHASE_SWEEP ? BROADPHASE_SWEEP : BROADPHASE_GRID);
+}
+
+void AbstractGame::cvar_physicsThreads(const std::string&) {
+	physics->setThreadCount(mySystem->getValue<int>("phys_threads"));
+}
+
+void AbstractGame::cvar_physicsSleepVelocity(const std::string&) {
+	physics->setSleep(mySystem->getValue<float>("phys_sleep_velocity"), physics->getSleepSteps());
+}
+
+void AbstractGame::cvar_physicsSleepSteps(const std::string&) {
+	physics->setSleep(physics->getSleepVelocity(), mySystem->getValue<int>("phys_sleep_steps"));
+}
+
+void AbstractGame::cmd_physStats(const std::string&) {
+	PhysicsStats stats = physics->getStats();
+
+	std::ostringstream ss;
+	ss.precision(3);
+	ss << std::fixed << "physics: " << stats.objects << " objects (" << stats.awake << " awake, " << stats.sleeping << " sleeping), ";
+	if (physics->getBroadphase() == BROADPHASE_SWEEP)
+		ss << "sweep and prune " << stats.swaps << " swaps, " << physics->getOverlapEvents().size() << " overlap events, ";
+	else
+		ss << "grid " << stats.cells << " cells (" << stats.oversized << " oversized), ";
+	ss << stats.candidates << " candidates (" << stats.swept << " swept), " << stats.contacts << " contacts, "
+		<< physics->getContactEvents().size() << " contact events";
+	mySystem->print(ss.str());
+
+	ss.str("");
+	ss << stats.threads << " threads: integrate " << stats.integrateMs << " ms (" << PhysicsEngine::getIntegrationPath() << "), broadphase " << stats.broadphaseMs
+		<< " ms, narrowphase " << stats.narrowphaseMs << " ms (cell size " << physics->getCellSize() << ")";
+	mySystem->print(ss.str());
+
+	TileLayer & tiles = physics->getTiles();
+	if (tiles.getWidth() > 0)
+		mySystem->print("tiles: " + std::to_string(tiles.getWidth()) + "x" + std::to_string(tiles.getHeight()) + ", "
+			+ std::to_string(tiles.getSolidCount()) + " solid");
+}
+
+void AbstractGame::cmd_physBench(const std::string& args) {
+	std::vector<int> counts;
+	std::istringstream in(args);
+	int count;
+	while (in >> count)
+		if (count > 0) counts.push_back(count);
+
+	if (counts.empty())
+		counts = { 1000, 2000, 5000, 10000, 20000, 50000 };
+
+	// all pairs grows quadratically and runs for both distributions, 10000 objects take about half a second
+	for (auto & result : PhysicsEngine::benchmark(counts, 10, 10000)) {
+		std::ostringstream ss;
+		ss.precision(3);
+		ss << std::fixed << result.objects << " " << result.distribution << ": grid " << result.gridMs << " ms, sweep and prune " << result.sweepMs << " ms";
+		if (result.bruteForceMs > 0.0)
+			ss << ", all pairs " << result.bruteForceMs << " ms (" << result.bruteForceMs / result.gridMs << "x)";
+		ss << ", " << result.candidates << " candidates, " << result.contacts << " contacts";
+		mySystem->print(ss.str());
+
+		if (result.mismatches > 0)
+			mySystem->print(std::to_string(result.mismatches) + " broadphases found a different number of contacts than the grid", LINETYPE_ERROR);
+	}
+}
+
+void AbstractGame::cmd_physQuery(const std::string& args) {
+	int count = 20000, queries = 10000;
+	std::istringstream in(args);
+	in >> count >> queries;
+
+	PhysicsQueryBenchResult result = PhysicsEngine::benchmarkQueries(std::max(1, count), std::max(1, queries));
+
+	std::ostringstream ss;
+	ss.precision(2);
+	ss << std::fixed << result.objects << " objects, " << result.queries << " queries (us each): raycast " << result.raycastUs
+		<< ", raycast all " << result.raycastAllUs << ", region " << result.regionUs << ", nearest 8 " << result.nearestUs;
+	mySystem->print(ss.str(), LINETYPE_INFO);
+
+	if (result.mismatches > 0)
+		mySystem->print(std::to_string(result.mismatches) + " queries differ from testing every object", LINETYPE_ERROR);
+}
+
+void AbstractGame::cmd_physThreads(const std::string& args) {
+	int count = 20000;
+	std::istringstream in(args);
+	in >> count;
+
+	double single = 0.0;
+	for (auto & result : PhysicsEngine::benchmarkThreads(std::max(1, count), 10, SDL_GetCPUCount())) {
+		if (result.threads == 1)
+			single = result.updateMs;
+
+		std::ostringstream ss;
+		ss.precision(3);
+		ss << std::fixed << result.threads << " threads: " << result.updateMs << " ms";
+		if (result.updateMs > 0.0)
+			ss << " (" << single / result.updateMs << "x)";
+		if (!result.identical)
+			ss << ", results differ from one thread";
+		mySystem->print(ss.str(), result.identical ? LINETYPE_INFO : LINETYPE_ERROR);
+	}
+}
@@ -8,6 +8,59 @@ class AbstractGame {
 		void handleMouseEvents();
 		void updatePhysics();
 
+		/* engine console variables and commands */
+		void registerConsole();
+		void cvar_textCacheBudget(const std::string&);
+		void cmd_textCache(const std::string&);
+		void cvar_dynamicResolution(const std::string&);
+		void cmd_dynres(const std::string&);
+		void cvar_uploadBudget(const std::string&);
+		void cmd_loadStats(const std::string&);
+		void cvar_resourceBudget(const std::string&);
+		void cmd_resStats(const std::string&);
+		void cvar_textureCache(const std::string&);
+		void cmd_textureCache(const std::string&);
+		void cvar_hotReload(const std::string&);
+		void cvar_streamThreshold(const std::string&);
+		void cvar_voices(const std::string&);
+		void cvar_attenuation(const std::string&);
+		void cmd_voices(const std::string&);
+		void cmd_seed(const std::string&);
+		void cmd_screenshot(const std::string&);
+		void cmd_golden(const std::string&);
+		void cmd_audioCapture(const std::string&);
+		void cmd_audioGolden(const std::string&);
+		void cmd_mixStats(const std::string&);
+		void cvar_physicsCellSize(const std::string&);
+		void cvar_physicsBroadphase(const std::string&);
+		void cvar_physicsThreads(const std::string&);
+		void cvar_physicsSleepVelocity(const std::string&);
+		void cvar_physicsSleepSteps(const std::string&);
+		void cmd_physThreads(const std::string&);
+		void cmd_physStats(const std::string&);
+		void cmd_physBench(const std::string&);
+		void cmd_physQuery(const std::string&);
+
+		/* frame captures requested from the console, taken once the frame is drawn */
+		struct FrameCapture {
+			std::string fileName;
+			int tolerance;
+			bool compare;
+		};
+		std::vector<FrameCapture> pendingCaptures;
+		void processCaptures();
+
+		/* audio recorded from the console, saved or compared when the main loop ends */
+		std::string audioCaptureFile, audioGoldenFile;
+		int audioGoldenTolerance;
+		void finishAudioCapture();
+
+		float getFloat(const std::string& variable, float fallback);
+
+		int frameLimit;
+		int exitCode;
+		bool recordGoldens;
+
 	protected:
 		AbstractGame();
 		virtual ~AbstractGame();
@@ -38,6 +91,22 @@ class AbstractGame {
 		void resume() { paused = false; }
 	public:
 		int runMainLoop();
+
+		/**
+		* Executes a console command, e.g. passed on the command line
+		*/
+		void exec(const std::string&);
+
+		/**
+		* @param frames - main loop exits after this many frames, 0 runs until quit
+		*/
+		void setFrameLimit(int frames) { frameLimit = frames; }
+
+		/**
+		* @param record - if true, golden files are written instead of compared,
+		*                 otherwise a missing golden file fails like a mismatch
+		*/
+		void setRecordGoldens(bool record) { recordGoldens = record; }
 };
 
 #endif
\ No newline at end of file
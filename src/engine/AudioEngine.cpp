@@ -1,11 +1,69 @@
 #include "AudioEngine.h"
+#include "ResourceManager.h"
 
-AudioEngine::AudioEngine() : soundOn(true), volume(MIX_MAX_VOLUME) {
-	if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, 4096) < 0)
+#include <algorithm>
+#include <cmath>
+
+std::mutex AudioEngine::registryMutex;
+std::map<Mix_Chunk *, AudioEngine::StreamedSound> AudioEngine::streamedSounds;
+std::vector<Uint8> AudioEngine::silence(STREAM_READ_BYTES, 0);
+size_t AudioEngine::streamThreshold = DEFAULT_STREAM_THRESHOLD;
+std::atomic<bool> AudioEngine::channelPlaying[MAX_VOICES];
+AudioEngine * AudioEngine::instance = nullptr;
+
+AudioEngine::AudioEngine(bool offline) : soundOn(true), volume(MIX_MAX_VOLUME), commands(AUDIO_COMMAND_QUEUE_SIZE), nextVoiceId(1),
+	queueStats(), pushedThisFrame(0), drainCount(0), voiceStats(), mixFrequency(0), mixChannels(0), mixFormat(0),
+	positionalStats(), audioRunning(true), mixed(false), offline(offline), rendering(false), mixerParked(false),
+	renderTime(0.0), mixedFrames(0), allowedFrames(0), mixResumed(0), renderStats(), capturing(false) {
+	if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, offline ? OFFLINE_MIX_BUFFER_SAMPLES : MIX_BUFFER_SAMPLES) < 0)
 		throw EngineException("Failed to init SDL_mixer:", Mix_GetError());
+
+	Mix_QuerySpec(&mixFrequency, &mixFormat, &mixChannels);
+	renderStats.frequency = mixFrequency;
+
+	AttenuationSettings defaults = { DEFAULT_ATTENUATION_MIN_DISTANCE, DEFAULT_ATTENUATION_MAX_DISTANCE, DEFAULT_PAN_DISTANCE };
+	attenuation = defaults;
+
+	Mix_ChannelFinished(&AudioEngine::channelFinished);
+	setVoiceCount(DEFAULT_VOICES);
+
+	instance = this;
+
+	// offline, the mixer thread does the audio thread's work between buffers
+	if (offline)
+		rendering = true;
+	else
+		audioThread = std::thread(&AudioEngine::runAudioThread, this);
+
+	Mix_SetPostMix(&AudioEngine::postMix, this);
 }
 
-AudioEngine::~AudioEngine() {}
+AudioEngine::~AudioEngine() {
+	// unpark the mixer first, it holds the audio lock that removing the hook needs
+	{
+		std::lock_guard<std::mutex> lock(renderMutex);
+		rendering = false;
+	}
+	renderWake.notify_all();
+	Mix_SetPostMix(nullptr, nullptr);
+
+	if (audioThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(streamMutex);
+			audioRunning = false;
+		}
+		audioWake.notify_all();
+		audioThread.join();
+	}
+	instance = nullptr;
+
+	Mix_HaltChannel(-1);
+	releaseOffsetChunks(nullptr);
+}
+
+void AudioEngine::flushCommands() {
+	runOnMixer([this] { drainCommands(); });
+}
 
 void AudioEngine::toggleSound() {
 	soundOn = !soundOn;
@@ -19,17 +77,895 @@ int AudioEngine::getSoundVolume() {
 	return volume;
 }
 
-void AudioEngine::playSound(Mix_Chunk * sound) {
-	playSound(sound, volume);
+VoiceId AudioEngine::playSound(Mix_Chunk * sound) {
+	return playSound(sound, volume);
+}
+
+VoiceId AudioEngine::playSound(Mix_Chunk * sound, const int & _volume) {
+	if (!soundOn || !sound)
+		return 0;
+
+	AudioCommand command = { AudioCommand::PLAY, nextVoiceId++, sound, nullptr, SoundHandle(), _volume, 0.0f, 0, 0 };
+	push(command);
+	return command.voice;
+}
+
+VoiceId AudioEngine::playSound(SoundHandle sound) {
+	return playSound(sound, volume);
+}
+
+VoiceId AudioEngine::playSound(SoundHandle sound, const int & _volume, float pan) {
+	if (!soundOn)
+		return 0;
+
+	// resolved here, the resource manager belongs to the game thread
+	Mix_Chunk * chunk = ResourceManager::getSound(sound);
+	if (!chunk)
+		return 0;
+
+	AudioCommand command = { AudioCommand::PLAY, nextVoiceId++, chunk, nullptr, sound, _volume, pan, 0, 0 };
+	push(command);
+	return command.voice;
+}
+
+void AudioEngine::stopSound(VoiceId voice) {
+	auto emitter = emitters.find(voice);
+	if (emitter != emitters.end()) {
+		voice = emitter->second.voice;
+		emitters.erase(emitter);
+		if (voice == 0)
+			return;	// virtual, nothing is playing
+	}
+
+	AudioCommand command = { AudioCommand::STOP, voice, nullptr, nullptr, SoundHandle(), 0, 0.0f, 0, 0 };
+	push(command);
 }
 
-void AudioEngine::playSound(Mix_Chunk * sound, const int & _volume) {
-	if (soundOn) {
-		Mix_VolumeChunk(sound, _volume);
-		Mix_PlayChannel(-1, sound, 0);
+void AudioEngine::stopSound(SoundHandle sound) {
+	if (!sound.isValid())
+		return;
+
+	for (auto iter = emitters.begin(); iter != emitters.end(); ) {
+		if (iter->second.sound == sound) iter = emitters.erase(iter);
+		else ++iter;
 	}
+
+	AudioCommand command = { AudioCommand::STOP_SOUND, 0, nullptr, nullptr, sound, 0, 0.0f, 0, 0 };
+	push(command);
+}
+
+void AudioEngine::stopAllSounds() {
+	emitters.clear();
+
+	AudioCommand command = { AudioCommand::STOP_ALL, 0, nullptr, nullptr, SoundHandle(), 0, 0.0f, 0, 0 };
+	push(command);
+}
+
+void AudioEngine::setVoiceVolume(VoiceId voice, const int & _volume) {
+	auto emitter = emitters.find(voice);
+	if (emitter != emitters.end()) {
+		emitter->second.volume = _volume;	// sent with the next positional pass
+		return;
+	}
+
+	AudioCommand command = { AudioCommand::SET_VOLUME, voice, nullptr, nullptr, SoundHandle(), _volume, 0.0f, 0, 0 };
+	push(command);
+}
+
+void AudioEngine::setVoicePan(VoiceId voice, float pan) {
+	if (emitters.count(voice))
+		return;
+
+	AudioCommand command = { AudioCommand::SET_PAN, voice, nullptr, nullptr, SoundHandle(), 0, pan, 0, 0 };
+	push(command);
 }
 
 void AudioEngine::playMP3(Mix_Music * mp3, const int & times) {
-	Mix_PlayMusic(mp3, times);
-}
\ No newline at end of file
+	AudioCommand command = { AudioCommand::PLAY_MUSIC, 0, nullptr, mp3, SoundHandle(), times, 0.0f, 0, 0 };
+	push(command);
+}
+
+void AudioEngine::stopMP3() {
+	AudioCommand command = { AudioCommand::STOP_MUSIC, 0, nullptr, nullptr, SoundHandle(), 0, 0.0f, 0, 0 };
+	push(command);
+}
+
+void AudioEngine::update() {
+	updateEmitters();
+
+	queueStats.peakPerFrame = std::max(queueStats.peakPerFrame, pushedThisFrame);
+	pushedThisFrame = 0;
+}
+
+/* POSITIONAL SOUNDS */
+
+VoiceId AudioEngine::playSoundAt(SoundHandle sound, const Vector2f & position, bool loop) {
+	return playSoundAt(sound, position, volume, loop);
+}
+
+VoiceId AudioEngine::playSoundAt(SoundHandle sound, const Vector2f & position, const int & _volume, bool loop) {
+	if (!soundOn)
+		return 0;
+
+	Mix_Chunk * chunk = ResourceManager::getSound(sound);
+	if (!chunk)
+		return 0;
+
+	Emitter emitter = { sound, 0, position, _volume, loop, getTicks(), getSoundLength(chunk), 0, 0.0f };
+	spatialize(position, _volume, emitter.mixVolume, emitter.mixPan);
+
+	VoiceId id = nextVoiceId++;
+	if (emitter.mixVolume > 0) {
+		emitter.voice = id;
+		AudioCommand command = { AudioCommand::PLAY, id, chunk, nullptr, sound, emitter.mixVolume, emitter.mixPan, loop ? -1 : 0, 0 };
+		push(command);
+	}
+	else {
+		positionalStats.virtualized++;
+	}
+
+	emitters[id] = emitter;
+	return id;
+}
+
+void AudioEngine::setVoicePosition(VoiceId voice, const Vector2f & position) {
+	auto emitter = emitters.find(voice);
+	if (emitter != emitters.end())
+		emitter->second.position = position;
+}
+
+void AudioEngine::setListener(const Vector2f & position) {
+	listener = position;
+}
+
+void AudioEngine::setAttenuation(const AttenuationSettings & settings) {
+	attenuation = settings;
+	attenuation.minDistance = std::max(0.0f, attenuation.minDistance);
+	attenuation.maxDistance = std::max(attenuation.minDistance, attenuation.maxDistance);
+}
+
+PositionalStats AudioEngine::getPositionalStats() {
+	PositionalStats stats = positionalStats;
+	stats.emitters = emitters.size();
+	stats.audible = 0;
+	for (auto & emitter : emitters)
+		if (emitter.second.voice != 0) stats.audible++;
+	return stats;
+}
+
+void AudioEngine::spatialize(const Vector2f & position, int _volume, int & mixVolume, float & mixPan) {
+	float dx = position.x - listener.x;
+	float dy = position.y - listener.y;
+	float distance = sqrtf(dx * dx + dy * dy);
+
+	float gain = 1.0f;
+	if (distance >= attenuation.maxDistance)
+		gain = 0.0f;
+	else if (distance > attenuation.minDistance)
+		gain = (attenuation.maxDistance - distance) / (attenuation.maxDistance - attenuation.minDistance);
+
+	mixVolume = (int)(_volume * gain);
+	mixPan = attenuation.panDistance > 0.0f ? std::max(-1.0f, std::min(1.0f, dx / attenuation.panDistance)) : 0.0f;
+}
+
+// one pass over every positional voice, only changes are sent to the audio thread
+void AudioEngine::updateEmitters() {
+	Uint32 now = getTicks();
+
+	lostThisFrame.clear();
+	{
+		std::lock_guard<std::mutex> lock(lostMutex);
+		lostThisFrame.swap(lostVoices);
+	}
+
+	for (auto iter = emitters.begin(); iter != emitters.end(); ) {
+		Emitter & emitter = iter->second;
+		Uint32 elapsed = now - emitter.startTicks;
+		if (!emitter.loop && elapsed >= emitter.lengthMs) {
+			iter = emitters.erase(iter);
+			continue;
+		}
+
+		// a voice the audio thread could not keep goes virtual, unless its settings dropped it
+		if (emitter.voice != 0) {
+			auto lost = std::find_if(lostThisFrame.begin(), lostThisFrame.end(),
+				[&emitter](const LostVoice & voice) { return voice.voice == emitter.voice; });
+			if (lost != lostThisFrame.end()) {
+				if (lost->ended) {
+					iter = emitters.erase(iter);
+					continue;
+				}
+				emitter.voice = 0;
+				emitter.mixVolume = 0;
+				positionalStats.virtualized++;
+			}
+		}
+
+		int mixVolume = 0;
+		float mixPan = 0.0f;
+		spatialize(emitter.position, emitter.volume, mixVolume, mixPan);
+
+		if (mixVolume <= 0) {
+			if (emitter.voice != 0) {
+				AudioCommand command = { AudioCommand::STOP, emitter.voice, nullptr, nullptr, SoundHandle(), 0, 0.0f, 0, 0 };
+				push(command);
+				emitter.voice = 0;
+				positionalStats.virtualized++;
+			}
+		}
+		else if (emitter.voice == 0) {
+			Mix_Chunk * chunk = soundOn ? ResourceManager::getSound(emitter.sound) : nullptr;
+			if (chunk) {
+				emitter.voice = nextVoiceId++;
+				AudioCommand command = { AudioCommand::RESUME, emitter.voice, chunk, nullptr, emitter.sound, mixVolume, mixPan,
+					emitter.loop ? -1 : 0, emitter.loop ? 0 : elapsed };
+				push(command);
+				positionalStats.resumed++;
+			}
+		}
+		else if (mixVolume != emitter.mixVolume || fabsf(mixPan - emitter.mixPan) > PAN_EPSILON) {
+			AudioCommand command = { AudioCommand::SET_MIX, emitter.voice, nullptr, nullptr, SoundHandle(), mixVolume, mixPan, 0, 0 };
+			push(command);
+			positionalStats.updates++;
+		}
+		else {
+			++iter;
+			continue;	// nothing audible changed
+		}
+
+		emitter.mixVolume = mixVolume;
+		emitter.mixPan = mixPan;
+		++iter;
+	}
+}
+
+Uint32 AudioEngine::getSoundLength(Mix_Chunk * sound) {
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto streamed = streamedSounds.find(sound);
+		if (streamed != streamedSounds.end()) {
+			const WavInfo & wav = streamed->second.wav;
+			Uint32 frameBytes = SDL_AUDIO_BITSIZE(wav.format) / 8 * wav.channels;
+			if (frameBytes == 0 || wav.frequency <= 0)
+				return 0;
+			return (Uint32)((Uint64)wav.dataSize / frameBytes * 1000 / wav.frequency);
+		}
+	}
+
+	Uint32 frameBytes = SDL_AUDIO_BITSIZE(mixFormat) / 8 * mixChannels;
+	return (Uint32)((Uint64)sound->alen / frameBytes * 1000 / mixFrequency);
+}
+
+/* COMMAND QUEUE */
+
+void AudioEngine::push(const AudioCommand & command) {
+	if (!commands.push(command)) {
+		// full, the audio thread fell behind, so run the backlog now rather than lose a stop
+		queueStats.stalls++;
+		flushCommands();
+		commands.push(command);
+	}
+
+	queueStats.pushed++;
+	queueStats.peakDepth = std::max(queueStats.peakDepth, commands.size());
+	pushedThisFrame++;
+}
+
+void AudioEngine::drainCommands() {
+	std::lock_guard<std::mutex> lock(drainMutex);
+
+	AudioCommand command;
+	bool drained = false;
+	while (commands.pop(command)) {
+		execute(command);
+		drained = true;
+	}
+
+	if (drained)
+		drainCount++;
+
+	releaseOffsetChunks(nullptr);
+}
+
+void AudioEngine::execute(const AudioCommand & command) {
+	int channel = -1;
+
+	switch (command.type) {
+		case AudioCommand::PLAY:
+		case AudioCommand::RESUME:
+			channel = playVoice(command.voice, command.sound, command.soundHandle, command.value, command.loops, command.offsetMs,
+				command.type == AudioCommand::RESUME);
+			if (channel >= 0 && command.pan != 0.0f)
+				applyPan(channel, command.pan);
+			break;
+		case AudioCommand::STOP:
+			channel = findVoice(command.voice);
+			if (channel >= 0)
+				Mix_HaltChannel(channel);
+			break;
+		case AudioCommand::STOP_SOUND:
+			for (int i = 0; i < (int)voices.size(); i++)
+				if (channelPlaying[i] && voices[i].sound == command.soundHandle)
+					Mix_HaltChannel(i);
+			break;
+		case AudioCommand::STOP_ALL:
+			Mix_HaltChannel(-1);
+			break;
+		case AudioCommand::SET_VOLUME:
+			channel = findVoice(command.voice);
+			if (channel >= 0)
+				Mix_Volume(channel, command.value);
+			break;
+		case AudioCommand::SET_PAN:
+			channel = findVoice(command.voice);
+			if (channel >= 0)
+				applyPan(channel, command.pan);
+			break;
+		case AudioCommand::SET_MIX:
+			channel = findVoice(command.voice);
+			if (channel >= 0) {
+				Mix_Volume(channel, command.value);
+				applyPan(channel, command.pan);
+			}
+			break;
+		case AudioCommand::PLAY_MUSIC:
+			Mix_PlayMusic(command.music, command.value);
+			break;
+		case AudioCommand::STOP_MUSIC:
+			Mix_HaltMusic();
+			break;
+	}
+}
+
+int AudioEngine::findVoice(VoiceId voice) {
+	for (int i = 0; i < (int)voices.size(); i++)
+		if (channelPlaying[i] && voices[i].id == voice)
+			return i;
+	return -1;
+}
+
+void AudioEngine::applyPan(int channel, float pan) {
+	pan = std::max(-1.0f, std::min(1.0f, pan));
+	Uint8 left = (Uint8)(255 * std::min(1.0f, 1.0f - pan));
+	Uint8 right = (Uint8)(255 * std::min(1.0f, 1.0f + pan));
+	Mix_SetPanning(channel, left, right);
+}
+
+// mixer thread, once per mix buffer
+void AudioEngine::postMix(void * engine, Uint8 * stream, int len) {
+	AudioEngine * self = (AudioEngine *)engine;
+	self->mixed = true;
+	self->audioWake.notify_one();
+	self->recordMix(stream, len);
+}
+
+/* OFFLINE RENDERING */
+
+void AudioEngine::recordMix(Uint8 * stream, int len) {
+	Uint64 mixEnd = SDL_GetPerformanceCounter();
+
+	int active = 0;
+	for (int i = 0; i < MAX_VOICES; i++)
+		if (channelPlaying[i]) active++;
+
+	Uint32 frames = len / (SDL_AUDIO_BITSIZE(mixFormat) / 8 * mixChannels);
+
+	std::unique_lock<std::mutex> lock(renderMutex);
+	renderStats.frames += frames;
+	renderStats.voiceFrames += (Uint64)active * frames;
+	if (capturing)
+		captured.insert(captured.end(), stream, stream + len);
+
+	if (!rendering)
+		return;
+
+	if (mixResumed != 0)
+		renderStats.mixSeconds += (double)(mixEnd - mixResumed) / SDL_GetPerformanceFrequency();
+
+	mixedFrames += frames;
+	while (rendering) {
+		if (mixerTask) {
+			mixerTask();
+			mixerTask = nullptr;
+			renderWake.notify_all();
+			continue;
+		}
+
+		if (mixedFrames < allowedFrames)
+			break;
+
+		mixerParked = true;
+		renderWake.notify_all();
+		renderWake.wait(lock);
+	}
+	mixerParked = false;
+	lock.unlock();
+
+	// the game thread waits while this runs, so commands always land in the same buffer
+	drainCommands();
+	serviceStreams();
+	mixResumed = SDL_GetPerformanceCounter();
+}
+
+void AudioEngine::runOnMixer(const std::function<void()> & task) {
+	std::unique_lock<std::mutex> lock(renderMutex);
+	if (!rendering) {
+		lock.unlock();
+		task();
+		return;
+	}
+
+	// a parked mixer holds the audio lock, so it has to make the call itself
+	mixerTask = task;
+	renderWake.notify_all();
+	renderWake.wait(lock, [this] { return !mixerTask || !rendering; });
+}
+
+Uint32 AudioEngine::getTicks() {
+	// offline, everything timed by the engine follows the game clock so runs are repeatable
+	return offline ? (Uint32)(renderTime * 1000.0) : SDL_GetTicks();
+}
+
+void AudioEngine::advanceRender(double seconds) {
+	if (!offline)
+		return;
+
+	std::unique_lock<std::mutex> lock(renderMutex);
+	renderTime += seconds;
+	allowedFrames = (Uint64)(renderTime * mixFrequency);
+	renderWake.notify_all();
+	renderWake.wait(lock, [this] { return (mixerParked && mixedFrames >= allowedFrames) || !rendering; });
+}
+
+AudioRenderStats AudioEngine::getRenderStats() {
+	std::lock_guard<std::mutex> lock(renderMutex);
+	return renderStats;
+}
+
+void AudioEngine::resetRenderStats() {
+	std::lock_guard<std::mutex> lock(renderMutex);
+	renderStats = AudioRenderStats();
+	renderStats.frequency = mixFrequency;
+}
+
+void AudioEngine::startCapture() {
+	std::lock_guard<std::mutex> lock(renderMutex);
+	captured.clear();
+	capturing = true;
+}
+
+std::vector<Uint8> AudioEngine::stopCapture() {
+	std::lock_guard<std::mutex> lock(renderMutex);
+	capturing = false;
+
+	std::vector<Uint8> samples;
+	samples.swap(captured);
+	return samples;
+}
+
+bool AudioEngine::isCapturing() {
+	std::lock_guard<std::mutex> lock(renderMutex);
+	return capturing;
+}
+
+bool AudioEngine::saveWav(const std::string & fileName, const std::vector<Uint8> & samples) {
+	SDL_RWops * file = SDL_RWFromFile(fileName.c_str(), "wb");
+	if (nullptr == file)
+		return false;
+
+	Uint16 bits = SDL_AUDIO_BITSIZE(mixFormat);
+	Uint16 frameBytes = bits / 8 * mixChannels;
+	Uint32 dataSize = (Uint32)samples.size();
+
+	// samples are in host order, which is what WAV expects on little endian machines
+	SDL_RWwrite(file, "RIFF", 1, 4);
+	SDL_WriteLE32(file, 36 + dataSize);
+	SDL_RWwrite(file, "WAVEfmt ", 1, 8);
+	SDL_WriteLE32(file, 16);
+	SDL_WriteLE16(file, SDL_AUDIO_ISFLOAT(mixFormat) ? 3 : 1);
+	SDL_WriteLE16(file, (Uint16)mixChannels);
+	SDL_WriteLE32(file, mixFrequency);
+	SDL_WriteLE32(file, mixFrequency * frameBytes);
+	SDL_WriteLE16(file, frameBytes);
+	SDL_WriteLE16(file, bits);
+	SDL_RWwrite(file, "data", 1, 4);
+	SDL_WriteLE32(file, dataSize);
+
+	bool written = samples.empty() || SDL_RWwrite(file, samples.data(), 1, samples.size()) == samples.size();
+	SDL_RWclose(file);
+	return written;
+}
+
+int AudioEngine::compareWav(const std::string & fileName, const std::vector<Uint8> & samples, int tolerance) {
+	SDL_RWops * file = SDL_RWFromFile(fileName.c_str(), "rb");
+	if (nullptr == file)
+		return -1;
+
+	WavInfo wav;
+	if (!AudioStream::parseWav(file, wav) || wav.channels != mixChannels || wav.frequency != mixFrequency
+		|| SDL_AUDIO_BITSIZE(wav.format) != SDL_AUDIO_BITSIZE(mixFormat) || SDL_AUDIO_ISFLOAT(wav.format) != SDL_AUDIO_ISFLOAT(mixFormat)) {
+		SDL_RWclose(file);
+		return -1;
+	}
+
+	std::vector<Uint8> golden(wav.dataSize);
+	SDL_RWseek(file, wav.dataOffset, RW_SEEK_SET);
+	size_t read = SDL_RWread(file, golden.data(), 1, golden.size());
+	SDL_RWclose(file);
+	golden.resize(read);
+
+	int mismatches = 0;
+	size_t common = std::min(golden.size(), samples.size());
+	if (mixFormat == AUDIO_S16SYS) {
+		const Sint16 * a = (const Sint16 *)golden.data();
+		const Sint16 * b = (const Sint16 *)samples.data();
+		for (size_t i = 0; i < common / 2; i++)
+			if (abs(a[i] - b[i]) > tolerance) mismatches++;
+		mismatches += (int)((std::max(golden.size(), samples.size()) - common) / 2);
+	}
+	else {
+		// other formats are compared byte by byte
+		for (size_t i = 0; i < common; i++)
+			if (abs(golden[i] - samples[i]) > tolerance) mismatches++;
+		mismatches += (int)(std::max(golden.size(), samples.size()) - common);
+	}
+
+	return mismatches;
+}
+
+AudioQueueStats AudioEngine::getQueueStats() {
+	AudioQueueStats stats = queueStats;
+	stats.depth = commands.size();
+	stats.capacity = commands.capacity();
+	stats.drains = drainCount;
+	return stats;
+}
+
+void AudioEngine::resetQueueStats() {
+	queueStats = AudioQueueStats();
+	drainCount = 0;
+}
+
+/* VOICES */
+
+void AudioEngine::channelFinished(int channel) {
+	if (channel >= 0 && channel < MAX_VOICES)
+		channelPlaying[channel] = false;
+}
+
+void AudioEngine::setVoiceCount(int count) {
+	count = std::max(1, std::min(MAX_VOICES, count));
+
+	// channels past the new count are halted, clearing their flags
+	runOnMixer([count] { Mix_AllocateChannels(count); });
+
+	std::lock_guard<std::mutex> lock(drainMutex);
+
+	Voice idle = { 0, SoundHandle(), 0, 0 };
+	voices.resize(count, idle);
+	voiceStats.voices = count;
+}
+
+void AudioEngine::setSoundSettings(SoundHandle sound, const SoundSettings & settings) {
+	std::lock_guard<std::mutex> lock(drainMutex);
+	soundStates[sound].settings = settings;
+}
+
+SoundSettings AudioEngine::getSoundSettings(SoundHandle sound) {
+	std::lock_guard<std::mutex> lock(drainMutex);
+	auto state = soundStates.find(sound);
+	if (state == soundStates.end()) {
+		SoundSettings defaults = { 0, 0, 0 };
+		return defaults;
+	}
+	return state->second.settings;
+}
+
+int AudioEngine::allocateVoice(SoundHandle handle, const SoundSettings & settings, bool resume) {
+	int freeVoice = -1, oldestInstance = -1, victim = -1, instances = 0;
+
+	for (int i = 0; i < (int)voices.size(); i++) {
+		if (!channelPlaying[i]) {
+			if (freeVoice < 0) freeVoice = i;
+			continue;
+		}
+
+		const Voice & voice = voices[i];
+		if (handle.isValid() && voice.sound == handle) {
+			instances++;
+			if (oldestInstance < 0 || voice.startTicks < voices[oldestInstance].startTicks)
+				oldestInstance = i;
+		}
+
+		// lowest priority first, the oldest of those
+		if (voice.priority <= settings.priority && (victim < 0 || voice.priority < voices[victim].priority
+			|| (voice.priority == voices[victim].priority && voice.startTicks < voices[victim].startTicks)))
+			victim = i;
+	}
+
+	// resumed voices were already counted, and stealing for them would only make another voice virtual
+	if (resume)
+		return freeVoice;
+
+	if (settings.maxInstances > 0 && instances >= settings.maxInstances) {
+		voiceStats.restarted++;
+		reportLost(voices[oldestInstance].id, true);
+		return oldestInstance;
+	}
+
+	if (freeVoice >= 0)
+		return freeVoice;
+
+	if (victim >= 0) {
+		voiceStats.stolen++;
+		reportLost(voices[victim].id, false);
+		return victim;
+	}
+
+	voiceStats.dropped++;
+	return -1;
+}
+
+void AudioEngine::reportLost(VoiceId voice, bool ended) {
+	if (voice == 0)
+		return;
+
+	LostVoice lost = { voice, ended };
+	std::lock_guard<std::mutex> lock(lostMutex);
+	lostVoices.push_back(lost);
+}
+
+int AudioEngine::playVoice(VoiceId id, Mix_Chunk * sound, SoundHandle handle, const int & _volume, int loops, Uint32 offsetMs, bool resume) {
+	SoundSettings settings = { 0, 0, 0 };
+	Uint32 now = getTicks();
+
+	if (handle.isValid()) {
+		SoundState & state = soundStates[handle];
+		settings = state.settings;
+		if (!resume) {
+			if (state.played && now - state.lastPlayTicks < state.settings.retriggerMs) {
+				voiceStats.throttled++;
+				reportLost(id, true);
+				return -1;
+			}
+			state.lastPlayTicks = now;
+			state.played = true;
+		}
+	}
+
+	int channel = allocateVoice(handle, settings, resume);
+	if (channel < 0) {
+		reportLost(id, false);
+		return -1;
+	}
+
+	// the finished callback runs inside the halt, so the flag is clear afterwards
+	if (channelPlaying[channel])
+		Mix_HaltChannel(channel);
+
+	Mix_Chunk * playing = sound;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto streamed = streamedSounds.find(sound);
+		if (streamed != streamedSounds.end()) {
+			// streams play once, the placeholder loops until the stream ends
+			if (!startStream(channel, streamed->second, offsetMs)) {
+				reportLost(id, true);
+				return -1;
+			}
+			loops = -1;
+		}
+		else if (offsetMs > 0) {
+			playing = createOffsetChunk(sound, offsetMs);
+			if (!playing) {
+				reportLost(id, true);
+				return -1;	// would already have finished
+			}
+		}
+	}
+
+	Mix_Volume(channel, _volume);
+	channelPlaying[channel] = true;
+	if (Mix_PlayChannel(channel, playing, loops) < 0) {
+		channelPlaying[channel] = false;
+		Mix_UnregisterAllEffects(channel);
+		if (playing != sound)
+			Mix_FreeChunk(playing);
+		reportLost(id, true);
+		return -1;
+	}
+
+	if (playing != sound) {
+		OffsetChunk offsetChunk = { sound, playing, channel };
+		offsetChunks.push_back(offsetChunk);
+	}
+
+	Voice voice = { id, handle, settings.priority, now };
+	voices[channel] = voice;
+	voiceStats.played++;
+
+	int active = 0;
+	for (size_t i = 0; i < voices.size(); i++)
+		if (channelPlaying[i]) active++;
+	voiceStats.peak = std::max(voiceStats.peak, active);
+	return channel;
+}
+
+Mix_Chunk * AudioEngine::createOffsetChunk(Mix_Chunk * sound, Uint32 offsetMs) {
+	// loaded chunks are already in the mixer format
+	Uint32 frameBytes = SDL_AUDIO_BITSIZE(mixFormat) / 8 * mixChannels;
+	Uint64 offset = (Uint64)offsetMs * mixFrequency / 1000 * frameBytes;
+	if (offset >= sound->alen)
+		return nullptr;
+
+	// shares the sample data, freeing it leaves the source alone
+	return Mix_QuickLoad_RAW(sound->abuf + offset, sound->alen - (Uint32)offset);
+}
+
+void AudioEngine::releaseOffsetChunks(Mix_Chunk * source) {
+	for (auto iter = offsetChunks.begin(); iter != offsetChunks.end(); ) {
+		bool stopped = !channelPlaying[iter->channel] || Mix_GetChunk(iter->channel) != iter->chunk;
+		if (source ? iter->source == source : stopped) {
+			Mix_FreeChunk(iter->chunk);	// halts it if still playing
+			iter = offsetChunks.erase(iter);
+		}
+		else {
+			++iter;
+		}
+	}
+}
+
+VoiceStats AudioEngine::getVoiceStats() {
+	std::lock_guard<std::mutex> lock(drainMutex);
+	VoiceStats stats = voiceStats;
+	stats.active = 0;
+	for (size_t i = 0; i < voices.size(); i++)
+		if (channelPlaying[i]) stats.active++;
+	return stats;
+}
+
+void AudioEngine::resetVoiceStats() {
+	std::lock_guard<std::mutex> lock(drainMutex);
+	int count = voiceStats.voices;
+	voiceStats = VoiceStats();
+	voiceStats.voices = count;
+	positionalStats = PositionalStats();
+}
+
+std::map<SoundHandle, int> AudioEngine::getVoiceUsage() {
+	std::lock_guard<std::mutex> lock(drainMutex);
+	std::map<SoundHandle, int> usage;
+	for (size_t i = 0; i < voices.size(); i++)
+		if (channelPlaying[i]) usage[voices[i].sound]++;
+	return usage;
+}
+
+/* STREAMING */
+
+Mix_Chunk * AudioEngine::createStreamedSound(const std::string & file, SDL_RWops * rw) {
+	StreamedSound sound;
+	sound.file = file;
+	if (!AudioStream::parseWav(rw, sound.wav))
+		return nullptr;
+
+	// loops silently under the stream, which the channel effect writes over
+	Mix_Chunk * placeholder = Mix_QuickLoad_RAW(silence.data(), (Uint32)silence.size());
+	if (nullptr == placeholder)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	streamedSounds[placeholder] = sound;
+	return placeholder;
+}
+
+bool AudioEngine::isStreamed(Mix_Chunk * sound) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return streamedSounds.count(sound) > 0;
+}
+
+void AudioEngine::freeChunk(Mix_Chunk * sound) {
+	if (instance) {
+		instance->runOnMixer([sound] {
+			// a queued play may still refer to it, or a resumed voice play from its data
+			instance->drainCommands();
+			{
+				std::lock_guard<std::mutex> lock(instance->drainMutex);
+				instance->releaseOffsetChunks(sound);
+			}
+
+			// halts every channel playing it, which also ends their streams
+			Mix_FreeChunk(sound);
+		});
+	}
+	else {
+		Mix_FreeChunk(sound);
+	}
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	streamedSounds.erase(sound);
+}
+
+void AudioEngine::freeMusic(Mix_Music * music) {
+	if (instance) {
+		instance->runOnMixer([music] {
+			instance->drainCommands();
+			Mix_FreeMusic(music);
+		});
+	}
+	else {
+		Mix_FreeMusic(music);
+	}
+}
+
+bool AudioEngine::startStream(int channel, const StreamedSound & sound, Uint32 offsetMs) {
+	SDL_RWops * rw = ResourceManager::openAsset(sound.file);
+	if (nullptr == rw)
+		return false;
+
+	std::shared_ptr<AudioStream> stream;
+	try {
+		Uint32 frameBytes = SDL_AUDIO_BITSIZE(sound.wav.format) / 8 * sound.wav.channels;
+		Uint32 startBytes = (Uint32)std::min((Uint64)offsetMs * sound.wav.frequency / 1000 * frameBytes, (Uint64)sound.wav.dataSize);
+		stream = std::make_shared<AudioStream>(rw, sound.wav, mixFrequency, mixFormat, mixChannels, startBytes);
+	}
+	catch (EngineException &) {
+		return false;
+	}
+
+	// start with a full ring, so the first mix buffer is not silent
+	stream->fill();
+	if (!Mix_RegisterEffect(channel, &AudioEngine::streamEffect, &AudioEngine::streamDone, stream.get()))
+		return false;
+
+	ActiveStream active = { channel, stream };
+	std::lock_guard<std::mutex> lock(streamMutex);
+	activeStreams.push_back(active);
+	return true;
+}
+
+// mixer thread, the buffer holds the silent placeholder and is overwritten
+void AudioEngine::streamEffect(int, void * buffer, int len, void * stream) {
+	((AudioStream *)stream)->read((Uint8 *)buffer, len);
+}
+
+// called when the channel halts or the effect is removed
+void AudioEngine::streamDone(int, void * stream) {
+	((AudioStream *)stream)->release();
+}
+
+void AudioEngine::runAudioThread() {
+	while (true) {
+		drainCommands();
+		serviceStreams();
+
+		std::unique_lock<std::mutex> lock(streamMutex);
+		if (!audioRunning)
+			return;
+
+		// woken after each mix buffer, the timeout bounds command latency with large buffers
+		audioWake.wait_for(lock, std::chrono::milliseconds(STREAM_DECODE_INTERVAL_MS), [this] { return mixed.exchange(false) || !audioRunning; });
+	}
+}
+
+void AudioEngine::serviceStreams() {
+	std::lock_guard<std::mutex> lock(streamMutex);
+
+	for (auto iter = activeStreams.begin(); iter != activeStreams.end(); ) {
+		if (iter->stream->isReleased()) {
+			iter = activeStreams.erase(iter);
+			continue;
+		}
+
+		// the done callback releases the stream, it is erased next pass
+		if (iter->stream->isFinished())
+			Mix_HaltChannel(iter->channel);
+		else
+			iter->stream->fill();
+		++iter;
+	}
+}
+
+size_t AudioEngine::getActiveStreamCount() {
+	std::lock_guard<std::mutex> lock(streamMutex);
+	return activeStreams.size();
+}
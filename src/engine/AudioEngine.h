@@ -1,16 +1,257 @@
 #ifndef __AUDIO_ENGINE_H__
 #define __AUDIO_ENGINE_H__
 
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
 #include <SDL_mixer.h>
 
 #include "EngineCommon.h"
+#include "GameMath.h"
+#include "AudioStream.h"
+#include "ResourcePool.h"
+#include "SPSCQueue.h"
+
+typedef ResourceHandle<Mix_Chunk *> SoundHandle;
+
+/**
+* Identifies one play of a sound, 0 if it was not played
+*/
+typedef Uint32 VoiceId;
+
+static const size_t DEFAULT_STREAM_THRESHOLD = 1024 * 1024;	// bytes of WAV file
+static const Uint32 STREAM_DECODE_INTERVAL_MS = 10;
+
+static const int DEFAULT_VOICES = 16;
+static const int MAX_VOICES = 256;
+
+static const size_t AUDIO_COMMAND_QUEUE_SIZE = 256;
+
+static const int MIX_BUFFER_SAMPLES = 4096;
+static const int OFFLINE_MIX_BUFFER_SAMPLES = 512;	// finer steps behind the game clock
+
+static const float DEFAULT_ATTENUATION_MIN_DISTANCE = 64.0f;
+static const float DEFAULT_ATTENUATION_MAX_DISTANCE = 1024.0f;
+static const float DEFAULT_PAN_DISTANCE = 512.0f;
+static const float PAN_EPSILON = 0.01f;
+
+/**
+* How many copies of a sound may play at once and how it competes for voices
+*/
+struct SoundSettings {
+	int maxInstances;		// 0 means unlimited, at the cap the oldest instance is restarted
+	Uint32 retriggerMs;		// plays within this interval of the last one are dropped
+	int priority;			// may steal voices of lower or equal priority when all are busy
+};
+
+struct VoiceStats {
+	int voices, active, peak;
+	Uint32 played, stolen, restarted, throttled, dropped;
+};
+
+/**
+* How positional sounds fade with distance from the listener, in world units
+* Volume falls off linearly between the two distances
+*/
+struct AttenuationSettings {
+	float minDistance;	// full volume up to here
+	float maxDistance;	// silent, so virtual, from here on
+	float panDistance;	// horizontal offset at which a sound is fully left or right
+};
+
+struct PositionalStats {
+	size_t emitters, audible;
+	Uint32 virtualized, resumed, updates;
+};
+
+struct AudioQueueStats {
+	size_t depth, peakDepth, capacity;
+	size_t peakPerFrame;	// most commands issued in one frame
+	Uint32 pushed, drains;
+	Uint32 stalls;			// pushes that found the queue full and drained it on the game thread
+};
+
+struct AudioRenderStats {
+	Uint64 frames;			// sample frames mixed
+	Uint64 voiceFrames;		// sample frames mixed per playing voice, summed
+	double mixSeconds;		// time the mixer took, only measured when rendering offline
+	int frequency;
+};
 
 class AudioEngine {
 	friend class XCube2Engine;
 	private:
-		AudioEngine();
+		/**
+		* @param offline - mix in step with advanceRender() instead of in real time,
+		*                  the audio driver should not be paced by a device (e.g. "disk")
+		*/
+		AudioEngine(bool offline = false);
 		bool soundOn;
 		int volume;
+
+		/* commands from the game thread, executed on the audio thread */
+		struct AudioCommand {
+			// RESUME plays a virtual voice again, outside of retriggerMs and maxInstances and only on a free voice
+			enum Type { PLAY, RESUME, STOP, STOP_SOUND, STOP_ALL, SET_VOLUME, SET_PAN, SET_MIX, PLAY_MUSIC, STOP_MUSIC } type;
+			VoiceId voice;
+			Mix_Chunk * sound;
+			Mix_Music * music;
+			SoundHandle soundHandle;
+			int value;		// volume, or loops of music
+			float pan;
+			int loops;
+			Uint32 offsetMs;	// where to start playing, for resumed virtual voices
+		};
+
+		SPSCQueue<AudioCommand> commands;
+		std::mutex drainMutex;	// held while commands run, guards the voice manager below
+		VoiceId nextVoiceId;
+		AudioQueueStats queueStats;
+		size_t pushedThisFrame;
+		std::atomic<Uint32> drainCount;
+
+		// lets freeChunk() run queued commands before a sound they refer to goes away
+		static AudioEngine * instance;
+
+		void push(const AudioCommand & command);
+		void drainCommands();
+		void execute(const AudioCommand & command);
+		int findVoice(VoiceId voice);
+		static void applyPan(int channel, float pan);
+
+		/* voice manager, one voice per mixer channel */
+		struct Voice {
+			VoiceId id;
+			SoundHandle sound;	// invalid for sounds played without a handle
+			int priority;
+			Uint32 startTicks;
+		};
+
+		struct SoundState {
+			SoundSettings settings;
+			Uint32 lastPlayTicks;
+			bool played;
+		};
+
+		std::vector<Voice> voices;
+		std::map<SoundHandle, SoundState> soundStates;	// by full handle, so a reused slot starts afresh
+		VoiceStats voiceStats;
+
+		// cleared by the mixer when a channel finishes
+		static std::atomic<bool> channelPlaying[MAX_VOICES];
+		static void channelFinished(int channel);
+
+		int playVoice(VoiceId id, Mix_Chunk * sound, SoundHandle handle, const int & volume, int loops, Uint32 offsetMs, bool resume);
+		int allocateVoice(SoundHandle handle, const SoundSettings & settings, bool resume);
+
+		/* voices that failed to play or were taken by another play, reported back to the game thread */
+		struct LostVoice {
+			VoiceId voice;
+			bool ended;		// dropped by its sound's settings or unplayable, rather than short of a free voice
+		};
+
+		std::mutex lostMutex;
+		std::vector<LostVoice> lostVoices, lostThisFrame;
+
+		void reportLost(VoiceId voice, bool ended);
+
+		/* chunks that start part way into a sound, freed once their channel stops */
+		struct OffsetChunk {
+			Mix_Chunk * source;
+			Mix_Chunk * chunk;
+			int channel;
+		};
+
+		std::vector<OffsetChunk> offsetChunks;
+		int mixFrequency, mixChannels;
+		Uint16 mixFormat;
+
+		Mix_Chunk * createOffsetChunk(Mix_Chunk * sound, Uint32 offsetMs);
+		void releaseOffsetChunks(Mix_Chunk * source);	// nullptr releases the ones that stopped
+
+		/* positional sounds, game thread only */
+		struct Emitter {
+			SoundHandle sound;
+			VoiceId voice;			// the voice playing it, 0 while virtual
+			Vector2f position;
+			int volume;
+			bool loop;
+			Uint32 startTicks, lengthMs;
+			int mixVolume;			// as last sent to the audio thread
+			float mixPan;
+		};
+
+		std::map<VoiceId, Emitter> emitters;	// keyed by the id returned from playSoundAt()
+		Vector2f listener;
+		AttenuationSettings attenuation;
+		PositionalStats positionalStats;
+
+		void spatialize(const Vector2f & position, int volume, int & mixVolume, float & mixPan);
+		void updateEmitters();
+		Uint32 getSoundLength(Mix_Chunk * sound);
+
+		/* streamed sounds, the chunk handed out is a silent placeholder */
+		struct StreamedSound {
+			std::string file;
+			WavInfo wav;
+		};
+
+		struct ActiveStream {
+			int channel;
+			std::shared_ptr<AudioStream> stream;
+		};
+
+		static std::mutex registryMutex;
+		static std::map<Mix_Chunk *, StreamedSound> streamedSounds;
+		static std::vector<Uint8> silence;
+		static size_t streamThreshold;
+
+		/* audio thread, runs commands and decodes streams once per mix buffer */
+		std::thread audioThread;
+		std::mutex streamMutex;
+		std::condition_variable audioWake;
+		std::vector<ActiveStream> activeStreams;
+		bool audioRunning;
+		std::atomic<bool> mixed;
+
+		void runAudioThread();
+		bool startStream(int channel, const StreamedSound &, Uint32 offsetMs);
+
+		void serviceStreams();
+
+		static void postMix(void * engine, Uint8 * stream, int len);
+
+		/*
+		* Offline rendering: the mixer thread parks in postMix once it has mixed up to the game
+		* clock. While parked it holds SDL's audio lock, so it also runs the queued commands and
+		* any other mixer calls the game thread needs (runOnMixer)
+		*/
+		bool offline;
+		std::mutex renderMutex;
+		std::condition_variable renderWake;
+		bool rendering, mixerParked;
+		double renderTime;
+		Uint64 mixedFrames, allowedFrames;
+		std::function<void()> mixerTask;
+		Uint64 mixResumed;
+		AudioRenderStats renderStats;
+
+		bool capturing;
+		std::vector<Uint8> captured;
+
+		void recordMix(Uint8 * stream, int len);
+		void runOnMixer(const std::function<void()> & task);
+		void flushCommands();
+		Uint32 getTicks();
+
+		static void streamEffect(int channel, void * buffer, int len, void * stream);
+		static void streamDone(int channel, void * stream);
 	public:
 		~AudioEngine();
 		void toggleSound();
@@ -22,15 +263,67 @@ class AudioEngine {
 		void setSoundVolume(const int &);
 		int getSoundVolume();
 
-		void playSound(Mix_Chunk * sound);
+		/*
+		* Sound and music calls below only queue a command for the audio thread and
+		* return straight away, they never wait for the mixer
+		*/
+
+		VoiceId playSound(Mix_Chunk * sound);
 
 		/**
 		* Call this to manually specify the volume of the sound
+		* The volume applies to this voice only, other copies of the sound keep theirs
 		*
 		* @param sound - the sound to play
 		* @param volume - the volume at which to play in range [0..128]
 		*/
-		void playSound(Mix_Chunk * sound, const int & _volume);
+		VoiceId playSound(Mix_Chunk * sound, const int & _volume);
+
+		/**
+		* Plays a loaded sound subject to its SoundSettings
+		* @param pan - from -1 (left) to 1 (right)
+		* @return the voice to adjust or stop later, it may still be dropped by the voice manager
+		*/
+		VoiceId playSound(SoundHandle sound);
+		VoiceId playSound(SoundHandle sound, const int & _volume, float pan = 0.0f);
+
+		/**
+		* Plays a sound at a world position, attenuated and panned relative to the listener
+		* Every frame update() recomputes volume and pan for all positional voices in one pass.
+		* Voices out of earshot are virtual: they keep time but release their mixer channel,
+		* and resume from where they would be once they are audible again. A voice stolen by
+		* another sound, or that found no free voice, turns virtual the same way
+		*
+		* @param loop - play until stopped rather than once, looping sounds resume from the start
+		* @return the voice, which keeps its id through virtualisation
+		*/
+		VoiceId playSoundAt(SoundHandle sound, const Vector2f & position, bool loop = false);
+		VoiceId playSoundAt(SoundHandle sound, const Vector2f & position, const int & _volume, bool loop = false);
+		void setVoicePosition(VoiceId voice, const Vector2f & position);
+
+		/**
+		* The point positional sounds are heard from, usually the centre of the camera
+		*/
+		void setListener(const Vector2f & position);
+		Vector2f getListener() { return listener; }
+
+		void setAttenuation(const AttenuationSettings & settings);
+		AttenuationSettings getAttenuation() { return attenuation; }
+		PositionalStats getPositionalStats();
+
+		/**
+		* Stops one voice, or every voice playing the sound
+		* Voices that already finished or were reused are left alone
+		*/
+		void stopSound(VoiceId voice);
+		void stopSound(SoundHandle sound);
+		void stopAllSounds();
+
+		/**
+		* The pan of positional voices follows their position, so setVoicePan() ignores them
+		*/
+		void setVoiceVolume(VoiceId voice, const int & _volume);
+		void setVoicePan(VoiceId voice, float pan);
 
 		/**
 		* Plays mp3 file given amount of times
@@ -39,6 +332,95 @@ class AudioEngine {
 		* @param times - number of times, -1 will play indefinitely
 		*/
 		void playMP3(Mix_Music * mp3, const int & times);
+		void stopMP3();
+
+		/**
+		* Called once per frame by the main loop, updates positional voices
+		*/
+		void update();
+
+		AudioQueueStats getQueueStats();
+		void resetQueueStats();
+
+		/**
+		* Offline mode: lets the mixer run until it has mixed the given game time
+		* and waits for it, so the output is the same on every run
+		* Commands queued before the call take effect at the start of the next mix buffer
+		*/
+		void advanceRender(double seconds);
+		bool isOffline() const { return offline; }
+
+		AudioRenderStats getRenderStats();
+		void resetRenderStats();
+
+		/**
+		* Records the mixed output from the next buffer on
+		*/
+		void startCapture();
+		std::vector<Uint8> stopCapture();
+		bool isCapturing();
+
+		/**
+		* Saves samples in the mixer format as a WAV file
+		*/
+		bool saveWav(const std::string & fileName, const std::vector<Uint8> & samples);
+
+		/**
+		* Compares samples in the mixer format with a WAV file
+		* @param tolerance - largest difference per sample that still counts as a match
+		* @return the number of samples that differ, missing or extra samples included,
+		*         or -1 if the file can't be read or is in another format
+		*/
+		int compareWav(const std::string & fileName, const std::vector<Uint8> & samples, int tolerance);
+
+		/**
+		* Resizes the mixer channel pool, voices above the new count are stopped
+		* Unlike the calls above this waits for the audio thread, so not for use every frame
+		*
+		* @param count - clamped to [1..MAX_VOICES]
+		*/
+		void setVoiceCount(int count);
+		int getVoiceCount() const { return (int)voices.size(); }
+
+		void setSoundSettings(SoundHandle sound, const SoundSettings & settings);
+		SoundSettings getSoundSettings(SoundHandle sound);
+
+		/**
+		* @return voices in use, peak and counters since the last reset
+		*/
+		VoiceStats getVoiceStats();
+		void resetVoiceStats();
+
+		/**
+		* @return number of voices playing each sound, the invalid handle counts sounds played without one
+		*/
+		std::map<SoundHandle, int> getVoiceUsage();
+
+		size_t getActiveStreamCount();
+
+		/**
+		* WAV files of at least this many bytes are streamed from disk (or a mapped pack)
+		* while they play, rather than decoded into memory when loaded
+		*/
+		static void setStreamThreshold(size_t bytes) { streamThreshold = bytes; }
+		static size_t getStreamThreshold() { return streamThreshold; }
+
+		/**
+		* Reads the WAV header from rw (which stays open) and registers the file for streaming
+		* Safe to call from loader threads
+		*
+		* @return a placeholder chunk to store and play like any other sound,
+		*         or nullptr if the file can't be streamed and should be decoded instead
+		*/
+		static Mix_Chunk * createStreamedSound(const std::string & fileName, SDL_RWops * rw);
+		static bool isStreamed(Mix_Chunk * sound);
+
+		/**
+		* Frees loaded and streamed sounds alike, halting any channel playing them
+		* Game thread only, commands still queued are run first
+		*/
+		static void freeChunk(Mix_Chunk * sound);
+		static void freeMusic(Mix_Music * music);
 };
 
-#endif
\ No newline at end of file
+#endif
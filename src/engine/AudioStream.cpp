@@ -0,0 +1,141 @@
+#include "AudioStream.h"
+#include "EngineCommon.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioStream::AudioStream(SDL_RWops * rw, const WavInfo & wav, int frequency, SDL_AudioFormat format, int channels, Uint32 startBytes, size_t ringBytes)
+	: rw(rw), remaining(wav.dataSize - std::min(startBytes, wav.dataSize)), converter(nullptr), flushed(false), frameBytes(SDL_AUDIO_BITSIZE(format) / 8 * channels),
+	ring(ringBytes), readPos(0), writePos(0), decoding(true), released(false), underruns(0) {
+
+	converter = SDL_NewAudioStream(wav.format, wav.channels, wav.frequency, format, (Uint8)channels, frequency);
+	if (nullptr == converter) {
+		SDL_RWclose(rw);
+		throw EngineException("Failed to create audio stream", SDL_GetError());
+	}
+
+	SDL_RWseek(rw, wav.dataOffset + (wav.dataSize - remaining), RW_SEEK_SET);
+}
+
+AudioStream::~AudioStream() {
+	SDL_FreeAudioStream(converter);
+	SDL_RWclose(rw);
+}
+
+void AudioStream::push(const Uint8 * data, size_t len) {
+	size_t start = writePos % ring.size();
+	size_t first = std::min(len, ring.size() - start);
+	memcpy(&ring[start], data, first);
+	memcpy(&ring[0], data + first, len - first);
+
+	// the mixer may only see the bytes once they are copied
+	writePos += len;
+}
+
+void AudioStream::fill() {
+	Uint8 buffer[STREAM_READ_BYTES];
+
+	while (decoding) {
+		size_t space = ring.size() - (writePos - readPos);
+		space -= space % frameBytes;
+		if (space == 0)
+			return;
+
+		int available = SDL_AudioStreamAvailable(converter);
+		if (available > 0) {
+			int len = (int)std::min(space, sizeof(buffer) - sizeof(buffer) % frameBytes);
+			int got = SDL_AudioStreamGet(converter, buffer, len);
+			if (got > 0)
+				push(buffer, got);
+			else
+				decoding = false;	// converter error, play what is buffered
+			continue;
+		}
+
+		if (remaining > 0) {
+			size_t len = SDL_RWread(rw, buffer, 1, std::min((size_t)remaining, sizeof(buffer)));
+			if (len == 0 || SDL_AudioStreamPut(converter, buffer, (int)len) != 0)
+				remaining = 0;	// truncated file, end here
+			else
+				remaining -= (Uint32)len;
+		}
+		else if (!flushed) {
+			SDL_AudioStreamFlush(converter);
+			flushed = true;
+		}
+		else {
+			decoding = false;
+		}
+	}
+}
+
+void AudioStream::read(Uint8 * dst, int len) {
+	size_t available = writePos - readPos;
+	size_t count = std::min(available, (size_t)len);
+
+	size_t start = readPos % ring.size();
+	size_t first = std::min(count, ring.size() - start);
+	memcpy(dst, &ring[start], first);
+	memcpy(dst + first, &ring[0], count - first);
+
+	if (count < (size_t)len) {
+		// silence, the channel plays a silent chunk underneath
+		memset(dst + count, 0, len - count);
+		if (decoding)
+			underruns++;
+	}
+
+	readPos += count;
+}
+
+bool AudioStream::parseWav(SDL_RWops * rw, WavInfo & wav) {
+	Uint8 header[12];
+	if (SDL_RWread(rw, header, 1, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+		return false;
+
+	wav.dataOffset = wav.dataSize = 0;
+	wav.channels = 0;
+
+	bool haveFormat = false;
+	Uint16 encoding = 0, bits = 0;
+
+	Uint8 chunk[8];
+	while (SDL_RWread(rw, chunk, 1, 8) == 8) {
+		Uint32 size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((Uint32)chunk[7] << 24);
+		Sint64 next = SDL_RWtell(rw) + size + (size & 1);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+			Uint8 fmt[16];
+			if (SDL_RWread(rw, fmt, 1, 16) != 16)
+				return false;
+
+			encoding = fmt[0] | (fmt[1] << 8);
+			wav.channels = fmt[2];
+			wav.frequency = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | (fmt[7] << 24);
+			bits = fmt[14] | (fmt[15] << 8);
+			haveFormat = true;
+		}
+		else if (memcmp(chunk, "data", 4) == 0) {
+			if (!haveFormat)
+				return false;
+
+			wav.dataOffset = (Uint32)SDL_RWtell(rw);
+			wav.dataSize = size;
+			break;
+		}
+
+		SDL_RWseek(rw, next, RW_SEEK_SET);
+	}
+
+	if (!haveFormat || wav.dataSize == 0 || wav.channels == 0)
+		return false;
+
+	// 1 = PCM, 3 = IEEE float, anything else needs a real decoder
+	if (encoding == 1 && bits == 8) wav.format = AUDIO_U8;
+	else if (encoding == 1 && bits == 16) wav.format = AUDIO_S16LSB;
+	else if (encoding == 1 && bits == 32) wav.format = AUDIO_S32LSB;
+	else if (encoding == 3 && bits == 32) wav.format = AUDIO_F32LSB;
+	else return false;
+
+	return true;
+}
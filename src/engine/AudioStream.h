@@ -0,0 +1,85 @@
+#ifndef __AUDIO_STREAM_H__
+#define __AUDIO_STREAM_H__
+
+#include <vector>
+#include <atomic>
+
+#include <SDL.h>
+
+static const size_t DEFAULT_STREAM_RING_BYTES = 64 * 1024;
+static const size_t STREAM_READ_BYTES = 4096;
+
+/**
+* Sample layout and location of the PCM data in a WAV file
+*/
+struct WavInfo {
+	SDL_AudioFormat format;
+	Uint8 channels;
+	int frequency;
+	Uint32 dataOffset;
+	Uint32 dataSize;
+};
+
+/**
+ * One playing instance of a streamed sound
+ *
+ * A decoder thread reads the WAV data incrementally, converts it to the mixer
+ * format and keeps a ring buffer topped up with fill(). The mixer thread drains
+ * the ring with read(). Each side only moves its own position, so no lock is needed
+ */
+class AudioStream {
+	private:
+		SDL_RWops * rw;
+		Uint32 remaining;	// source bytes not yet read
+		SDL_AudioStream * converter;
+		bool flushed;
+		int frameBytes;
+
+		std::vector<Uint8> ring;
+		std::atomic<size_t> readPos, writePos;	// total bytes ever read / written
+		std::atomic<bool> decoding, released;
+		std::atomic<Uint32> underruns;
+
+		void push(const Uint8 * data, size_t len);
+
+	public:
+		/**
+		* @param rw - positioned anywhere, owned and closed by the stream
+		* @param startBytes - how far into the WAV data to start
+		* @exception throws EngineException if no converter exists for the format
+		*/
+		AudioStream(SDL_RWops * rw, const WavInfo & wav, int frequency, SDL_AudioFormat format, int channels,
+			Uint32 startBytes = 0, size_t ringBytes = DEFAULT_STREAM_RING_BYTES);
+		~AudioStream();
+
+		AudioStream(const AudioStream &) = delete;
+		AudioStream & operator=(const AudioStream &) = delete;
+
+		/**
+		* Decoder thread: reads and converts until the ring is full or the source ends
+		*/
+		void fill();
+
+		/**
+		* Mixer thread: copies len bytes of output, padding with silence on underrun
+		*/
+		void read(Uint8 * dst, int len);
+
+		bool isFinished() const { return !decoding && readPos == writePos; }
+		size_t getBufferedBytes() const { return writePos - readPos; }
+		Uint32 getUnderruns() const { return underruns; }
+
+		/**
+		* Set once the mixer no longer calls read(), the stream may then be destroyed
+		*/
+		void release() { released = true; }
+		bool isReleased() const { return released; }
+
+		/**
+		* Reads the RIFF header, only uncompressed PCM and float data can be streamed
+		* @return false if rw is not a WAV file that can be streamed
+		*/
+		static bool parseWav(SDL_RWops * rw, WavInfo & wav);
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "FileWatcher.h"
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher() : running(true), inotifyDescriptor(-1) {
+#ifdef __linux__
+	inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher() {
+	running = false;
+	thread.join();
+
+#ifdef __linux__
+	if (inotifyDescriptor >= 0)
+		close(inotifyDescriptor);
+#endif
+}
+
+std::string FileWatcher::directoryOf(const std::string & path) {
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+bool FileWatcher::stat(const std::string & path, WatchedFile & file) {
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0)
+		return false;
+
+	file.modifiedTime = (Uint64)st.st_mtime;
+	file.size = (Uint64)st.st_size;
+	return true;
+}
+
+void FileWatcher::watch(const std::string & path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (files.count(path))
+		return;
+
+	WatchedFile file = { 0, 0 };
+	stat(path, file);
+	files[path] = file;
+
+#ifdef __linux__
+	if (inotifyDescriptor >= 0) {
+		// the same directory always yields the same watch
+		std::string directory = directoryOf(path);
+		int wd = inotify_add_watch(inotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (wd >= 0)
+			directories[wd] = directory;
+	}
+#endif
+}
+
+std::vector<std::string> FileWatcher::takeChanged(Uint32 debounceMs) {
+	std::vector<std::string> result;
+	Uint32 now = SDL_GetTicks();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto iter = changed.begin(); iter != changed.end(); ) {
+		if (now - iter->second >= debounceMs) {
+			result.push_back(iter->first);
+			iter = changed.erase(iter);
+		}
+		else {
+			++iter;
+		}
+	}
+	return result;
+}
+
+size_t FileWatcher::getWatchCount() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return files.size();
+}
+
+void FileWatcher::markChanged(const std::string & path) {
+	// called with the mutex held
+	changed[path] = SDL_GetTicks();
+}
+
+void FileWatcher::run() {
+	while (running) {
+		if (inotifyDescriptor >= 0) {
+			readEvents();
+		}
+		else {
+			pollFiles();
+			SDL_Delay(FILE_WATCH_POLL_MS);
+		}
+	}
+}
+
+void FileWatcher::readEvents() {
+#ifdef __linux__
+	// short timeout so the destructor never waits long
+	pollfd descriptor = { inotifyDescriptor, POLLIN, 0 };
+	if (poll(&descriptor, 1, 100) <= 0)
+		return;
+
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(inotifyDescriptor, buffer, sizeof(buffer))) > 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (char * ptr = buffer; ptr < buffer + length; ) {
+			const inotify_event * event = (const inotify_event *)ptr;
+			ptr += sizeof(inotify_event) + event->len;
+
+			auto directory = directories.find(event->wd);
+			if (event->len == 0 || directory == directories.end())
+				continue;
+
+			std::string path = directory->second == "." ? event->name : directory->second + "/" + event->name;
+			if (files.count(path))
+				markChanged(path);
+		}
+	}
+#endif
+}
+
+void FileWatcher::pollFiles() {
+	std::map<std::string, WatchedFile> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		snapshot = files;
+	}
+
+	for (auto & entry : snapshot) {
+		WatchedFile current = { 0, 0 };
+		if (!stat(entry.first, current))
+			continue;	// mid-save, picked up once the file is back
+
+		if (current.modifiedTime != entry.second.modifiedTime || current.size != entry.second.size) {
+			std::lock_guard<std::mutex> lock(mutex);
+			files[entry.first] = current;
+			markChanged(entry.first);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef __FILE_WATCHER_H__
+#define __FILE_WATCHER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include <SDL.h>
+
+static const Uint32 FILE_WATCH_POLL_MS = 250;
+
+/**
+ * Watches files for changes on a background thread
+ *
+ * Uses inotify on the parent directories on Linux, so files replaced by editors
+ * through a rename are still seen. Elsewhere, or if inotify is unavailable,
+ * the files are polled with stat() every FILE_WATCH_POLL_MS
+ */
+class FileWatcher {
+	private:
+		struct WatchedFile {
+			Uint64 modifiedTime, size;
+		};
+
+		std::thread thread;
+		std::atomic<bool> running;
+
+		std::mutex mutex;
+		std::map<std::string, WatchedFile> files;
+		std::map<std::string, Uint32> changed;	// path -> ticks of its latest change
+
+		int inotifyDescriptor;
+		std::map<int, std::string> directories;	// inotify watch -> directory
+
+		static std::string directoryOf(const std::string & path);
+		static bool stat(const std::string & path, WatchedFile & file);
+
+		void run();
+		void readEvents();
+		void pollFiles();
+		void markChanged(const std::string & path);
+
+	public:
+		FileWatcher();
+		~FileWatcher();
+
+		FileWatcher(const FileWatcher &) = delete;
+		FileWatcher & operator=(const FileWatcher &) = delete;
+
+		/**
+		* Starts watching given file, watching it again is a no-op
+		*/
+		void watch(const std::string & path);
+
+		/**
+		* @param debounceMs - files still changing within this interval are held back,
+		*                     so a burst of writes reports the file once
+		* @return files that changed since the last call
+		*/
+		std::vector<std::string> takeChanged(Uint32 debounceMs);
+
+		size_t getWatchCount();
+		bool usesNotifications() const { return inotifyDescriptor >= 0; }
+};
+
+#endif
@@ -2,6 +2,8 @@
 #define __GAME_MATH_H__
 
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 
 #include <SDL_rect.h>
 
@@ -119,6 +121,136 @@ struct Rectangle2f {
 typedef Rectangle2 Rect;
 typedef Rectangle2f Rectf;
 
+/**
+* Axis aligned box given by its edges, as used for collision
+* Boxes that only touch along an edge do not overlap, same as SDL_HasIntersection
+*/
+struct Box2f {
+	float minX, minY, maxX, maxY;
+
+	inline bool overlaps(const Box2f & other) const {
+		return minX < other.maxX && other.minX < maxX && minY < other.maxY && other.minY < maxY;
+	}
+
+	/**
+	* @return axis of least overlap with other, pointing from other towards this box
+	*/
+	inline Vector2f separation(const Box2f & other) const {
+		float overlapX = std::min(maxX, other.maxX) - std::max(minX, other.minX);
+		float overlapY = std::min(maxY, other.maxY) - std::max(minY, other.minY);
+
+		if (overlapX < overlapY)
+			return Vector2f(minX + maxX < other.minX + other.maxX ? -1.0f : 1.0f, 0.0f);
+		return Vector2f(0.0f, minY + maxY < other.minY + other.maxY ? -1.0f : 1.0f);
+	}
+
+	/**
+	* @return distance from the point to the nearest point of the box, 0 inside
+	*/
+	inline float distanceTo(const Vector2f & point) const {
+		float dx = std::max(std::max(minX - point.x, point.x - maxX), 0.0f);
+		float dy = std::max(std::max(minY - point.y, point.y - maxY), 0.0f);
+		return sqrtf(dx * dx + dy * dy);
+	}
+
+	/**
+	* Casts a ray of length maxT along a normalized direction
+	* @return true if it enters the box, t is then the distance to the entry point and normal
+	*			the face entered, or t 0 and no normal if the origin is inside
+	*/
+	inline bool raycast(const Vector2f & origin, const Vector2f & direction, float maxT, float & t, Vector2f & normal) const {
+		float entry = 0.0f, exit = maxT;
+		Vector2f face(0.0f, 0.0f);
+
+		if (direction.x != 0.0f) {
+			float t0 = (minX - origin.x) / direction.x, t1 = (maxX - origin.x) / direction.x;
+			if (t0 > t1) std::swap(t0, t1);
+			if (t0 > entry) {
+				entry = t0;
+				face = Vector2f(direction.x > 0.0f ? -1.0f : 1.0f, 0.0f);
+			}
+			exit = std::min(exit, t1);
+		}
+		else if (origin.x <= minX || origin.x >= maxX) {
+			return false;
+		}
+
+		if (direction.y != 0.0f) {
+			float t0 = (minY - origin.y) / direction.y, t1 = (maxY - origin.y) / direction.y;
+			if (t0 > t1) std::swap(t0, t1);
+			if (t0 > entry) {
+				entry = t0;
+				face = Vector2f(0.0f, direction.y > 0.0f ? -1.0f : 1.0f);
+			}
+			exit = std::min(exit, t1);
+		}
+		else if (origin.y <= minY || origin.y >= maxY) {
+			return false;
+		}
+
+		if (entry >= exit)
+			return false;
+
+		t = entry;
+		normal = face;
+		return true;
+	}
+
+	/**
+	* Moves this box by (dx, dy) against other, which stays in place
+	*
+	* @return true if they overlap at some point of the move, toi is then the fraction
+	*			of the move when they first touch and normal the face of other that was hit,
+	*			or toi 0 and the separation() if they overlap from the start
+	*/
+	inline bool sweep(float dx, float dy, const Box2f & other, float & toi, Vector2f & normal) const {
+		if (overlaps(other)) {
+			toi = 0.0f;
+			normal = separation(other);
+			return true;
+		}
+
+		// times at which the boxes start and stop overlapping on each axis
+		float entryX = -INFINITY, exitX = INFINITY, entryY = -INFINITY, exitY = INFINITY;
+		if (dx > 0.0f) {
+			entryX = (other.minX - maxX) / dx;
+			exitX = (other.maxX - minX) / dx;
+		}
+		else if (dx < 0.0f) {
+			entryX = (other.maxX - minX) / dx;
+			exitX = (other.minX - maxX) / dx;
+		}
+		else if (!(minX < other.maxX && other.minX < maxX)) {
+			return false;
+		}
+
+		if (dy > 0.0f) {
+			entryY = (other.minY - maxY) / dy;
+			exitY = (other.maxY - minY) / dy;
+		}
+		else if (dy < 0.0f) {
+			entryY = (other.maxY - minY) / dy;
+			exitY = (other.minY - maxY) / dy;
+		}
+		else if (!(minY < other.maxY && other.minY < maxY)) {
+			return false;
+		}
+
+		// boxes that only touch at the end of the move do not overlap
+		float entry = std::max(entryX, entryY), exit = std::min(exitX, exitY);
+		if (entry >= exit || entry >= 1.0f || exit <= 0.0f)
+			return false;
+
+		// the face hit is on the axis that started overlapping last
+		toi = std::max(0.0f, entry);
+		if (entryX > entryY)
+			normal = Vector2f(dx > 0.0f ? -1.0f : 1.0f, 0.0f);
+		else
+			normal = Vector2f(0.0f, dy > 0.0f ? -1.0f : 1.0f);
+		return true;
+	}
+};
+
 struct Dimension2i {
 	int w, h;
 
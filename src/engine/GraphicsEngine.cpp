@@ -1,16 +1,36 @@
 #include "GraphicsEngine.h"
 
+#include <algorithm>
+
 SDL_Renderer * GraphicsEngine::renderer = nullptr;
 
-GraphicsEngine::GraphicsEngine() : fpsAverage(0), fpsPrevious(0), fpsStart(0), fpsEnd(0), drawColor(toSDLColor(0, 0, 0, 255)) {
-	window = SDL_CreateWindow("The X-CUBE 2D Game Engine",
-		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-		DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+GraphicsEngine::GraphicsEngine(bool headless) : window(nullptr), framebuffer(nullptr), headless(headless), drawColor(toSDLColor(0, 0, 0, 255)),
+	fpsAverage(0), fpsPrevious(0), fpsStart(0), fpsEnd(0),
+	worldTarget(nullptr), worldTargetW(0), worldTargetH(0), dynamicResolution(false), inWorldPass(false),
+	renderScale(1.0f), drawScale(1.0f, 1.0f), frameStartCounter(0), frameTimeAverage(0.0f), framesSinceScaleChange(0) {
+	dynresSettings.targetMs = DEFAULT_DYNRES_TARGET_MS;
+	dynresSettings.minScale = DEFAULT_DYNRES_MIN_SCALE;
+	dynresSettings.maxScale = DEFAULT_DYNRES_MAX_SCALE;
+	dynresSettings.hysteresis = DEFAULT_DYNRES_HYSTERESIS;
+
+	if (headless) {
+		framebuffer = SDL_CreateRGBSurfaceWithFormat(0, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
 
-	if (nullptr == window)
-		throw EngineException("Failed to create window", SDL_GetError());
+		if (nullptr == framebuffer)
+			throw EngineException("Failed to create framebuffer", SDL_GetError());
 
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+		renderer = SDL_CreateSoftwareRenderer(framebuffer);
+	}
+	else {
+		window = SDL_CreateWindow("The X-CUBE 2D Game Engine",
+			SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+			DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+
+		if (nullptr == window)
+			throw EngineException("Failed to create window", SDL_GetError());
+
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	}
 
 	if (nullptr == renderer)
 		throw EngineException("Failed to create renderer", SDL_GetError());
@@ -28,9 +48,17 @@ GraphicsEngine::~GraphicsEngine() {
 	debug("GraphicsEngine::~GraphicsEngine() started");
 #endif
 
+	// cached textures must go before the renderer does
+	textCache.clear();
+	if (worldTarget) SDL_DestroyTexture(worldTarget);
+
 	IMG_Quit();
 	TTF_Quit();
-	SDL_DestroyWindow(window);
+	if (window) SDL_DestroyWindow(window);
+	if (framebuffer) {
+		SDL_DestroyRenderer(renderer);
+		SDL_FreeSurface(framebuffer);
+	}
 	SDL_Quit();
 
 #ifdef __DEBUG
@@ -86,6 +114,12 @@ void GraphicsEngine::setDrawColor(const SDL_Color & color) {
 }
 
 void GraphicsEngine::setWindowSize(const int &w, const int &h) {
+	if (headless) {
+		// the software renderer is bound to its surface, textures would not survive a new one
+		std::cout << "GraphicsEngine::setWindowSize() ignored in headless mode" << std::endl;
+		return;
+	}
+
 	SDL_SetWindowSize(window, w, h);
 	SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
 #ifdef __DEBUG
@@ -95,6 +129,9 @@ void GraphicsEngine::setWindowSize(const int &w, const int &h) {
 }
 
 Dimension2i GraphicsEngine::getCurrentWindowSize() {
+	if (headless)
+		return Dimension2i(framebuffer->w, framebuffer->h);
+
 	int w, h;
 	SDL_GetWindowSize(window, &w, &h);
 	return Dimension2i(w, h);
@@ -113,6 +150,11 @@ Dimension2i GraphicsEngine::getMaximumWindowSize() {
 }
 
 void GraphicsEngine::showInfoMessageBox(const std::string & info, const std::string & title) {
+	if (headless) {
+		std::cout << title << ": " << info << std::endl;
+		return;
+	}
+
 	SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, title.c_str(), info.c_str(), window);
 }
 
@@ -124,6 +166,12 @@ void GraphicsEngine::clearScreen() {
 
 void GraphicsEngine::showScreen() {
 	SDL_RenderPresent(renderer);
+
+	// present blocks while the GPU is behind, so this includes the cost of drawing at renderScale
+	float frameMs = (float)((SDL_GetPerformanceCounter() - frameStartCounter) * 1000.0 / SDL_GetPerformanceFrequency());
+	frameTimeAverage = frameTimeAverage * 0.9f + frameMs * 0.1f;
+	if (dynamicResolution)
+		updateDynamicResolution(frameTimeAverage);
 }
 
 void GraphicsEngine::useFont(TTF_Font * _font) {
@@ -139,15 +187,16 @@ void GraphicsEngine::useFont(TTF_Font * _font) {
 
 void GraphicsEngine::setFrameStart() {
 	fpsStart = SDL_GetTicks();
+	frameStartCounter = SDL_GetPerformanceCounter();
 }
 
 void GraphicsEngine::adjustFPSDelay(const Uint32 &delay) {
 	fpsEnd = SDL_GetTicks() - fpsStart;
-	if (fpsEnd < delay) {
+	if (fpsEnd < delay && !headless) {
 		SDL_Delay(delay - fpsEnd);
 	}
 
-	Uint32 fpsCurrent = 1000 / (SDL_GetTicks() - fpsStart);
+	Uint32 fpsCurrent = 1000 / std::max((Uint32)1, SDL_GetTicks() - fpsStart);
 	fpsAverage = (fpsCurrent + fpsPrevious + fpsAverage * 8) / 10;	// average, 10 values / 10
 	fpsPrevious = fpsCurrent;
 }
@@ -156,10 +205,101 @@ Uint32 GraphicsEngine::getAverageFPS() {
 	return fpsAverage;
 }
 
+bool GraphicsEngine::readPixels(std::vector<Uint32> & pixels, int & w, int & h) {
+	if (SDL_GetRendererOutputSize(renderer, &w, &h) < 0)
+		return false;
+
+	pixels.resize((size_t)w * h);
+	if (SDL_RenderReadPixels(renderer, 0, SDL_PIXELFORMAT_ARGB8888, pixels.data(), w * sizeof(Uint32)) < 0) {
+		std::cout << "Failed to read pixels: " << SDL_GetError() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool GraphicsEngine::saveScreenshot(const std::string & fileName) {
+	std::vector<Uint32> pixels;
+	int w, h;
+	if (!readPixels(pixels, w, h))
+		return false;
+
+	SDL_Surface * surf = SDL_CreateRGBSurfaceWithFormatFrom(pixels.data(), w, h, 32, w * sizeof(Uint32), SDL_PIXELFORMAT_ARGB8888);
+	if (nullptr == surf)
+		return false;
+
+	bool saved = SDL_SaveBMP(surf, fileName.c_str()) == 0;
+	if (!saved)
+		std::cout << "Failed to save screenshot: " << fileName << " " << SDL_GetError() << std::endl;
+
+	SDL_FreeSurface(surf);
+	return saved;
+}
+
+int GraphicsEngine::compareWithImage(const std::string & fileName, const int & tolerance) {
+	std::vector<Uint32> pixels;
+	int w, h;
+	if (!readPixels(pixels, w, h))
+		return -1;
+
+	SDL_Surface * loaded = IMG_Load(fileName.c_str());
+	if (nullptr == loaded) {
+		std::cout << "Failed to load image: " << fileName << std::endl;
+		return -1;
+	}
+
+	SDL_Surface * image = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(loaded);
+	if (nullptr == image)
+		return -1;
+
+	if (image->w != w || image->h != h) {
+		std::cout << "Image size differs from frame: " << fileName << std::endl;
+		SDL_FreeSurface(image);
+		return -1;
+	}
+
+	int mismatches = 0;
+	SDL_LockSurface(image);
+	for (int y = 0; y < h; y++) {
+		const Uint32 * row = (const Uint32 *)((const Uint8 *)image->pixels + y * image->pitch);
+		const Uint32 * frame = &pixels[(size_t)y * w];
+		for (int x = 0; x < w; x++) {
+			Uint32 a = row[x], b = frame[x];
+			// alpha is ignored, screenshots are opaque
+			for (int shift = 0; shift < 24; shift += 8) {
+				int diff = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+				if (diff > tolerance || -diff > tolerance) {
+					mismatches++;
+					break;
+				}
+			}
+		}
+	}
+	SDL_UnlockSurface(image);
+	SDL_FreeSurface(image);
+
+	return mismatches;
+}
+
 SDL_Texture * GraphicsEngine::createTextureFromSurface(SDL_Surface * surf) {
 	return SDL_CreateTextureFromSurface(renderer, surf);
 }
 
+SDL_Texture * GraphicsEngine::createTexture(int w, int h, const void * pixels, int pitch) {
+	SDL_Texture * texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, w, h);
+	if (nullptr == texture)
+		return nullptr;
+
+	if (SDL_UpdateTexture(texture, NULL, pixels, pitch) != 0) {
+		SDL_DestroyTexture(texture);
+		return nullptr;
+	}
+
+	SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+	return texture;
+}
+
 SDL_Texture * GraphicsEngine::createTextureFromString(const std::string & text, TTF_Font * _font, SDL_Color color) {
 	SDL_Texture * textTexture = nullptr;
 	SDL_Surface * textSurface = TTF_RenderText_Blended(_font, text.c_str(), color);
@@ -176,7 +316,118 @@ SDL_Texture * GraphicsEngine::createTextureFromString(const std::string & text,
 }
 
 void GraphicsEngine::setDrawScale(const Vector2f & v) {
-	SDL_RenderSetScale(renderer, v.x, v.y);
+	drawScale = v;
+	float scale = inWorldPass ? renderScale : 1.0f;
+	SDL_RenderSetScale(renderer, v.x * scale, v.y * scale);
+}
+
+/* DYNAMIC RESOLUTION */
+
+void GraphicsEngine::setDynamicResolution(bool b) {
+	if (b && !SDL_RenderTargetSupported(renderer)) {
+		std::cout << "Dynamic resolution needs render target support" << std::endl;
+		return;
+	}
+
+	dynamicResolution = b;
+	framesSinceScaleChange = 0;
+	if (!b) renderScale = 1.0f;
+}
+
+void GraphicsEngine::setDynamicResolutionSettings(const DynamicResolutionSettings & settings) {
+	dynresSettings = settings;
+	dynresSettings.minScale = std::max(0.1f, std::min(1.0f, settings.minScale));
+	dynresSettings.maxScale = std::max(dynresSettings.minScale, std::min(1.0f, settings.maxScale));
+	dynresSettings.hysteresis = std::max(0.0f, settings.hysteresis);
+
+	renderScale = std::max(dynresSettings.minScale, std::min(dynresSettings.maxScale, renderScale));
+}
+
+void GraphicsEngine::updateDynamicResolution(float averageMs) {
+	if (++framesSinceScaleChange < DYNRES_COOLDOWN_FRAMES)
+		return;
+
+	// only react outside of the hysteresis band, so the scale doesn't oscillate around the target
+	float target = dynresSettings.targetMs;
+	float vsyncMs = getVsyncIntervalMs();
+	if (vsyncMs > 0.0f)
+		target = std::max(target, vsyncMs * (1.0f + dynresSettings.hysteresis));
+
+	float band = target * dynresSettings.hysteresis;
+	if (averageMs <= 0.0f)
+		return;
+
+	if (averageMs < target + band && averageMs > target - band) {
+		// waiting for vsync hides any headroom, so after a while on time try one step up
+		if (vsyncMs > 0.0f && framesSinceScaleChange >= DYNRES_PROBE_FRAMES && renderScale < dynresSettings.maxScale) {
+			renderScale = std::min(dynresSettings.maxScale, renderScale + 0.05f);
+			framesSinceScaleChange = 0;
+		}
+		return;
+	}
+
+	// cost is roughly proportional to pixel count, i.e. scale squared
+	float scale = renderScale * sqrtf(target / averageMs);
+	scale = std::max(dynresSettings.minScale, std::min(dynresSettings.maxScale, scale));
+	scale = floorf(scale * 20.0f + 0.5f) / 20.0f;	// 5% steps
+
+	if (scale != renderScale) {
+		renderScale = std::max(dynresSettings.minScale, std::min(dynresSettings.maxScale, scale));
+		framesSinceScaleChange = 0;
+	}
+}
+
+float GraphicsEngine::getVsyncIntervalMs() {
+	SDL_RendererInfo info;
+	if (headless || SDL_GetRendererInfo(renderer, &info) != 0 || !(info.flags & SDL_RENDERER_PRESENTVSYNC))
+		return 0.0f;
+
+	SDL_DisplayMode mode;
+	if (SDL_GetWindowDisplayMode(window, &mode) != 0 || mode.refresh_rate <= 0)
+		return 1000.0f / 60.0f;
+
+	return 1000.0f / mode.refresh_rate;
+}
+
+void GraphicsEngine::beginWorld() {
+	if (!dynamicResolution)
+		return;
+
+	Dimension2i size = getCurrentWindowSize();
+	if (nullptr == worldTarget || worldTargetW != size.w || worldTargetH != size.h) {
+		if (worldTarget) SDL_DestroyTexture(worldTarget);
+
+		// allocated at full size, lower scales use its top left corner
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+		worldTarget = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, size.w, size.h);
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+
+		if (nullptr == worldTarget) {
+			std::cout << "Failed to create world render target: " << SDL_GetError() << std::endl;
+			dynamicResolution = false;
+			return;
+		}
+		worldTargetW = size.w;
+		worldTargetH = size.h;
+	}
+
+	SDL_SetRenderTarget(renderer, worldTarget);
+	clearScreen();
+
+	inWorldPass = true;
+	setDrawScale(drawScale);
+}
+
+void GraphicsEngine::endWorld() {
+	if (!inWorldPass)
+		return;
+
+	inWorldPass = false;
+	SDL_SetRenderTarget(renderer, nullptr);
+	setDrawScale(drawScale);
+
+	SDL_Rect src = { 0, 0, (int)(worldTargetW * renderScale), (int)(worldTargetH * renderScale) };
+	SDL_RenderCopy(renderer, worldTarget, &src, nullptr);
 }
 
 /* ALL DRAW FUNCTIONS */
@@ -252,11 +503,72 @@ void GraphicsEngine::drawTexture(SDL_Texture * texture, SDL_Rect * dst, SDL_Rend
 	SDL_RenderCopyEx(renderer, texture, 0, dst, 0.0, 0, flip);
 }
 
+void GraphicsEngine::drawTexture(const TextureRegion & region, SDL_Rect * src, SDL_Rect * dst, const double & angle, const SDL_Point * center, SDL_RendererFlip flip) {
+	if (nullptr == src) {
+		SDL_RenderCopyEx(renderer, region.texture, &region.rect, dst, angle, center, flip);
+		return;
+	}
+
+	// SDL only clips to the edge of the atlas, so a source running off the region is clipped here
+	// or it would sample the neighbouring regions
+	SDL_Rect wanted = { region.rect.x + src->x, region.rect.y + src->y, src->w, src->h };
+	SDL_Rect atlasSrc;
+	if (!SDL_IntersectRect(&wanted, &region.rect, &atlasSrc))
+		return;
+
+	if (nullptr == dst || (atlasSrc.w == wanted.w && atlasSrc.h == wanted.h)) {
+		SDL_RenderCopyEx(renderer, region.texture, &atlasSrc, dst, angle, center, flip);
+		return;
+	}
+
+	// the part of dst the clipped source maps to, flipped sources lose the other side of dst
+	float scaleX = (float)dst->w / wanted.w, scaleY = (float)dst->h / wanted.h;
+	int cutLeft = (flip & SDL_FLIP_HORIZONTAL) ? (wanted.x + wanted.w) - (atlasSrc.x + atlasSrc.w) : atlasSrc.x - wanted.x;
+	int cutTop = (flip & SDL_FLIP_VERTICAL) ? (wanted.y + wanted.h) - (atlasSrc.y + atlasSrc.h) : atlasSrc.y - wanted.y;
+	SDL_Rect clipped = { dst->x + (int)(cutLeft * scaleX + 0.5f), dst->y + (int)(cutTop * scaleY + 0.5f),
+		(int)(atlasSrc.w * scaleX + 0.5f), (int)(atlasSrc.h * scaleY + 0.5f) };
+
+	// keep rotating around the same point of the screen
+	SDL_Point pivot = center ? *center : SDL_Point{ dst->w / 2, dst->h / 2 };
+	pivot.x -= clipped.x - dst->x;
+	pivot.y -= clipped.y - dst->y;
+	SDL_RenderCopyEx(renderer, region.texture, &atlasSrc, &clipped, angle, &pivot, flip);
+}
+
+void GraphicsEngine::drawTexture(const TextureRegion & region, SDL_Rect * dst, SDL_RendererFlip flip) {
+	SDL_RenderCopyEx(renderer, region.texture, &region.rect, dst, 0.0, 0, flip);
+}
+
 void GraphicsEngine::drawText(const std::string & text, const int &x, const int &y) {
-	SDL_Texture * textTexture = createTextureFromString(text, font, drawColor);
 	int w, h;
-	SDL_QueryTexture(textTexture, 0, 0, &w, &h);
+	SDL_Texture * textTexture = textCache.get(text, font, drawColor, &w, &h);
+	if (nullptr == textTexture)
+		return;
+
 	SDL_Rect dst = { x, y, w, h };
 	drawTexture(textTexture, &dst);
-	SDL_DestroyTexture(textTexture);
+}
+
+void GraphicsEngine::pinText(const std::string & text) {
+	textCache.pin(text, font, drawColor);
+}
+
+void GraphicsEngine::unpinText(const std::string & text) {
+	textCache.unpin(text, font, drawColor);
+}
+
+void GraphicsEngine::setTextCacheBudget(size_t bytes) {
+	textCache.setBudget(bytes);
+}
+
+void GraphicsEngine::clearTextCache() {
+	textCache.clear();
+}
+
+void GraphicsEngine::resetTextCacheStats() {
+	textCache.resetStats();
+}
+
+TextCacheStats GraphicsEngine::getTextCacheStats() {
+	return textCache.getStats();
 }
\ No newline at end of file
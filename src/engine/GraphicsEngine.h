@@ -3,6 +3,7 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 #include <iostream>
 
 #include <SDL.h>
@@ -11,11 +12,20 @@
 
 #include "EngineCommon.h"
 #include "GameMath.h"
+#include "TextCache.h"
 
 /* ENGINE DEFAULT SETTINGS */
 static const int DEFAULT_WINDOW_WIDTH = 800;
 static const int DEFAULT_WINDOW_HEIGHT = 600;
 
+/* DYNAMIC RESOLUTION DEFAULTS */
+static const float DEFAULT_DYNRES_TARGET_MS = 14.0f;
+static const float DEFAULT_DYNRES_MIN_SCALE = 0.5f;
+static const float DEFAULT_DYNRES_MAX_SCALE = 1.0f;
+static const float DEFAULT_DYNRES_HYSTERESIS = 0.1f;
+static const int DYNRES_COOLDOWN_FRAMES = 30;
+static const int DYNRES_PROBE_FRAMES = 300;	// frames on time under vsync before a higher scale is tried
+
 static const SDL_Color SDL_COLOR_GRAY	= { 0x80, 0x80, 0x80 };
 static const SDL_Color SDL_COLOR_YELLOW = { 0xFF, 0xFF, 0 };
 static const SDL_Color SDL_COLOR_RED	= { 0xFF, 0, 0 };
@@ -34,6 +44,21 @@ inline SDL_Color getRandomColor(int minRGB, int maxRGB) {
 	return color;
 }
 
+/**
+* Part of a texture, e.g. an image packed into an atlas page
+* src rectangles passed to drawTexture() are relative to rect
+*/
+struct TextureRegion {
+	SDL_Texture * texture;
+	SDL_Rect rect;
+};
+
+struct DynamicResolutionSettings {
+	float targetMs;		// frame time the controller aims for
+	float minScale, maxScale;
+	float hysteresis;	// fraction of targetMs inside which the scale is left alone
+};
+
 struct SDL_Colorf {
 	float r, g, b, a;
 };
@@ -53,13 +78,41 @@ class GraphicsEngine {
 	private:
 		SDL_Window * window;
 		static SDL_Renderer * renderer;
+
+		// only used in headless mode, software renderer draws into it
+		SDL_Surface * framebuffer;
+		bool headless;
 		SDL_Color drawColor;
 
 		TTF_Font * font;
 
+		TextCache textCache;
+
 		Uint32 fpsAverage, fpsPrevious, fpsStart, fpsEnd;
 
-		GraphicsEngine();
+		/* dynamic resolution */
+		SDL_Texture * worldTarget;
+		int worldTargetW, worldTargetH;
+		bool dynamicResolution, inWorldPass;
+		float renderScale;
+		Vector2f drawScale;
+		DynamicResolutionSettings dynresSettings;
+		Uint64 frameStartCounter;
+		float frameTimeAverage;
+		int framesSinceScaleChange;
+
+		void updateDynamicResolution(float averageMs);
+
+		/**
+		* @return ms between refreshes if presents wait for vsync, otherwise 0
+		*/
+		float getVsyncIntervalMs();
+
+		/**
+		* @param headless - if true, no window is created and everything is
+		*                   rendered into an offscreen surface by SDL's software renderer
+		*/
+		GraphicsEngine(bool headless = false);
 
 	public:	
 		~GraphicsEngine();
@@ -95,10 +148,46 @@ class GraphicsEngine {
 		void drawEllipse(const Point2 & center, const float & radiusX, const float & radiusY);
 		void drawTexture(SDL_Texture *, SDL_Rect * src, SDL_Rect * dst, const double & angle = 0.0, const SDL_Point * center = 0, SDL_RendererFlip flip = SDL_FLIP_NONE);
 		void drawTexture(SDL_Texture *, SDL_Rect * dst, SDL_RendererFlip flip = SDL_FLIP_NONE);
+		void drawTexture(const TextureRegion &, SDL_Rect * src, SDL_Rect * dst, const double & angle = 0.0, const SDL_Point * center = 0, SDL_RendererFlip flip = SDL_FLIP_NONE);
+		void drawTexture(const TextureRegion &, SDL_Rect * dst, SDL_RendererFlip flip = SDL_FLIP_NONE);
 		void drawText(const std::string & text, const int &x, const int &y);
 
+		/**
+		* Text drawn with drawText() is cached between frames
+		* Pinned strings (current font and draw colour) are never evicted
+		*/
+		void pinText(const std::string & text);
+		void unpinText(const std::string & text);
+		void setTextCacheBudget(size_t bytes);
+		void clearTextCache();
+		void resetTextCacheStats();
+		TextCacheStats getTextCacheStats();
+
 		void setDrawColor(const SDL_Color &);
-		void setDrawScale(const Vector2f &);	// not tested
+		void setDrawScale(const Vector2f &);
+
+		/**
+		* World layer pass, call beginWorld() before drawing the world
+		* and endWorld() before drawing UI
+		*
+		* With dynamic resolution enabled, the world is drawn into an offscreen
+		* target at renderScale * window size and upscaled when the pass ends
+		* Otherwise both calls do nothing
+		*/
+		void beginWorld();
+		void endWorld();
+
+		/**
+		* Dynamic resolution adjusts renderScale from the average frame time,
+		* measured from setFrameStart() until SDL_RenderPresent() returns so the GPU's share is included.
+		* With vsync on, a frame that fits the refresh measures the whole refresh interval, so the target
+		* is at least that and a higher scale is only tried after DYNRES_PROBE_FRAMES frames on time
+		*/
+		void setDynamicResolution(bool);
+		void setDynamicResolutionSettings(const DynamicResolutionSettings &);
+		bool isDynamicResolution() { return dynamicResolution; }
+		float getRenderScale() { return renderScale; }
+		float getAverageFrameTime() { return frameTimeAverage; }
 
 		/**
 		* @param fileName - name of the icon file
@@ -133,11 +222,40 @@ class GraphicsEngine {
 		*/
 		Dimension2i getMaximumWindowSize();
 
+		bool isHeadless() { return headless; }
+
+		/**
+		* Reads back the current frame as ARGB8888 pixels
+		* Call this after drawing and before showScreen()
+		*
+		* @return false if the renderer could not read the pixels
+		*/
+		bool readPixels(std::vector<Uint32> & pixels, int & w, int & h);
+
+		/**
+		* Saves the current frame as a BMP file
+		*/
+		bool saveScreenshot(const std::string & fileName);
+
+		/**
+		* Compares the current frame pixel-wise with an image file
+		*
+		* @param tolerance - maximum per-channel difference for a pixel to still match
+		* @return number of mismatching pixels or -1 if the image
+		*         could not be loaded or its size differs from the frame
+		*/
+		int compareWithImage(const std::string & fileName, const int & tolerance);
+
 		void setFrameStart();
 		void adjustFPSDelay(const Uint32 &);
 		Uint32 getAverageFPS();
 
 		static SDL_Texture * createTextureFromSurface(SDL_Surface *);
+
+		/**
+		* Uploads ARGB8888 pixels into a static, alpha blended texture without any conversion
+		*/
+		static SDL_Texture * createTexture(int w, int h, const void * pixels, int pitch);
 		static SDL_Texture * createTextureFromString(const std::string &, TTF_Font *, SDL_Color);
 };
 
@@ -0,0 +1,212 @@
+#include "PackFile.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+PackFile::PackFile(const std::string & fileName) : fileName(fileName), data(nullptr), dataSize(0), entries(nullptr), entryCount(0) {
+#ifdef _WIN32
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		throw EngineException("Failed to open pack", fileName);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(fileHandle, &size);
+	dataSize = (size_t)size.QuadPart;
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle)
+		data = (const Uint8 *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+	if (nullptr == data) {
+		if (mappingHandle) CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		throw EngineException("Failed to map pack", fileName);
+	}
+#else
+	fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+		throw EngineException("Failed to open pack", fileName);
+
+	struct stat info;
+	if (fstat(fileDescriptor, &info) == 0 && info.st_size > 0) {
+		dataSize = (size_t)info.st_size;
+		void * mapped = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (mapped != MAP_FAILED)
+			data = (const Uint8 *)mapped;
+	}
+
+	if (nullptr == data) {
+		close(fileDescriptor);
+		throw EngineException("Failed to map pack", fileName);
+	}
+#endif
+
+	const PackHeader * header = (const PackHeader *)data;
+	if (dataSize < sizeof(PackHeader) || header->magic != PACK_MAGIC || header->version != PACK_VERSION
+		|| dataSize < sizeof(PackHeader) + (size_t)header->entryCount * sizeof(PackEntry)) {
+		unmap();
+		throw EngineException("Not a valid pack", fileName);
+	}
+
+	entryCount = header->entryCount;
+	entries = (const PackEntry *)(data + sizeof(PackHeader));
+}
+
+PackFile::~PackFile() {
+	unmap();
+}
+
+void PackFile::unmap() {
+	if (nullptr == data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+#else
+	munmap((void *)data, dataSize);
+	close(fileDescriptor);
+#endif
+
+	data = nullptr;
+}
+
+std::string PackFile::normalizePath(const std::string & path) {
+	std::string normalized = path.compare(0, 2, "./") == 0 ? path.substr(2) : path;
+	std::replace(normalized.begin(), normalized.end(), '\\', '/');
+	return normalized;
+}
+
+Uint64 PackFile::hashNormalized(const std::string & path) {
+	Uint64 hash = 14695981039346656037ULL;
+	for (char c : path) {
+		hash ^= (Uint8)c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+Uint64 PackFile::hashPath(const std::string & path) {
+	return hashNormalized(normalizePath(path));
+}
+
+const PackEntry * PackFile::find(const std::string & path) const {
+	std::string normalized = normalizePath(path);
+	Uint64 hash = hashNormalized(normalized);
+	const PackEntry * end = entries + entryCount;
+	const PackEntry * entry = std::lower_bound(entries, end, hash,
+		[](const PackEntry & e, Uint64 h) { return e.pathHash < h; });
+
+	// build() rejects colliding paths, but a hash alone doesn't prove the path was packed
+	for (; entry != end && entry->pathHash == hash; entry++) {
+		if (entry->pathOffset + entry->pathLength <= dataSize && entry->pathLength == normalized.size()
+			&& normalized.compare(0, normalized.size(), (const char *)data + entry->pathOffset, entry->pathLength) == 0)
+			return entry;
+	}
+	return nullptr;
+}
+
+SDL_RWops * PackFile::open(const std::string & path) const {
+	const PackEntry * entry = find(path);
+	if (nullptr == entry)
+		return nullptr;
+
+	if (entry->flags & PACK_FLAG_COMPRESSED) {
+		std::cout << "Compressed pack entries are not supported: " << path << std::endl;
+		return nullptr;
+	}
+
+	if (entry->offset + entry->size > dataSize) {
+		std::cout << "Pack entry out of bounds: " << path << std::endl;
+		return nullptr;
+	}
+
+	return SDL_RWFromConstMem(data + entry->offset, (int)entry->size);
+}
+
+void PackFile::build(const std::string & packName, const std::vector<std::string> & files) {
+	std::vector<PackEntry> index(files.size());
+	std::vector<size_t> order(files.size());
+
+	for (size_t i = 0; i < files.size(); i++) {
+		FILE * in = fopen(files[i].c_str(), "rb");
+		if (nullptr == in)
+			throw EngineException("Failed to read", files[i]);
+		fseek(in, 0, SEEK_END);
+		long size = ftell(in);
+		fclose(in);
+
+		PackEntry entry = { hashPath(files[i]), 0, (Uint64)size, 0, (Uint32)normalizePath(files[i]).size(), 0 };
+		index[i] = entry;
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [&index](size_t a, size_t b) { return index[a].pathHash < index[b].pathHash; });
+	for (size_t i = 1; i < order.size(); i++) {
+		if (index[order[i]].pathHash == index[order[i - 1]].pathHash)
+			throw EngineException("Duplicate path or hash collision", files[order[i - 1]] + ", " + files[order[i]]);
+	}
+
+	// paths follow the index, then data, both in sorted order
+	Uint64 offset = sizeof(PackHeader) + files.size() * sizeof(PackEntry);
+	for (size_t i : order) {
+		index[i].pathOffset = offset;
+		offset += index[i].pathLength;
+	}
+
+	std::vector<PackEntry> sorted;
+	for (size_t i : order) {
+		offset = (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+		index[i].offset = offset;
+		offset += index[i].size;
+		sorted.push_back(index[i]);
+	}
+
+	FILE * out = fopen(packName.c_str(), "wb");
+	if (nullptr == out)
+		throw EngineException("Failed to write", packName);
+
+	PackHeader header = { PACK_MAGIC, PACK_VERSION, (Uint32)files.size(), 0 };
+	fwrite(&header, sizeof(header), 1, out);
+	if (!sorted.empty())
+		fwrite(sorted.data(), sizeof(PackEntry), sorted.size(), out);
+	for (size_t i : order) {
+		std::string path = normalizePath(files[i]);
+		fwrite(path.data(), 1, path.size(), out);
+	}
+
+	std::vector<char> buffer;
+	for (size_t i : order) {
+		long position = ftell(out);
+		while ((Uint64)position < index[i].offset) {
+			fputc(0, out);
+			position++;
+		}
+
+		buffer.resize((size_t)index[i].size);
+		FILE * in = fopen(files[i].c_str(), "rb");
+		if (nullptr == in || (!buffer.empty() && fread(buffer.data(), 1, buffer.size(), in) != buffer.size())) {
+			if (in) fclose(in);
+			fclose(out);
+			throw EngineException("Failed to read", files[i]);
+		}
+		fclose(in);
+
+		if (!buffer.empty())
+			fwrite(buffer.data(), 1, buffer.size(), out);
+	}
+
+	fclose(out);
+}
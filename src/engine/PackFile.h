@@ -0,0 +1,103 @@
+#ifndef __PACK_FILE_H__
+#define __PACK_FILE_H__
+
+#include <string>
+#include <vector>
+
+#include <SDL_stdinc.h>
+#include <SDL_rwops.h>
+
+#include "EngineCommon.h"
+
+/**
+* Pack file layout (little endian):
+*
+*   PackHeader
+*   PackEntry[entryCount]   sorted by pathHash
+*   entry paths, normalized as in hashPath(), not terminated
+*   entry data, each entry aligned to PACK_ALIGNMENT
+*/
+static const Uint32 PACK_MAGIC = 0x4B415058;	// "XPAK"
+static const Uint32 PACK_VERSION = 2;
+static const Uint32 PACK_ALIGNMENT = 16;
+
+static const Uint32 PACK_FLAG_COMPRESSED = 1;	// reserved, no compressor is shipped yet
+
+struct PackHeader {
+	Uint32 magic;
+	Uint32 version;
+	Uint32 entryCount;
+	Uint32 reserved;
+};
+
+struct PackEntry {
+	Uint64 pathHash;
+	Uint64 offset;	// from the start of the file
+	Uint64 size;
+	Uint64 pathOffset;	// from the start of the file
+	Uint32 pathLength;
+	Uint32 flags;
+};
+
+/**
+ * Read-only, memory mapped asset archive
+ * Entries are exposed as SDL_RWops over the mapped memory, so nothing is copied
+ */
+class PackFile {
+	private:
+		std::string fileName;
+		const Uint8 * data;
+		size_t dataSize;
+		const PackEntry * entries;
+		Uint32 entryCount;
+
+#ifdef _WIN32
+		void * fileHandle;
+		void * mappingHandle;
+#else
+		int fileDescriptor;
+#endif
+
+		void unmap();
+
+		static std::string normalizePath(const std::string & path);
+		static Uint64 hashNormalized(const std::string & path);
+
+		PackFile(const PackFile &);
+		PackFile & operator=(const PackFile &);
+
+	public:
+		/**
+		* Maps the archive into memory
+		* @exception throws EngineException if the file can't be mapped or isn't a valid pack
+		*/
+		PackFile(const std::string & fileName);
+		~PackFile();
+
+		/**
+		* FNV-1a of the path with '\' replaced by '/' and any leading "./" removed
+		*/
+		static Uint64 hashPath(const std::string & path);
+
+		/**
+		* @return the entry of given path or nullptr, the stored path is compared on a hash match
+		*/
+		const PackEntry * find(const std::string & path) const;
+
+		/**
+		* @return a read-only SDL_RWops over the mapped entry, or nullptr if the path is not packed
+		*         the caller must close it, the pack must outlive it
+		*/
+		SDL_RWops * open(const std::string & path) const;
+
+		const std::string & getFileName() const { return fileName; }
+		Uint32 getEntryCount() const { return entryCount; }
+
+		/**
+		* Writes a pack containing given files, stored under the paths given
+		* @exception throws EngineException if a file can't be read or two paths hash the same
+		*/
+		static void build(const std::string & packName, const std::vector<std::string> & files);
+};
+
+#endif
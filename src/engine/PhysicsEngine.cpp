@@ -1,39 +1,1711 @@
 #include "PhysicsEngine.h"
+#include "EngineCommon.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include <SDL.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define PHYSICS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PHYSICS_SSE2
+#endif
 
 PhysicsObject::PhysicsObject(const Point2 & center, float x, float y)
-: center(center), lX(x), lY(y), hlX(x / 2.0f), hlY(y / 2.0f), force(0.0f, 0.0f) {}
+: engine(nullptr), center((float)center.x, (float)center.y), halfLengths(x / 2.0f, y / 2.0f) {}
+
+Vector2f PhysicsObject::getPosition() const {
+	return engine ? engine->getPosition(body) : center;
+}
+
+Point2 PhysicsObject::getCenter() const {
+	Vector2f position = getPosition();
+	return Point2((int)position.x, (int)position.y);
+}
+
+float PhysicsObject::getHalfLengthX() const {
+	return engine ? engine->getHalfLengths(body).x : halfLengths.x;
+}
+
+float PhysicsObject::getHalfLengthY() const {
+	return engine ? engine->getHalfLengths(body).y : halfLengths.y;
+}
 
 bool PhysicsObject::isColliding(const PhysicsObject & other) {
-    Rectf r1 = { center.x - hlX, center.y - hlY, lX, lY };
-    Rectf r2 = { other.center.x - other.hlX, other.center.y - other.hlY, other.lX, other.lY };
+	Vector2f p1 = getPosition(), p2 = other.getPosition();
+	float hx1 = getHalfLengthX(), hy1 = getHalfLengthY();
+	float hx2 = other.getHalfLengthX(), hy2 = other.getHalfLengthY();
 
-	return r1.intersects(r2);
+	return p1.x - hx1 < p2.x + hx2 && p2.x - hx2 < p1.x + hx1
+		&& p1.y - hy1 < p2.y + hy2 && p2.y - hy2 < p1.y + hy1;
 }
 
 void PhysicsObject::applyForce(const Vector2f & v) {
-	force = v;
+	if (engine)
+		engine->applyForce(body, v);
 }
 
 void PhysicsObject::applyGravity(const PhysicsEngine & engine) {
-	center += engine.gravity;
+	Vector2f position = getPosition();
+	position.x += engine.gravity.x;
+	position.y += engine.gravity.y;
+	if (this->engine) this->engine->setPosition(body, position);
+	else center = position;
 }
 
 void PhysicsObject::applyAntiGravity(const PhysicsEngine & engine) {
-	center -= engine.gravity;
+	Vector2f position = getPosition();
+	position.x -= engine.gravity.x;
+	position.y -= engine.gravity.y;
+	if (this->engine) this->engine->setPosition(body, position);
+	else center = position;
 }
 
 /* PHYSICS ENGINE */
 
-PhysicsEngine::PhysicsEngine() : gravity(Vector2f(0, DEFAULT_GRAVITY)) {}
+// work split into fixed chunks, so results are the same for any number of threads
+static const size_t INTEGRATE_GRAIN = 4096;	// bodies, a multiple of the vector width
+static const size_t BUCKET_GRAIN = 2048;
+static const size_t PAIR_GRAIN = 2048;
+
+PhysicsEngine::PhysicsEngine() : gravity(Vector2f(0, DEFAULT_GRAVITY)), step(DEFAULT_PHYSICS_STEP), threads(1), cellSize(DEFAULT_PHYSICS_CELL_SIZE), gridStale(true), stats(),
+	broadphase(BROADPHASE_GRID), sweepInserted(0), sweepDirty(false),
+	awakeCount(0), sleepVelocity(DEFAULT_SLEEP_VELOCITY), sleepSteps(DEFAULT_SLEEP_STEPS), snapshotSize(0), staleEntries(0),
+	sleepStale(false), recentStale(false) {
+	slots.push_back(BodySlot());
+	slots[0].used = false;
+	slots[0].generation = 0;
+	slots[0].nextAsleep = 0;
+	slots[0].sleepIndex = NOT_ASLEEP;
+	slots[0].userData = nullptr;
+}
 
 void PhysicsEngine::setGravity(float val, float interval) {
 	gravity = Vector2f(0, val * interval);
+	step = interval;
 }
 
 void PhysicsEngine::registerObject(std::shared_ptr<PhysicsObject> obj) {
-	objects.push_back(obj);
+	if (obj->engine != nullptr)
+		throw EngineException("PhysicsObject is already registered");
+
+	obj->body = createBody(obj->center.x, obj->center.y, obj->halfLengths.x, obj->halfLengths.y);
+	obj->engine = this;
+	slots[obj->body.index].object = obj;
+}
+
+void PhysicsEngine::unregisterObject(std::shared_ptr<PhysicsObject> obj) {
+	if (obj->engine != this)
+		return;
+
+	// the object keeps where the body was
+	obj->center = getPosition(obj->body);
+	obj->halfLengths = getHalfLengths(obj->body);
+	destroyBody(obj->body);
+}
+
+void PhysicsEngine::setThreadCount(int count) {
+	if (count <= 0)
+		count = SDL_GetCPUCount();
+	count = std::max(1, count);
+	if (count == threads)
+		return;
+
+	// the calling thread takes part, so one thread needs no pool
+	threads = count;
+	pool.reset(count > 1 ? new ThreadPool(count - 1) : nullptr);
+}
+
+void PhysicsEngine::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> & job) {
+	if (pool) {
+		pool->parallelFor(count, grain, job);
+		return;
+	}
+
+	for (size_t begin = 0; begin < count; begin += grain)
+		job(begin, std::min(count, begin + grain));
+}
+
+void PhysicsEngine::setBroadphase(Broadphase type) {
+	if (type == broadphase)
+		return;
+
+	broadphase = type;
+	endpointsX.clear();
+	endpointsY.clear();
+	sweepPairs.clear();
+	overlapEvents.clear();
+	removedEvents.clear();
+	sweepDirty = type == BROADPHASE_SWEEP;
+}
+
+void PhysicsEngine::setCellSize(float size) {
+	if (size > 0.0f)
+		cellSize = size;
 }
 
 void PhysicsEngine::update() {
+	Uint64 start = SDL_GetPerformanceCounter();
+	integrate();
+	Uint64 integrateEnd = SDL_GetPerformanceCounter();
+
+	computeBounds();
+	ensureSleepGrid();
+	if (broadphase == BROADPHASE_SWEEP) {
+		sweepAndPrune();
+	}
+	else {
+		stats.cells = buildGrid(awakeGrid, bounds, 0, awakeCount);
+		findCandidates();
+	}
+	gridStale = broadphase == BROADPHASE_SWEEP;
+	Uint64 broadphaseEnd = SDL_GetPerformanceCounter();
+	narrowphase();
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	stats.oversized = awakeGrid.oversized.size();
+	updateIslands();
+	findContactEvents();
+
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	stats.objects = posX.size();
+	stats.awake = awakeCount;
+	stats.sleeping = posX.size() - awakeCount;
+	stats.threads = threads;
+	stats.candidates = candidates.size();
+	stats.contacts = contacts.size();
+	stats.integrateMs = (integrateEnd - start) * 1000.0 / frequency;
+	stats.broadphaseMs = (broadphaseEnd - integrateEnd) * 1000.0 / frequency;
+	stats.narrowphaseMs = (end - broadphaseEnd) * 1000.0 / frequency;
+
+	deliverContactEvents();
+}
+
+/* BODY STORE */
+
+BodyId PhysicsEngine::createBody(float x, float y, float halfLengthX, float halfLengthY, Uint32 bodyFlags) {
+	Uint32 index;
+	if (!freeSlots.empty()) {
+		index = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else {
+		index = (Uint32)slots.size();
+		slots.push_back(BodySlot());
+		slots[index].generation = 0;
+	}
+
+	BodySlot & slot = slots[index];
+	slot.dense = (Uint32)posX.size();
+	slot.used = true;
+	slot.nextAsleep = 0;
+	slot.sleepIndex = NOT_ASLEEP;
+	slot.userData = nullptr;
+
+	posX.push_back(x);
+	posY.push_back(y);
+	startX.push_back(x);
+	startY.push_back(y);
+	velX.push_back(0.0f);
+	velY.push_back(0.0f);
+	halfX.push_back(halfLengthX);
+	halfY.push_back(halfLengthY);
+	forceX.push_back(0.0f);
+	forceY.push_back(0.0f);
+	flags.push_back(bodyFlags);
+	restSteps.push_back(0);
+	layers.push_back(DEFAULT_COLLISION_LAYER);
+	masks.push_back(ALL_LAYERS);
+	denseSlots.push_back(index);
+	bounds.push_back(bodyBox(slot.dense));
+
+	// new bodies are awake, the first sleeping body makes room
+	swapBodies(slot.dense, (Uint32)awakeCount++);
+
+	if (broadphase == BROADPHASE_SWEEP)
+		insertSweepBody(index);
+	gridStale = true;
+
+	return BodyId(index, slot.generation);
+}
+
+void PhysicsEngine::destroyBody(const BodyId & body) {
+	// whatever rested on the body has to fall
+	Uint32 dense = wakeBody(denseIndex(body));
+	if (broadphase == BROADPHASE_SWEEP)
+		removeSweepBody(body);
+
+	// moved to the end of the awake bodies, then the last body takes its place so the arrays stay packed
+	swapBodies(dense, (Uint32)--awakeCount);
+	swapBodies((Uint32)awakeCount, (Uint32)posX.size() - 1);
+
+	posX.pop_back();
+	posY.pop_back();
+	startX.pop_back();
+	startY.pop_back();
+	velX.pop_back();
+	velY.pop_back();
+	halfX.pop_back();
+	halfY.pop_back();
+	forceX.pop_back();
+	forceY.pop_back();
+	flags.pop_back();
+	restSteps.pop_back();
+	layers.pop_back();
+	masks.pop_back();
+	denseSlots.pop_back();
+	bounds.pop_back();
+
+	BodySlot & slot = slots[body.index];
+	if (slot.object) {
+		slot.object->engine = nullptr;
+		slot.object->body = BodyId();
+		slot.object.reset();
+	}
+	slot.used = false;
+	slot.userData = nullptr;
+	slot.generation++;
+	freeSlots.push_back(body.index);
+	gridStale = true;
+}
+
+void PhysicsEngine::swapBodies(Uint32 a, Uint32 b) {
+	if (a == b)
+		return;
+
+	std::swap(posX[a], posX[b]);
+	std::swap(posY[a], posY[b]);
+	std::swap(startX[a], startX[b]);
+	std::swap(startY[a], startY[b]);
+	std::swap(velX[a], velX[b]);
+	std::swap(velY[a], velY[b]);
+	std::swap(halfX[a], halfX[b]);
+	std::swap(halfY[a], halfY[b]);
+	std::swap(forceX[a], forceX[b]);
+	std::swap(forceY[a], forceY[b]);
+	std::swap(flags[a], flags[b]);
+	std::swap(restSteps[a], restSteps[b]);
+	std::swap(layers[a], layers[b]);
+	std::swap(masks[a], masks[b]);
+	std::swap(denseSlots[a], denseSlots[b]);
+	std::swap(bounds[a], bounds[b]);
+	slots[denseSlots[a]].dense = a;
+	slots[denseSlots[b]].dense = b;
+}
+
+bool PhysicsEngine::isBody(const BodyId & body) const {
+	return body.index != 0 && body.index < slots.size()
+		&& slots[body.index].used && slots[body.index].generation == body.generation;
+}
+
+Uint32 PhysicsEngine::denseIndex(const BodyId & body) const {
+	if (!isBody(body))
+		throw EngineException("Stale body id", std::to_string(body.index));
+	return slots[body.index].dense;
+}
+
+Vector2f PhysicsEngine::getPosition(const BodyId & body) const {
+	Uint32 i = denseIndex(body);
+	return Vector2f(posX[i], posY[i]);
+}
+
+void PhysicsEngine::setPosition(const BodyId & body, const Vector2f & position) {
+	Uint32 i = wakeBody(denseIndex(body));
+	posX[i] = position.x;
+	posY[i] = position.y;
+	gridStale = true;
+}
+
+Vector2f PhysicsEngine::getVelocity(const BodyId & body) const {
+	Uint32 i = denseIndex(body);
+	return Vector2f(velX[i], velY[i]);
+}
+
+void PhysicsEngine::setVelocity(const BodyId & body, const Vector2f & velocity) {
+	Uint32 i = wakeBody(denseIndex(body));
+	velX[i] = velocity.x;
+	velY[i] = velocity.y;
+}
+
+Vector2f PhysicsEngine::getHalfLengths(const BodyId & body) const {
+	Uint32 i = denseIndex(body);
+	return Vector2f(halfX[i], halfY[i]);
+}
+
+void PhysicsEngine::setHalfLengths(const BodyId & body, const Vector2f & halfLengths) {
+	Uint32 i = wakeBody(denseIndex(body));
+	halfX[i] = halfLengths.x;
+	halfY[i] = halfLengths.y;
+	gridStale = true;
+}
+
+Uint32 PhysicsEngine::getFlags(const BodyId & body) const {
+	return flags[denseIndex(body)];
+}
+
+void PhysicsEngine::setFlags(const BodyId & body, Uint32 bodyFlags) {
+	flags[wakeBody(denseIndex(body))] = bodyFlags;
+}
+
+void PhysicsEngine::applyForce(const BodyId & body, const Vector2f & force) {
+	Uint32 i = wakeBody(denseIndex(body));
+	forceX[i] += force.x;
+	forceY[i] += force.y;
+}
+
+PhysicsObject * PhysicsEngine::getObject(const BodyId & body) const {
+	return isBody(body) ? slots[body.index].object.get() : nullptr;
+}
+
+void * PhysicsEngine::getUserData(const BodyId & body) const {
+	return isBody(body) ? slots[body.index].userData : nullptr;
+}
+
+void PhysicsEngine::setUserData(const BodyId & body, void * data) {
+	denseIndex(body);
+	slots[body.index].userData = data;
+}
+
+void PhysicsEngine::setCollisionFilter(const BodyId & body, Uint32 layer, Uint32 mask) {
+	Uint32 i = wakeBody(denseIndex(body));
+	layers[i] = layer;
+	masks[i] = mask;
+}
+
+Uint32 PhysicsEngine::getCollisionLayer(const BodyId & body) const {
+	return layers[denseIndex(body)];
+}
+
+Uint32 PhysicsEngine::getCollisionMask(const BodyId & body) const {
+	return masks[denseIndex(body)];
+}
+
+/* INTEGRATION */
+
+const char * PhysicsEngine::getIntegrationPath() {
+#if defined(PHYSICS_AVX2)
+	return "AVX2";
+#elif defined(PHYSICS_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void PhysicsEngine::integrate() {
+	parallelFor(awakeCount, INTEGRATE_GRAIN, [this](size_t begin, size_t end) { integrateRange(begin, end); });
+}
+
+void PhysicsEngine::integrateRange(size_t begin, size_t end) {
+	// semi-implicit Euler, v += (force * dt + gravity), p += v * dt
+	// every path does the same operations in the same order so results do not depend on it
+	const size_t count = end;
+	const float dt = step;
+	size_t i = begin;
+
+	// fast bodies are swept from here
+	std::copy(posX.begin() + begin, posX.begin() + end, startX.begin() + begin);
+	std::copy(posY.begin() + begin, posY.begin() + end, startY.begin() + begin);
+
+#if defined(PHYSICS_AVX2)
+	const __m256 dt8 = _mm256_set1_ps(dt);
+	const __m256 gravityX = _mm256_set1_ps(gravity.x), gravityY = _mm256_set1_ps(gravity.y);
+	const __m256i gravityFlag = _mm256_set1_epi32(BODY_GRAVITY), staticFlag = _mm256_set1_epi32(BODY_STATIC);
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i f = _mm256_loadu_si256((const __m256i *)&flags[i]);
+		__m256 hasGravity = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(f, gravityFlag), gravityFlag));
+		__m256 moving = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(f, staticFlag), zero));
+
+		__m256 dvx = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&forceX[i]), dt8), _mm256_and_ps(hasGravity, gravityX));
+		__m256 dvy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&forceY[i]), dt8), _mm256_and_ps(hasGravity, gravityY));
+		__m256 vx = _mm256_add_ps(_mm256_loadu_ps(&velX[i]), _mm256_and_ps(moving, dvx));
+		__m256 vy = _mm256_add_ps(_mm256_loadu_ps(&velY[i]), _mm256_and_ps(moving, dvy));
+		_mm256_storeu_ps(&velX[i], vx);
+		_mm256_storeu_ps(&velY[i], vy);
+
+		__m256 x = _mm256_add_ps(_mm256_loadu_ps(&posX[i]), _mm256_and_ps(moving, _mm256_mul_ps(vx, dt8)));
+		__m256 y = _mm256_add_ps(_mm256_loadu_ps(&posY[i]), _mm256_and_ps(moving, _mm256_mul_ps(vy, dt8)));
+		_mm256_storeu_ps(&posX[i], x);
+		_mm256_storeu_ps(&posY[i], y);
+	}
+#elif defined(PHYSICS_SSE2)
+	const __m128 dt4 = _mm_set1_ps(dt);
+	const __m128 gravityX = _mm_set1_ps(gravity.x), gravityY = _mm_set1_ps(gravity.y);
+	const __m128i gravityFlag = _mm_set1_epi32(BODY_GRAVITY), staticFlag = _mm_set1_epi32(BODY_STATIC);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i f = _mm_loadu_si128((const __m128i *)&flags[i]);
+		__m128 hasGravity = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(f, gravityFlag), gravityFlag));
+		__m128 moving = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(f, staticFlag), zero));
+
+		__m128 dvx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&forceX[i]), dt4), _mm_and_ps(hasGravity, gravityX));
+		__m128 dvy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&forceY[i]), dt4), _mm_and_ps(hasGravity, gravityY));
+		__m128 vx = _mm_add_ps(_mm_loadu_ps(&velX[i]), _mm_and_ps(moving, dvx));
+		__m128 vy = _mm_add_ps(_mm_loadu_ps(&velY[i]), _mm_and_ps(moving, dvy));
+		_mm_storeu_ps(&velX[i], vx);
+		_mm_storeu_ps(&velY[i], vy);
+
+		__m128 x = _mm_add_ps(_mm_loadu_ps(&posX[i]), _mm_and_ps(moving, _mm_mul_ps(vx, dt4)));
+		__m128 y = _mm_add_ps(_mm_loadu_ps(&posY[i]), _mm_and_ps(moving, _mm_mul_ps(vy, dt4)));
+		_mm_storeu_ps(&posX[i], x);
+		_mm_storeu_ps(&posY[i], y);
+	}
+#endif
+
+	// scalar fallback and the bodies left over from the vector loop
+	for (; i < count; i++) {
+		if (flags[i] & BODY_STATIC)
+			continue;
+
+		bool hasGravity = (flags[i] & BODY_GRAVITY) != 0;
+		velX[i] += forceX[i] * dt + (hasGravity ? gravity.x : 0.0f);
+		velY[i] += forceY[i] * dt + (hasGravity ? gravity.y : 0.0f);
+		posX[i] += velX[i] * dt;
+		posY[i] += velY[i] * dt;
+	}
+
+	std::fill(forceX.begin() + begin, forceX.begin() + end, 0.0f);
+	std::fill(forceY.begin() + begin, forceY.begin() + end, 0.0f);
+
+	const float restLimit = sleepVelocity * sleepVelocity;
+	for (i = begin; i < end; i++) {
+		bool resting = (flags[i] & BODY_STATIC) || velX[i] * velX[i] + velY[i] * velY[i] <= restLimit;
+		restSteps[i] = resting ? std::min(restSteps[i] + 1, (Uint32)INT_MAX) : 0;
+	}
+}
+
+/* BROADPHASE */
+
+int PhysicsEngine::cellOf(float coordinate) const {
+	return (int)floorf(coordinate / cellSize);
+}
+
+Uint32 PhysicsEngine::hashCell(int x, int y) {
+	return (Uint32)x * 73856093u ^ (Uint32)y * 19349663u;
+}
+
+void PhysicsEngine::computeBounds() {
+	// sleeping bodies do not move, their bounds stay as they were
+	Uint32 count = (Uint32)awakeCount;
+	for (Uint32 i = 0; i < count; i++) {
+		Bounds & box = bounds[i];
+		if (flags[i] & BODY_FAST) {
+			// the whole path of the step, so the broadphase pairs it with anything in the way
+			box.minX = std::min(startX[i], posX[i]) - halfX[i];
+			box.minY = std::min(startY[i], posY[i]) - halfY[i];
+			box.maxX = std::max(startX[i], posX[i]) + halfX[i];
+			box.maxY = std::max(startY[i], posY[i]) + halfY[i];
+		}
+		else {
+			box.minX = posX[i] - halfX[i];
+			box.minY = posY[i] - halfY[i];
+			box.maxX = posX[i] + halfX[i];
+			box.maxY = posY[i] + halfY[i];
+		}
+	}
+}
+
+size_t PhysicsEngine::buildGrid(SpatialGrid & grid, const std::vector<Bounds> & boxes, size_t begin, size_t end) {
+	grid.entries.clear();
+	grid.oversized.clear();
+
+	for (Uint32 i = (Uint32)begin; i < (Uint32)end; i++) {
+		const Bounds & box = boxes[i];
+		int x0 = cellOf(box.minX), x1 = cellOf(box.maxX);
+		int y0 = cellOf(box.minY), y1 = cellOf(box.maxY);
+		if ((x1 - x0 + 1) * (y1 - y0 + 1) > MAX_CELLS_PER_OBJECT) {
+			grid.oversized.push_back(i);
+			continue;
+		}
+
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				GridEntry entry = { x, y, i, 0 };
+				grid.entries.push_back(entry);
+			}
+		}
+	}
+
+	// counting sort of the entries into hash buckets, about two buckets per entry
+	size_t bucketCount = 16;
+	while (bucketCount < grid.entries.size() * 2)
+		bucketCount <<= 1;
+	grid.bucketMask = (Uint32)bucketCount - 1;
+
+	grid.minX = grid.minY = INT_MAX;
+	grid.maxX = grid.maxY = INT_MIN;
+	grid.bucketStarts.assign(bucketCount + 1, 0);
+	for (auto & entry : grid.entries) {
+		entry.bucket = hashCell(entry.cellX, entry.cellY) & grid.bucketMask;
+		grid.bucketStarts[entry.bucket + 1]++;
+
+		grid.minX = std::min(grid.minX, entry.cellX);
+		grid.minY = std::min(grid.minY, entry.cellY);
+		grid.maxX = std::max(grid.maxX, entry.cellX);
+		grid.maxY = std::max(grid.maxY, entry.cellY);
+	}
+
+	size_t occupied = 0;
+	for (size_t b = 0; b < bucketCount; b++) {
+		if (grid.bucketStarts[b + 1] > 0) occupied++;
+		grid.bucketStarts[b + 1] += grid.bucketStarts[b];
+	}
+
+	grid.bucketCursor.assign(grid.bucketStarts.begin(), grid.bucketStarts.end() - 1);
+	grid.sortedEntries.resize(grid.entries.size());
+	for (auto & entry : grid.entries)
+		grid.sortedEntries[grid.bucketCursor[entry.bucket]++] = entry;
+
+	return occupied;
+}
+
+template <typename F>
+void PhysicsEngine::forEachInCell(const SpatialGrid & grid, int cellX, int cellY, F visit) const {
+	Uint32 bucket = hashCell(cellX, cellY) & grid.bucketMask;
+	for (Uint32 i = grid.bucketStarts[bucket]; i < grid.bucketStarts[bucket + 1]; i++) {
+		const GridEntry & entry = grid.sortedEntries[i];
+		if (entry.cellX == cellX && entry.cellY == cellY && (&grid == &awakeGrid || isSleepEntry(entry.object)))
+			visit(entry.object);
+	}
+}
+
+template <typename F>
+void PhysicsEngine::forEachOversized(const SpatialGrid & grid, F visit) const {
+	for (Uint32 object : grid.oversized)
+		if (&grid == &awakeGrid || isSleepEntry(object))
+			visit(object);
+}
+
+void PhysicsEngine::findCandidates() {
+	// each range of buckets collects its own pairs, joined in bucket order as if found by one thread
+	size_t bucketCount = awakeGrid.bucketStarts.size() - 1;
+	size_t chunks = (bucketCount + BUCKET_GRAIN - 1) / BUCKET_GRAIN;
+	if (chunkCandidates.size() < chunks)
+		chunkCandidates.resize(chunks);
+
+	parallelFor(bucketCount, BUCKET_GRAIN, [this](size_t begin, size_t end) {
+		std::vector<std::pair<Uint32, Uint32>> & pairs = chunkCandidates[begin / BUCKET_GRAIN];
+		pairs.clear();
+		findCellPairs(awakeGrid, bounds, begin, end, pairs);
+	});
+
+	candidates.clear();
+	for (size_t c = 0; c < chunks; c++)
+		candidates.insert(candidates.end(), chunkCandidates[c].begin(), chunkCandidates[c].end());
+
+	const std::vector<Uint32> & oversized = awakeGrid.oversized;
+	for (size_t i = 0; i < oversized.size(); i++) {
+		Uint32 big = oversized[i];
+		for (Uint32 other = 0; other < (Uint32)posX.size(); other++) {
+			// pairs of two oversized objects are only added once, oversized is in index order
+			if (other == big || (other < big && std::binary_search(oversized.begin(), oversized.begin() + i, other)))
+				continue;
+
+			candidates.push_back(std::make_pair(std::min(big, other), std::max(big, other)));
+		}
+	}
+
+	if (awakeCount == posX.size())
+		return;
+
+	// awake bodies look up the sleeping ones in their cells, pairs of sleeping bodies are already known
+	chunks = (awakeCount + BUCKET_GRAIN - 1) / BUCKET_GRAIN;
+	if (chunkCandidates.size() < chunks)
+		chunkCandidates.resize(chunks);
+
+	parallelFor(awakeCount, BUCKET_GRAIN, [this](size_t begin, size_t end) {
+		std::vector<std::pair<Uint32, Uint32>> & pairs = chunkCandidates[begin / BUCKET_GRAIN];
+		pairs.clear();
+		for (Uint32 i = (Uint32)begin; i < (Uint32)end; i++) {
+			const Bounds & box = bounds[i];
+			int x0 = cellOf(box.minX), x1 = cellOf(box.maxX);
+			int y0 = cellOf(box.minY), y1 = cellOf(box.maxY);
+			if ((x1 - x0 + 1) * (y1 - y0 + 1) > MAX_CELLS_PER_OBJECT)
+				continue;	// paired with everything above
+
+			for (const SpatialGrid * grid : { &sleepGrid, &recentGrid }) {
+				for (int y = std::max(y0, grid->minY); y <= std::min(y1, grid->maxY); y++) {
+					for (int x = std::max(x0, grid->minX); x <= std::min(x1, grid->maxX); x++) {
+						forEachInCell(*grid, x, y, [&](Uint32 object) {
+							const Bounds & other = sleepBounds[object];
+							if (box.overlaps(other) && cellOf(std::max(box.minX, other.minX)) == x && cellOf(std::max(box.minY, other.minY)) == y)
+								pairs.push_back(std::make_pair(i, slots[sleepSlots[object]].dense));
+						});
+					}
+				}
+			}
+		}
+	});
+
+	for (size_t c = 0; c < chunks; c++)
+		candidates.insert(candidates.end(), chunkCandidates[c].begin(), chunkCandidates[c].end());
+
+	for (const SpatialGrid * grid : { &sleepGrid, &recentGrid }) {
+		forEachOversized(*grid, [&](Uint32 object) {
+			Uint32 big = slots[sleepSlots[object]].dense;
+			for (Uint32 other = 0; other < (Uint32)awakeCount; other++)
+				if (!std::binary_search(oversized.begin(), oversized.end(), other))
+					candidates.push_back(std::make_pair(other, big));
+		});
+	}
+}
+
+void PhysicsEngine::findCellPairs(const SpatialGrid & grid, const std::vector<Bounds> & boxes, size_t beginBucket, size_t endBucket,
+	std::vector<std::pair<Uint32, Uint32>> & pairs) const {
+	for (size_t b = beginBucket; b < endBucket; b++) {
+		Uint32 begin = grid.bucketStarts[b], end = grid.bucketStarts[b + 1];
+		for (Uint32 i = begin; i < end; i++) {
+			const GridEntry & first = grid.sortedEntries[i];
+			for (Uint32 j = i + 1; j < end; j++) {
+				const GridEntry & second = grid.sortedEntries[j];
+				if (first.cellX != second.cellX || first.cellY != second.cellY)
+					continue;	// another cell with the same hash
+
+				Uint32 a = std::min(first.object, second.object);
+				Uint32 c = std::max(first.object, second.object);
+				const Bounds & boxA = boxes[a];
+				const Bounds & boxC = boxes[c];
+				if (!boxA.overlaps(boxC))
+					continue;
+
+				// objects sharing several cells are reported from the cell holding the corner of their overlap
+				if (cellOf(std::max(boxA.minX, boxC.minX)) != first.cellX || cellOf(std::max(boxA.minY, boxC.minY)) != first.cellY)
+					continue;
+
+				pairs.push_back(std::make_pair(a, c));
+			}
+		}
+	}
+}
+
+/* SWEEP AND PRUNE */
+
+bool PhysicsEngine::before(const Endpoint & a, const Endpoint & b) {
+	// on a tie the max comes first, so touching boxes do not overlap
+	return a.value < b.value || (a.value == b.value && !a.min && b.min);
+}
+
+Uint64 PhysicsEngine::pairKey(Uint32 slotA, Uint32 slotB) {
+	if (slotA > slotB)
+		std::swap(slotA, slotB);
+	return ((Uint64)slotA << 32) | slotB;
+}
+
+void PhysicsEngine::addSweepPair(Uint32 slotA, Uint32 slotB) {
+	if (!bounds[slots[slotA].dense].overlaps(bounds[slots[slotB].dense]))
+		return;
+
+	if (sweepPairs.insert(pairKey(slotA, slotB)).second) {
+		OverlapEvent event = { BodyId(slotA, slots[slotA].generation), BodyId(slotB, slots[slotB].generation), true };
+		overlapEvents.push_back(event);
+	}
+}
+
+void PhysicsEngine::removeSweepPair(Uint32 slotA, Uint32 slotB) {
+	if (sweepPairs.erase(pairKey(slotA, slotB)) > 0) {
+		OverlapEvent event = { BodyId(slotA, slots[slotA].generation), BodyId(slotB, slots[slotB].generation), false };
+		overlapEvents.push_back(event);
+	}
+}
+
+void PhysicsEngine::insertSweepBody(Uint32 slot) {
+	// appended past the end, the next sort moves it into place and finds its overlaps
+	Endpoint min = { 0.0f, slot, true }, max = { 0.0f, slot, false };
+	endpointsX.push_back(min);
+	endpointsX.push_back(max);
+	endpointsY.push_back(min);
+	endpointsY.push_back(max);
+	sweepInserted++;
+}
+
+void PhysicsEngine::removeSweepBody(const BodyId & body) {
+	auto ofBody = [&body](const Endpoint & endpoint) { return endpoint.slot == body.index; };
+	endpointsX.erase(std::remove_if(endpointsX.begin(), endpointsX.end(), ofBody), endpointsX.end());
+	endpointsY.erase(std::remove_if(endpointsY.begin(), endpointsY.end(), ofBody), endpointsY.end());
+
+	for (auto iter = sweepPairs.begin(); iter != sweepPairs.end();) {
+		Uint32 slotA = (Uint32)(*iter >> 32), slotB = (Uint32)*iter;
+		if (slotA == body.index || slotB == body.index) {
+			OverlapEvent event = { BodyId(slotA, slots[slotA].generation), BodyId(slotB, slots[slotB].generation), false };
+			removedEvents.push_back(event);
+			iter = sweepPairs.erase(iter);
+		}
+		else {
+			++iter;
+		}
+	}
+}
+
+void PhysicsEngine::sortAxis(std::vector<Endpoint> & axis, bool xAxis) {
+	for (auto & endpoint : axis) {
+		const Bounds & box = bounds[slots[endpoint.slot].dense];
+		endpoint.value = xAxis ? (endpoint.min ? box.minX : box.maxX) : (endpoint.min ? box.minY : box.maxY);
+	}
+
+	// insertion sort, close to linear when the order barely changed since the last step
+	// every swap of a min and a max is where two boxes start or stop overlapping on this axis
+	for (size_t i = 1; i < axis.size(); i++) {
+		Endpoint endpoint = axis[i];
+		size_t j = i;
+		for (; j > 0 && before(endpoint, axis[j - 1]); j--) {
+			const Endpoint & other = axis[j - 1];
+			if (endpoint.slot != other.slot) {
+				if (endpoint.min && !other.min)
+					addSweepPair(endpoint.slot, other.slot);
+				else if (!endpoint.min && other.min)
+					removeSweepPair(endpoint.slot, other.slot);
+			}
+
+			axis[j] = other;
+			stats.swaps++;
+		}
+		axis[j] = endpoint;
+	}
+}
+
+void PhysicsEngine::rebuildSweep() {
+	endpointsX.clear();
+	endpointsY.clear();
+	for (Uint32 dense = 0; dense < (Uint32)denseSlots.size(); dense++) {
+		const Bounds & box = bounds[dense];
+		Uint32 slot = denseSlots[dense];
+		Endpoint minX = { box.minX, slot, true }, maxX = { box.maxX, slot, false };
+		Endpoint minY = { box.minY, slot, true }, maxY = { box.maxY, slot, false };
+		endpointsX.push_back(minX);
+		endpointsX.push_back(maxX);
+		endpointsY.push_back(minY);
+		endpointsY.push_back(maxY);
+	}
+
+	std::sort(endpointsX.begin(), endpointsX.end(), before);
+	std::sort(endpointsY.begin(), endpointsY.end(), before);
+
+	// one sweep along x finds all pairs, then only the changes are reported
+	std::unordered_set<Uint64> previous;
+	previous.swap(sweepPairs);
+
+	std::vector<Uint32> open;
+	for (auto & endpoint : endpointsX) {
+		if (endpoint.min) {
+			for (Uint32 other : open)
+				if (bounds[slots[endpoint.slot].dense].overlaps(bounds[slots[other].dense]))
+					sweepPairs.insert(pairKey(endpoint.slot, other));
+			open.push_back(endpoint.slot);
+		}
+		else {
+			auto iter = std::find(open.begin(), open.end(), endpoint.slot);
+			*iter = open.back();
+			open.pop_back();
+		}
+	}
+
+	for (Uint64 key : sweepPairs) {
+		if (previous.count(key) == 0) {
+			Uint32 slotA = (Uint32)(key >> 32), slotB = (Uint32)key;
+			OverlapEvent event = { BodyId(slotA, slots[slotA].generation), BodyId(slotB, slots[slotB].generation), true };
+			overlapEvents.push_back(event);
+		}
+	}
+
+	for (Uint64 key : previous) {
+		if (sweepPairs.count(key) == 0) {
+			Uint32 slotA = (Uint32)(key >> 32), slotB = (Uint32)key;
+			OverlapEvent event = { BodyId(slotA, slots[slotA].generation), BodyId(slotB, slots[slotB].generation), false };
+			overlapEvents.push_back(event);
+		}
+	}
+
+	sweepInserted = 0;
+	sweepDirty = false;
+}
+
+void PhysicsEngine::sweepAndPrune() {
+	// overlaps ended by destroyBody() since the last step come first
+	overlapEvents.swap(removedEvents);
+	removedEvents.clear();
+	stats.cells = 0;
+	stats.swaps = 0;
+	awakeGrid.oversized.clear();
+
+	// many new bodies would each have to travel the whole list, sorting from scratch is cheaper
+	if (sweepDirty || sweepInserted * 8 > denseSlots.size()) {
+		rebuildSweep();
+	}
+	else {
+		sortAxis(endpointsX, true);
+		sortAxis(endpointsY, false);
+		sweepInserted = 0;
+	}
+
+	// sorted so that the contacts do not depend on the hash set layout
+	candidates.clear();
+	for (Uint64 key : sweepPairs) {
+		Uint32 a = slots[(Uint32)(key >> 32)].dense, b = slots[(Uint32)key].dense;
+		if (std::min(a, b) >= awakeCount)
+			continue;	// both asleep, in sleepContacts
+		candidates.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+	}
+	std::sort(candidates.begin(), candidates.end());
+}
+
+/* NARROWPHASE */
 
-}
\ No newline at end of file
+void PhysicsEngine::narrowphase() {
+	size_t chunks = (candidates.size() + PAIR_GRAIN - 1) / PAIR_GRAIN;
+	if (chunkContacts.size() < chunks)
+		chunkContacts.resize(chunks);
+
+	parallelFor(candidates.size(), PAIR_GRAIN, [this](size_t begin, size_t end) {
+		std::vector<Contact> & found = chunkContacts[begin / PAIR_GRAIN];
+		found.clear();
+		for (size_t i = begin; i < end; i++) {
+			Uint32 a = candidates[i].first, b = candidates[i].second;
+			if (!collides(a, b))
+				continue;
+
+			Contact contact = { bodyAt(a), bodyAt(b), 1.0f, Vector2f() };
+
+			if ((flags[a] | flags[b]) & BODY_FAST) {
+				if (sweep(a, b, contact.toi, contact.normal))
+					found.push_back(contact);
+			}
+			else if (bounds[a].overlaps(bounds[b])) {
+				contact.normal = bounds[a].separation(bounds[b]);
+				found.push_back(contact);
+			}
+		}
+	});
+
+	contacts.clear();
+	for (size_t c = 0; c < chunks; c++)
+		contacts.insert(contacts.end(), chunkContacts[c].begin(), chunkContacts[c].end());
+	contacts.insert(contacts.end(), sleepContacts.begin(), sleepContacts.end());
+
+	stats.swept = 0;
+	for (auto & pair : candidates)
+		if ((flags[pair.first] | flags[pair.second]) & BODY_FAST) stats.swept++;
+}
+
+bool PhysicsEngine::sweep(Uint32 a, Uint32 b, float & toi, Vector2f & normal) const {
+	// a moves against a resting b by the difference of both displacements
+	Bounds boxA = { startX[a] - halfX[a], startY[a] - halfY[a], startX[a] + halfX[a], startY[a] + halfY[a] };
+	Bounds boxB = { startX[b] - halfX[b], startY[b] - halfY[b], startX[b] + halfX[b], startY[b] + halfY[b] };
+	float dx = (posX[a] - startX[a]) - (posX[b] - startX[b]);
+	float dy = (posY[a] - startY[a]) - (posY[b] - startY[b]);
+
+	return boxA.sweep(dx, dy, boxB, toi, normal);
+}
+
+/* QUERIES */
+
+void PhysicsEngine::ensureGrid() {
+	ensureSleepGrid();
+	if (!gridStale)
+		return;
+
+	computeBounds();
+	buildGrid(awakeGrid, bounds, 0, awakeCount);
+	gridStale = false;
+}
+
+PhysicsEngine::Bounds PhysicsEngine::bodyBox(Uint32 dense) const {
+	Bounds box = { posX[dense] - halfX[dense], posY[dense] - halfY[dense], posX[dense] + halfX[dense], posY[dense] + halfY[dense] };
+	return box;
+}
+
+Uint32 PhysicsEngine::gridBody(const SpatialGrid & grid, Uint32 object) const {
+	return &grid == &awakeGrid ? object : slots[sleepSlots[object]].dense;
+}
+
+const PhysicsEngine::Bounds & PhysicsEngine::gridBounds(const SpatialGrid & grid, Uint32 object) const {
+	return &grid == &awakeGrid ? bounds[object] : sleepBounds[object];
+}
+
+template <typename F>
+void PhysicsEngine::traceRay(const SpatialGrid & grid, const Vector2f & origin, const Vector2f & direction, float maxDistance, F visit) const {
+	if (grid.minX > grid.maxX)
+		return;
+
+	// the ray starts where it enters the occupied cells
+	Bounds extents = { grid.minX * cellSize, grid.minY * cellSize, (grid.maxX + 1) * cellSize, (grid.maxY + 1) * cellSize };
+	float t;
+	Vector2f face;
+	if (!extents.raycast(origin, direction, maxDistance, t, face))
+		return;
+
+	int x = std::min(std::max(cellOf(origin.x + direction.x * t), grid.minX), grid.maxX);
+	int y = std::min(std::max(cellOf(origin.y + direction.y * t), grid.minY), grid.maxY);
+	int stepX = direction.x > 0.0f ? 1 : -1;
+	int stepY = direction.y > 0.0f ? 1 : -1;
+
+	// distances at which the ray crosses the next cell edge on each axis
+	float nextX = INFINITY, nextY = INFINITY, deltaX = INFINITY, deltaY = INFINITY;
+	if (direction.x != 0.0f) {
+		nextX = ((x + (stepX > 0 ? 1 : 0)) * cellSize - origin.x) / direction.x;
+		deltaX = cellSize / fabsf(direction.x);
+	}
+	if (direction.y != 0.0f) {
+		nextY = ((y + (stepY > 0 ? 1 : 0)) * cellSize - origin.y) / direction.y;
+		deltaY = cellSize / fabsf(direction.y);
+	}
+
+	while (true) {
+		float exit = std::min(std::min(nextX, nextY), maxDistance);
+		if (!visit(x, y, t, exit) || exit >= maxDistance)
+			return;
+
+		if (nextX < nextY) {
+			x += stepX;
+			t = nextX;
+			nextX += deltaX;
+		}
+		else {
+			y += stepY;
+			t = nextY;
+			nextY += deltaY;
+		}
+
+		if (x < grid.minX || x > grid.maxX || y < grid.minY || y > grid.maxY)
+			return;
+	}
+}
+
+bool PhysicsEngine::raycast(const Vector2f & origin, const Vector2f & direction, float maxDistance, RaycastHit & hit) {
+	float length = sqrtf(direction.x * direction.x + direction.y * direction.y);
+	if (length == 0.0f || maxDistance <= 0.0f)
+		return false;
+	Vector2f dir(direction.x / length, direction.y / length);
+
+	ensureGrid();
+	float best = maxDistance;
+	bool found = false;
+
+	auto test = [&](Uint32 i) {
+		float t;
+		Vector2f normal;
+		if (bodyBox(i).raycast(origin, dir, best, t, normal)) {
+			hit.body = bodyAt(i);
+			hit.distance = t;
+			hit.normal = normal;
+			best = t;
+			found = true;
+		}
+	};
+
+	// awake and sleeping bodies are in separate grids, each walk starts with the best hit of the ones before
+	for (const SpatialGrid * grid : { &awakeGrid, &sleepGrid, &recentGrid }) {
+		forEachOversized(*grid, [&](Uint32 object) { test(gridBody(*grid, object)); });
+
+		// a body entered further along than the best hit cannot be nearer
+		traceRay(*grid, origin, dir, maxDistance, [&](int x, int y, float enter, float) {
+			if (found && enter > hit.distance)
+				return false;
+			forEachInCell(*grid, x, y, [&](Uint32 object) { test(gridBody(*grid, object)); });
+			return true;
+		});
+	}
+
+	if (found)
+		hit.point = Vector2f(origin.x + dir.x * hit.distance, origin.y + dir.y * hit.distance);
+	return found;
+}
+
+size_t PhysicsEngine::raycastAll(const Vector2f & origin, const Vector2f & direction, float maxDistance, RaycastHit * hits, size_t maxHits) {
+	float length = sqrtf(direction.x * direction.x + direction.y * direction.y);
+	if (length == 0.0f || maxDistance <= 0.0f || maxHits == 0)
+		return 0;
+	Vector2f dir(direction.x / length, direction.y / length);
+
+	ensureGrid();
+	size_t count = 0;
+	size_t farthest = 0;	// the hit to replace once the buffer is full
+
+	auto test = [&](Uint32 i) {
+		float t;
+		Vector2f normal;
+		if (!bodyBox(i).raycast(origin, dir, maxDistance, t, normal))
+			return;
+		if (count == maxHits && t >= hits[farthest].distance)
+			return;
+
+		// a body covering several cells is met again in each of them
+		BodyId body = bodyAt(i);
+		for (size_t h = 0; h < count; h++)
+			if (hits[h].body == body) return;
+
+		RaycastHit hit = { body, t, Vector2f(origin.x + dir.x * t, origin.y + dir.y * t), normal };
+		if (count < maxHits) {
+			hits[count++] = hit;
+		}
+		else {
+			hits[farthest] = hit;
+		}
+
+		if (count == maxHits) {
+			farthest = 0;
+			for (size_t h = 1; h < count; h++)
+				if (hits[h].distance > hits[farthest].distance) farthest = h;
+		}
+	};
+
+	for (const SpatialGrid * grid : { &awakeGrid, &sleepGrid, &recentGrid }) {
+		forEachOversized(*grid, [&](Uint32 object) { test(gridBody(*grid, object)); });
+
+		traceRay(*grid, origin, dir, maxDistance, [&](int x, int y, float enter, float) {
+			if (count == maxHits && enter > hits[farthest].distance)
+				return false;
+			forEachInCell(*grid, x, y, [&](Uint32 object) { test(gridBody(*grid, object)); });
+			return true;
+		});
+	}
+
+	std::sort(hits, hits + count, [](const RaycastHit & a, const RaycastHit & b) {
+		return a.distance < b.distance || (a.distance == b.distance && a.body.index < b.body.index);
+	});
+	return count;
+}
+
+size_t PhysicsEngine::queryRegion(const Box2f & region, BodyId * results, size_t maxResults) {
+	ensureGrid();
+	size_t count = 0;
+
+	auto test = [&](Uint32 i) {
+		if (bodyBox(i).overlaps(region)) {
+			if (count < maxResults) results[count] = bodyAt(i);
+			count++;
+		}
+	};
+
+	int x0 = cellOf(region.minX), x1 = cellOf(region.maxX);
+	int y0 = cellOf(region.minY), y1 = cellOf(region.maxY);
+
+	// a region covering more cells than there are bodies is quicker to test body by body
+	if ((double)(x1 - x0 + 1) * (y1 - y0 + 1) > (double)posX.size()) {
+		for (Uint32 i = 0; i < (Uint32)posX.size(); i++)
+			test(i);
+		return count;
+	}
+
+	for (const SpatialGrid * grid : { &awakeGrid, &sleepGrid, &recentGrid }) {
+		forEachOversized(*grid, [&](Uint32 object) { test(gridBody(*grid, object)); });
+
+		for (int y = std::max(y0, grid->minY); y <= std::min(y1, grid->maxY); y++) {
+			for (int x = std::max(x0, grid->minX); x <= std::min(x1, grid->maxX); x++) {
+				forEachInCell(*grid, x, y, [&](Uint32 object) {
+					// bodies in several of the cells are reported from the one holding the corner of the overlap
+					const Bounds & box = gridBounds(*grid, object);
+					if (cellOf(std::max(box.minX, region.minX)) == x && cellOf(std::max(box.minY, region.minY)) == y)
+						test(gridBody(*grid, object));
+				});
+			}
+		}
+	}
+
+	return count;
+}
+
+size_t PhysicsEngine::queryNearest(const Vector2f & point, NearestHit * results, size_t k) {
+	if (k == 0)
+		return 0;
+
+	ensureGrid();
+	size_t count = 0;
+
+	// results is kept as a heap with the farthest of the nearest bodies on top
+	auto farther = [](const NearestHit & a, const NearestHit & b) {
+		return a.distance < b.distance || (a.distance == b.distance && a.body.index < b.body.index);
+	};
+
+	auto test = [&](Uint32 i) {
+		NearestHit hit = { bodyAt(i), bodyBox(i).distanceTo(point) };
+		if (count == k && !farther(hit, results[0]))
+			return;
+
+		for (size_t h = 0; h < count; h++)
+			if (results[h].body == hit.body) return;
+
+		if (count == k)
+			std::pop_heap(results, results + count--, farther);
+		results[count++] = hit;
+		std::push_heap(results, results + count, farther);
+	};
+
+	for (const SpatialGrid * grid : { &awakeGrid, &sleepGrid, &recentGrid }) {
+		forEachOversized(*grid, [&](Uint32 object) { test(gridBody(*grid, object)); });
+
+		if (grid->minX > grid->maxX)
+			continue;
+
+		// rings of cells around the point, every body outside ring r is at least r - 1 cells away
+		int cx = cellOf(point.x), cy = cellOf(point.y);
+		int first = std::max(std::max(grid->minX - cx, cx - grid->maxX), std::max(grid->minY - cy, cy - grid->maxY));
+		int last = std::max(std::max(cx - grid->minX, grid->maxX - cx), std::max(cy - grid->minY, grid->maxY - cy));
+		auto visit = [&](Uint32 object) { test(gridBody(*grid, object)); };
+
+		for (int r = std::max(0, first); r <= last; r++) {
+			if (count == k && results[0].distance <= (r - 1) * cellSize)
+				break;
+
+			int y0 = std::max(cy - r, grid->minY), y1 = std::min(cy + r, grid->maxY);
+			int x0 = std::max(cx - r, grid->minX), x1 = std::min(cx + r, grid->maxX);
+			for (int y = y0; y <= y1; y++) {
+				if (y == cy - r || y == cy + r) {
+					for (int x = x0; x <= x1; x++)
+						forEachInCell(*grid, x, y, visit);
+				}
+				else {
+					if (cx - r >= grid->minX) forEachInCell(*grid, cx - r, y, visit);
+					if (cx + r <= grid->maxX) forEachInCell(*grid, cx + r, y, visit);
+				}
+			}
+		}
+	}
+
+	std::sort_heap(results, results + count, farther);
+	return count;
+}
+
+/* SLEEP */
+
+void PhysicsEngine::setSleep(float velocity, int steps) {
+	sleepVelocity = std::max(0.0f, velocity);
+	sleepSteps = std::max(0, steps);
+
+	if (sleepSteps == 0)
+		while (awakeCount < posX.size())
+			wakeIsland(denseSlots[awakeCount]);
+}
+
+bool PhysicsEngine::isAwake(const BodyId & body) const {
+	return denseIndex(body) < awakeCount;
+}
+
+void PhysicsEngine::wake(const BodyId & body) {
+	wakeBody(denseIndex(body));
+}
+
+Uint32 PhysicsEngine::wakeBody(Uint32 dense) {
+	Uint32 slot = denseSlots[dense];
+	if (dense >= awakeCount)
+		wakeIsland(slot);
+
+	dense = slots[slot].dense;
+	restSteps[dense] = 0;
+	return dense;
+}
+
+void PhysicsEngine::wakeIsland(Uint32 slot) {
+	// an island is a ring of slots, any of them leads to the rest
+	Uint32 current = slot;
+	do {
+		BodySlot & body = slots[current];
+		Uint32 next = body.nextAsleep;
+		body.nextAsleep = 0;
+
+		if (body.dense >= awakeCount) {
+			restSteps[body.dense] = 0;
+			swapBodies(body.dense, (Uint32)awakeCount++);
+			body.sleepIndex = NOT_ASLEEP;
+			staleEntries++;
+		}
+		current = next;
+	} while (current != 0 && current != slot);
+
+	gridStale = true;
+	sleepStale = true;
+}
+
+void PhysicsEngine::ensureSleepGrid() {
+	if (!sleepStale)
+		return;
+
+	// once the recent and stale entries outweigh an eighth of the sleeping bodies, both grids start over
+	size_t sleeping = posX.size() - awakeCount;
+	if (sleepSlots.size() - snapshotSize + staleEntries > sleeping / 8 + 256) {
+		sleepSlots.assign(denseSlots.begin() + awakeCount, denseSlots.end());
+		sleepBounds.assign(bounds.begin() + awakeCount, bounds.end());
+		for (Uint32 i = 0; i < (Uint32)sleepSlots.size(); i++)
+			slots[sleepSlots[i]].sleepIndex = i;
+
+		snapshotSize = sleepSlots.size();
+		staleEntries = 0;
+		buildGrid(sleepGrid, sleepBounds, 0, snapshotSize);
+		sleepPairs.clear();
+		findSleepPairs(sleepGrid, 0, snapshotSize, sleepPairs);
+		recentStale = true;
+	}
+
+	if (recentStale) {
+		buildGrid(recentGrid, sleepBounds, snapshotSize, sleepSlots.size());
+		recentPairs.clear();
+		findSleepPairs(recentGrid, snapshotSize, sleepSlots.size(), recentPairs);
+		recentStale = false;
+	}
+
+	// sleeping bodies do not move, so the contacts between them only change as bodies wake or fall asleep
+	sleepContacts.clear();
+	for (auto * pairs : { &sleepPairs, &recentPairs }) {
+		for (auto & pair : *pairs) {
+			if (!isSleepEntry(pair.first) || !isSleepEntry(pair.second))
+				continue;
+
+			Uint32 a = sleepSlots[pair.first], b = sleepSlots[pair.second];
+			if (!collides(slots[a].dense, slots[b].dense))
+				continue;
+
+			Contact contact = { BodyId(a, slots[a].generation), BodyId(b, slots[b].generation), 1.0f,
+				sleepBounds[pair.first].separation(sleepBounds[pair.second]) };
+			sleepContacts.push_back(contact);
+		}
+	}
+
+	sleepStale = false;
+}
+
+void PhysicsEngine::findSleepPairs(const SpatialGrid & grid, size_t begin, size_t end, std::vector<std::pair<Uint32, Uint32>> & pairs) {
+	findCellPairs(grid, sleepBounds, 0, grid.bucketStarts.size() - 1, pairs);
+
+	// oversized entries against every entry before them, pairs of two are only added once
+	const std::vector<Uint32> & oversized = grid.oversized;
+	for (size_t i = 0; i < oversized.size(); i++) {
+		Uint32 big = oversized[i];
+		for (Uint32 other = 0; other < (Uint32)end; other++) {
+			if (other == big || (other >= begin && other < big && std::binary_search(oversized.begin(), oversized.begin() + i, other)))
+				continue;
+			if (sleepBounds[big].overlaps(sleepBounds[other]))
+				pairs.push_back(std::make_pair(std::min(big, other), std::max(big, other)));
+		}
+	}
+
+	if (&grid != &recentGrid)
+		return;
+
+	// recent entries against the snapshot
+	for (Uint32 i = (Uint32)begin; i < (Uint32)end; i++) {
+		if (std::binary_search(oversized.begin(), oversized.end(), i))
+			continue;
+
+		const Bounds & box = sleepBounds[i];
+		int x0 = std::max(cellOf(box.minX), sleepGrid.minX), x1 = std::min(cellOf(box.maxX), sleepGrid.maxX);
+		int y0 = std::max(cellOf(box.minY), sleepGrid.minY), y1 = std::min(cellOf(box.maxY), sleepGrid.maxY);
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				forEachInCell(sleepGrid, x, y, [&](Uint32 object) {
+					const Bounds & other = sleepBounds[object];
+					if (box.overlaps(other) && cellOf(std::max(box.minX, other.minX)) == x && cellOf(std::max(box.minY, other.minY)) == y)
+						pairs.push_back(std::make_pair(object, i));
+				});
+			}
+		}
+	}
+
+	forEachOversized(sleepGrid, [&](Uint32 big) {
+		for (Uint32 i = (Uint32)begin; i < (Uint32)end; i++)
+			if (!std::binary_search(oversized.begin(), oversized.end(), i) && sleepBounds[big].overlaps(sleepBounds[i]))
+				pairs.push_back(std::make_pair(big, i));
+	});
+}
+
+Uint32 PhysicsEngine::findIsland(Uint32 dense) {
+	while (islandParent[dense] != dense) {
+		islandParent[dense] = islandParent[islandParent[dense]];
+		dense = islandParent[dense];
+	}
+	return dense;
+}
+
+void PhysicsEngine::updateIslands() {
+	if (sleepSteps == 0)
+		return;
+
+	// contacts between moving bodies join their islands, static bodies keep to themselves
+	islandParent.resize(awakeCount);
+	for (Uint32 i = 0; i < (Uint32)awakeCount; i++)
+		islandParent[i] = i;
+
+	wakers.clear();
+	touching.clear();
+
+	size_t stepContacts = contacts.size() - sleepContacts.size();
+	for (size_t c = 0; c < stepContacts; c++) {
+		Uint32 a = slots[contacts[c].a.index].dense, b = slots[contacts[c].b.index].dense;
+		if ((flags[a] & BODY_STATIC) || (flags[b] & BODY_STATIC))
+			continue;
+
+		if (a < awakeCount && b < awakeCount) {
+			islandParent[findIsland(a)] = findIsland(b);
+		}
+		else {
+			// only one can sleep, pairs of sleeping bodies are not in this step's contacts
+			Uint32 awake = a < awakeCount ? a : b;
+			wakers.push_back(denseSlots[awake == a ? b : a]);
+			touching.push_back(awake);	// kept awake to join the island it wakes
+		}
+	}
+
+	// an island sleeps once its most recently moving body has rested long enough
+	islandRest.assign(awakeCount, INT_MAX);
+	for (Uint32 i = 0; i < (Uint32)awakeCount; i++) {
+		Uint32 root = findIsland(i);
+		islandRest[root] = std::min(islandRest[root], restSteps[i]);
+	}
+	for (Uint32 i : touching)
+		islandRest[findIsland(i)] = 0;
+
+	// bodies of each island falling asleep are linked into a ring
+	islandFirst.assign(awakeCount, 0);
+	islandLast.assign(awakeCount, 0);
+	sleepers.clear();
+	for (Uint32 i = 0; i < (Uint32)awakeCount; i++) {
+		Uint32 root = findIsland(i);
+		if (islandRest[root] < (Uint32)sleepSteps)
+			continue;
+
+		Uint32 slot = denseSlots[i];
+		if (islandLast[root] == 0) islandFirst[root] = slot;
+		else slots[islandLast[root]].nextAsleep = slot;
+		islandLast[root] = slot;
+		sleepers.push_back(slot);
+	}
+
+	for (Uint32 i = 0; i < (Uint32)awakeCount; i++)
+		if (islandLast[i] != 0)
+			slots[islandLast[i]].nextAsleep = islandFirst[i];
+
+	for (Uint32 slot : wakers)
+		if (slots[slot].dense >= awakeCount)
+			wakeIsland(slot);
+
+	for (Uint32 slot : sleepers) {
+		Uint32 dense = slots[slot].dense;
+		velX[dense] = velY[dense] = 0.0f;
+		startX[dense] = posX[dense];
+		startY[dense] = posY[dense];
+
+		slots[slot].sleepIndex = (Uint32)sleepSlots.size();
+		sleepSlots.push_back(slot);
+		sleepBounds.push_back(bounds[dense]);
+		swapBodies(dense, (Uint32)--awakeCount);
+	}
+
+	if (!sleepers.empty()) {
+		gridStale = true;
+		sleepStale = true;
+		recentStale = true;
+	}
+}
+
+/* CONTACT EVENTS */
+
+void PhysicsEngine::findContactEvents() {
+	currentContacts.clear();
+	for (const Contact & contact : contacts) {
+		ContactEvent event = { contact.a, contact.b, CONTACT_STAY, 0, 0, contact.toi, contact.normal };
+		if (event.a.index > event.b.index) {
+			std::swap(event.a, event.b);
+			event.normal = Vector2f(-event.normal.x, -event.normal.y);
+		}
+		event.layerA = layers[slots[event.a.index].dense];
+		event.layerB = layers[slots[event.b.index].dense];
+		currentContacts.push_back(event);
+	}
+
+	auto pairKey = [](const ContactEvent & event) { return ((Uint64)event.a.index << 32) | event.b.index; };
+	std::sort(currentContacts.begin(), currentContacts.end(), [&](const ContactEvent & first, const ContactEvent & second) {
+		return pairKey(first) < pairKey(second);
+	});
+
+	// both lists are in pair order, so one merge finds what began, stayed and ended
+	contactEvents.clear();
+	size_t last = 0, current = 0;
+	while (last < lastContacts.size() || current < currentContacts.size()) {
+		if (current == currentContacts.size()
+			|| (last < lastContacts.size() && pairKey(lastContacts[last]) < pairKey(currentContacts[current]))) {
+			contactEvents.push_back(lastContacts[last++]);
+			contactEvents.back().type = CONTACT_END;
+		}
+		else if (last == lastContacts.size() || pairKey(currentContacts[current]) < pairKey(lastContacts[last])) {
+			contactEvents.push_back(currentContacts[current++]);
+			contactEvents.back().type = CONTACT_BEGIN;
+		}
+		else if (lastContacts[last].a == currentContacts[current].a && lastContacts[last].b == currentContacts[current].b) {
+			last++;
+			contactEvents.push_back(currentContacts[current++]);
+		}
+		else {
+			// the slots were reused by new bodies since the last step
+			contactEvents.push_back(lastContacts[last++]);
+			contactEvents.back().type = CONTACT_END;
+			contactEvents.push_back(currentContacts[current++]);
+			contactEvents.back().type = CONTACT_BEGIN;
+		}
+	}
+
+	lastContacts.swap(currentContacts);
+}
+
+void PhysicsEngine::deliverContactEvents() {
+	if (contactEvents.empty())
+		return;
+
+	// listeners may add or clear listeners, added ones hear from the next update() on
+	size_t count = listeners.size();
+	for (size_t l = 0; l < count && l < listeners.size(); l++) {
+		Uint32 layerMask = listeners[l].first;
+		ContactListener onContacts = listeners[l].second;
+		if (layerMask == ALL_LAYERS) {
+			onContacts(contactEvents.data(), contactEvents.size());
+			continue;
+		}
+
+		listenerEvents.clear();
+		for (const ContactEvent & event : contactEvents)
+			if ((event.layerA | event.layerB) & layerMask)
+				listenerEvents.push_back(event);
+
+		if (!listenerEvents.empty())
+			onContacts(listenerEvents.data(), listenerEvents.size());
+	}
+}
+
+void PhysicsEngine::addContactListener(Uint32 layerMask, const ContactListener & onContacts) {
+	listeners.push_back(std::make_pair(layerMask, onContacts));
+}
+
+void PhysicsEngine::clearContactListeners() {
+	listeners.clear();
+}
+
+/* TILES */
+
+bool PhysicsEngine::overlapsTiles(const BodyId & body) const {
+	Uint32 i = denseIndex(body);
+	Bounds box = { posX[i] - halfX[i], posY[i] - halfY[i], posX[i] + halfX[i], posY[i] + halfY[i] };
+	return tiles.overlaps(box);
+}
+
+bool PhysicsEngine::sweepTiles(const BodyId & body, float & toi, Vector2f & normal) const {
+	Uint32 i = denseIndex(body);
+	Bounds box = { startX[i] - halfX[i], startY[i] - halfY[i], startX[i] + halfX[i], startY[i] + halfY[i] };
+	return tiles.sweep(box, posX[i] - startX[i], posY[i] - startY[i], toi, normal);
+}
+
+/* BENCHMARK */
+
+std::vector<PhysicsBenchResult> PhysicsEngine::benchmark(const std::vector<int> & counts, int steps, int bruteForceLimit) {
+	std::vector<PhysicsBenchResult> results;
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	steps = std::max(1, steps);
+
+	auto timeSteps = [&](PhysicsEngine & engine) {
+		engine.update();	// warm up the buffers and the first sort
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int s = 0; s < steps; s++)
+			engine.update();
+		return (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency / steps;
+	};
+
+	for (int count : counts) {
+		for (int clustered = 0; clustered < 2; clustered++) {
+			PhysicsEngine grid, sweep;
+			sweep.setBroadphase(BROADPHASE_SWEEP);
+
+			// same seed and average density for every size, objects of 8 to 32 units on about 6% of the area
+			// drifting up to 5 units a second, so a step changes the order of few endpoints
+			Uint32 seed = 12345;
+			auto random = [&seed](int range) {
+				seed = seed * 1664525u + 1013904223u;
+				return (int)((seed >> 8) % (Uint32)range);
+			};
+
+			int side = std::max(1, (int)(sqrtf((float)count) * 80.0f));
+			std::vector<Vector2f> clusters;
+			for (int c = 0; c < std::max(1, count / 250); c++)
+				clusters.push_back(Vector2f((float)random(side), (float)random(side)));
+
+			for (int i = 0; i < count; i++) {
+				float x, y;
+				if (clustered) {
+					// about 250 objects within 320 units of each cluster center
+					const Vector2f & center = clusters[random((int)clusters.size())];
+					x = center.x + random(320) - random(320);
+					y = center.y + random(320) - random(320);
+				}
+				else {
+					x = (float)random(side);
+					y = (float)random(side);
+				}
+
+				float hx = (8 + random(25)) / 2.0f, hy = (8 + random(25)) / 2.0f;
+				Vector2f velocity((float)(random(11) - 5), (float)(random(11) - 5));
+				grid.setVelocity(grid.createBody(x, y, hx, hy), velocity);
+				sweep.setVelocity(sweep.createBody(x, y, hx, hy), velocity);
+			}
+
+			PhysicsBenchResult result = { count, clustered ? "clustered" : "uniform", timeSteps(grid), timeSteps(sweep), 0.0,
+				grid.candidates.size(), grid.contacts.size(), 0 };
+
+			if (sweep.contacts.size() != result.contacts)
+				result.mismatches++;
+
+			if (count <= bruteForceLimit) {
+				size_t bruteContacts = 0;
+				Uint64 start = SDL_GetPerformanceCounter();
+				for (size_t i = 0; i < grid.bounds.size(); i++)
+					for (size_t j = i + 1; j < grid.bounds.size(); j++)
+						if (grid.bounds[i].overlaps(grid.bounds[j])) bruteContacts++;
+				Uint64 end = SDL_GetPerformanceCounter();
+
+				result.bruteForceMs = (end - start) * 1000.0 / frequency;
+				if (bruteContacts != result.contacts)
+					result.mismatches++;
+			}
+
+			results.push_back(result);
+		}
+	}
+
+	return results;
+}
+
+std::vector<PhysicsScalingResult> PhysicsEngine::benchmarkThreads(int count, int steps, int maxThreads) {
+	std::vector<PhysicsScalingResult> results;
+	std::vector<Contact> reference;
+	std::vector<float> referenceX, referenceY;
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	steps = std::max(1, steps);
+
+	for (int threadCount = 1; threadCount <= std::max(1, maxThreads); threadCount++) {
+		PhysicsEngine engine;
+		engine.setThreadCount(threadCount);
+
+		// the same uniform scene every time, moving fast enough to keep the grid busy
+		Uint32 seed = 12345;
+		auto random = [&seed](int range) {
+			seed = seed * 1664525u + 1013904223u;
+			return (int)((seed >> 8) % (Uint32)range);
+		};
+
+		int side = std::max(1, (int)(sqrtf((float)count) * 80.0f));
+		for (int i = 0; i < count; i++) {
+			float x = (float)random(side), y = (float)random(side);
+			BodyId body = engine.createBody(x, y, (8 + random(25)) / 2.0f, (8 + random(25)) / 2.0f, i % 4 == 0 ? BODY_GRAVITY : 0);
+			engine.setVelocity(body, Vector2f((float)(random(61) - 30), (float)(random(61) - 30)));
+		}
+
+		engine.update();
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int s = 0; s < steps; s++)
+			engine.update();
+		Uint64 end = SDL_GetPerformanceCounter();
+
+		if (threadCount == 1) {
+			reference = engine.contacts;
+			referenceX = engine.posX;
+			referenceY = engine.posY;
+		}
+
+		bool identical = reference.size() == engine.contacts.size() && referenceX == engine.posX && referenceY == engine.posY;
+		for (size_t i = 0; identical && i < reference.size(); i++)
+			identical = reference[i].a == engine.contacts[i].a && reference[i].b == engine.contacts[i].b;
+
+		PhysicsScalingResult result = { threadCount, (end - start) * 1000.0 / frequency / steps, identical };
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+PhysicsQueryBenchResult PhysicsEngine::benchmarkQueries(int count, int queries) {
+	PhysicsQueryBenchResult result = { count, std::max(1, queries), 0.0, 0.0, 0.0, 0.0, 0 };
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	const int checked = std::min(result.queries, 100);
+
+	PhysicsEngine engine;
+	Uint32 seed = 12345;
+	auto random = [&seed](int range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (int)((seed >> 8) % (Uint32)range);
+	};
+
+	int side = std::max(1, (int)(sqrtf((float)count) * 80.0f));
+	for (int i = 0; i < count; i++)
+		engine.createBody((float)random(side), (float)random(side), (8 + random(25)) / 2.0f, (8 + random(25)) / 2.0f);
+	engine.update();
+
+	// rays of up to 500 units, regions of up to 200 units and the 8 nearest bodies around random points
+	std::vector<Vector2f> points, directions;
+	std::vector<Box2f> regions;
+	for (int q = 0; q < result.queries; q++) {
+		Vector2f point((float)random(side), (float)random(side));
+		Vector2f direction((float)(random(201) - 100), (float)(random(201) - 100));
+		float length = sqrtf(direction.x * direction.x + direction.y * direction.y);
+		if (length == 0.0f) direction = Vector2f(1.0f, 0.0f);
+		else direction = Vector2f(direction.x / length, direction.y / length);
+		float w = (float)(1 + random(200)), h = (float)(1 + random(200));
+		Box2f region = { point.x, point.y, point.x + w, point.y + h };
+		points.push_back(point);
+		directions.push_back(direction);
+		regions.push_back(region);
+	}
+
+	const size_t maxHits = 64, maxResults = 1024, nearest = 8;
+	std::vector<RaycastHit> hits(maxHits);
+	std::vector<BodyId> found(maxResults);
+	std::vector<NearestHit> nearby(nearest);
+	auto timeQueries = [&](const std::function<void(int)> & query) {
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int q = 0; q < result.queries; q++)
+			query(q);
+		return (SDL_GetPerformanceCounter() - start) * 1000000.0 / frequency / result.queries;
+	};
+
+	result.raycastUs = timeQueries([&](int q) { engine.raycast(points[q], directions[q], 500.0f, hits[0]); });
+	result.raycastAllUs = timeQueries([&](int q) { engine.raycastAll(points[q], directions[q], 500.0f, &hits[0], maxHits); });
+	result.regionUs = timeQueries([&](int q) { engine.queryRegion(regions[q], &found[0], maxResults); });
+	result.nearestUs = timeQueries([&](int q) { engine.queryNearest(points[q], &nearby[0], nearest); });
+
+	for (int q = 0; q < checked; q++) {
+		size_t rayHits = 0, overlapping = 0;
+		float firstHit = INFINITY;
+		std::vector<float> distances;
+		for (Uint32 i = 0; i < (Uint32)engine.posX.size(); i++) {
+			Bounds box = engine.bodyBox(i);
+			float t;
+			Vector2f normal;
+			if (box.raycast(points[q], directions[q], 500.0f, t, normal)) {
+				rayHits++;
+				firstHit = std::min(firstHit, t);
+			}
+			if (box.overlaps(regions[q]))
+				overlapping++;
+			distances.push_back(box.distanceTo(points[q]));
+		}
+		std::sort(distances.begin(), distances.end());
+
+		// queries normalize the direction again, which may move the hit by a rounding error
+		RaycastHit hit;
+		bool mismatch = engine.raycast(points[q], directions[q], 500.0f, hit) != (rayHits > 0) || (rayHits > 0 && fabsf(hit.distance - firstHit) > 0.001f);
+		mismatch |= engine.raycastAll(points[q], directions[q], 500.0f, &hits[0], maxHits) != std::min(rayHits, maxHits);
+		mismatch |= engine.queryRegion(regions[q], &found[0], maxResults) != overlapping;
+
+		size_t nearCount = engine.queryNearest(points[q], &nearby[0], nearest);
+		mismatch |= nearCount != std::min(nearest, distances.size());
+		for (size_t n = 0; !mismatch && n < nearCount; n++)
+			mismatch = fabsf(nearby[n].distance - distances[n]) > 0.001f;
+
+		if (mismatch)
+			result.mismatches++;
+	}
+
+	return result;
+}
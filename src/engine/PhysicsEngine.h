@@ -3,21 +3,334 @@
 
 #include <vector>
 #include <memory>
+#include <functional>
+#include <unordered_set>
 
 #include "GameMath.h"
+#include "ThreadPool.h"
+#include "TileLayer.h"
 
 static const float DEFAULT_GRAVITY = -1.0f;
+static const float DEFAULT_PHYSICS_STEP = 0.016f;	// seconds, the main loop runs at ~60 FPS
+static const float DEFAULT_PHYSICS_CELL_SIZE = 64.0f;
+
+// objects covering more cells than this are tested against everything instead
+static const int MAX_CELLS_PER_OBJECT = 64;
+
+// bodies slower than this, in units per second, for this many steps in a row fall asleep
+static const float DEFAULT_SLEEP_VELOCITY = 2.0f;
+static const int DEFAULT_SLEEP_STEPS = 60;
+static const Uint32 NOT_ASLEEP = 0xFFFFFFFF;
+
+// bodies are in layer 1 and collide with every layer unless told otherwise
+static const Uint32 DEFAULT_COLLISION_LAYER = 1;
+static const Uint32 ALL_LAYERS = 0xFFFFFFFF;
 
 class PhysicsObject;
 
+/**
+* Stable id of a body in the PhysicsEngine body store, issued by createBody()
+*
+* Stays valid while the body moves around in the store, the generation
+* tells a destroyed body apart from a new one in the same slot
+*/
+struct BodyId {
+	Uint32 index;
+	Uint32 generation;
+
+	BodyId() : index(0), generation(0) {}
+	BodyId(Uint32 index, Uint32 generation) : index(index), generation(generation) {}
+
+	bool isValid() const { return index != 0; }
+	bool operator==(const BodyId & other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const BodyId & other) const { return !(*this == other); }
+};
+
+enum BodyFlag {
+	BODY_GRAVITY = 1 << 0,	// gravity is applied every step
+	BODY_STATIC = 1 << 1,	// never integrated, still collides
+	BODY_FAST = 1 << 2		// swept over each step so it cannot pass through thin bodies
+};
+
+enum Broadphase {
+	BROADPHASE_GRID,	// rebuilt every step, best when bodies move a lot
+	BROADPHASE_SWEEP	// sweep and prune kept sorted between steps, best when most bodies barely move
+};
+
+/**
+* Two bodies whose boxes overlapped in the last update()
+* Valid until the next update()
+*/
+struct Contact {
+	BodyId a;
+	BodyId b;
+	float toi;			// fraction of the step when they first touched, 1 unless one is BODY_FAST
+	Vector2f normal;	// from b towards a, along the face that was hit or the axis of least overlap
+};
+
+/**
+* Two boxes that started or stopped overlapping in the last update()
+* Only reported by the sweep and prune broadphase, overlaps of a destroyed
+* body end in the next update() and carry its old id
+*/
+struct OverlapEvent {
+	BodyId a;
+	BodyId b;
+	bool begin;
+};
+
+enum ContactEventType {
+	CONTACT_BEGIN,	// not in contact in the update() before
+	CONTACT_STAY,
+	CONTACT_END		// in contact in the update() before, a destroyed body keeps its old id
+};
+
+/**
+* Change of a contact between two updates, a is always the body in the lower slot
+* so a pair is reported the same way every step
+*/
+struct ContactEvent {
+	BodyId a;
+	BodyId b;
+	ContactEventType type;
+	Uint32 layerA, layerB;
+	float toi;
+	Vector2f normal;	// from b towards a, of the last step they touched in for CONTACT_END
+};
+
+/**
+* Receives every contact event of one update() in a single call
+*/
+typedef std::function<void(const ContactEvent * events, size_t count)> ContactListener;
+
+struct RaycastHit {
+	BodyId body;
+	float distance;		// from the origin along the ray
+	Vector2f point;
+	Vector2f normal;	// of the face entered, 0 if the ray starts inside
+};
+
+struct NearestHit {
+	BodyId body;
+	float distance;		// to the nearest point of the box, 0 inside
+};
+
+struct PhysicsStats {
+	size_t objects, cells, oversized;
+	size_t awake, sleeping;
+	size_t swaps;	// sweep and prune endpoint swaps
+	size_t swept;	// candidates with a BODY_FAST body, tested by sweeping
+	size_t candidates, contacts;
+	int threads;
+	double integrateMs, broadphaseMs, narrowphaseMs;
+};
+
+struct PhysicsScalingResult {
+	int threads;
+	double updateMs;
+	bool identical;		// same positions and contacts in the same order as with one thread
+};
+
+struct PhysicsQueryBenchResult {
+	int objects;
+	int queries;
+	double raycastUs, raycastAllUs, regionUs, nearestUs;	// per query
+	int mismatches;		// queries answered differently from testing every body
+};
+
+struct PhysicsBenchResult {
+	int objects;
+	const char * distribution;
+	double gridMs, sweepMs;	// per update()
+	double bruteForceMs;	// per all-pairs pass, 0 when skipped
+	size_t candidates, contacts;
+	int mismatches;		// sweep and prune or all pairs found a different number of contacts than the grid
+};
+
 class PhysicsEngine {
 	friend class XCube2Engine;
 	friend class PhysicsObject;
 	private:
-		Vector2f gravity;
+		Vector2f gravity;	// velocity change per step
+		float step;
 		PhysicsEngine();
 
-		std::vector<std::shared_ptr<PhysicsObject>> objects;
+		/* body store, one array per field in dense order so integration streams through memory */
+		std::vector<float> posX, posY, velX, velY, halfX, halfY;
+		std::vector<float> startX, startY;	// positions before the last step
+		std::vector<float> forceX, forceY;	// cleared after every step
+		std::vector<Uint32> flags;
+		std::vector<Uint32> restSteps;		// steps in a row slower than sleepVelocity
+		std::vector<Uint32> layers, masks;	// a pair collides if each is in a layer of the other's mask
+		std::vector<Uint32> denseSlots;		// dense index -> slot
+
+		struct BodySlot {
+			Uint32 dense;
+			Uint32 generation;
+			bool used;
+			Uint32 nextAsleep;	// next slot of the same sleeping island, 0 while awake
+			Uint32 sleepIndex;	// entry in sleepSlots while asleep, NOT_ASLEEP while awake
+			void * userData;
+			std::shared_ptr<PhysicsObject> object;	// registered facade, if any
+		};
+
+		std::vector<BodySlot> slots;		// slot 0 is never used, so BodyId() is invalid
+		std::vector<Uint32> freeSlots;
+
+		Uint32 denseIndex(const BodyId & body) const;
+		BodyId bodyAt(Uint32 dense) const { return BodyId(denseSlots[dense], slots[denseSlots[dense]].generation); }
+		void swapBodies(Uint32 a, Uint32 b);
+		bool collides(Uint32 a, Uint32 b) const { return (layers[a] & masks[b]) != 0 && (layers[b] & masks[a]) != 0; }
+
+		void integrate();
+		void integrateRange(size_t begin, size_t end);
+
+		/* steps are split into chunks run on the pool, each chunk writes its own buffer */
+		int threads;
+		std::unique_ptr<ThreadPool> pool;
+		std::vector<std::vector<std::pair<Uint32, Uint32>>> chunkCandidates;
+		std::vector<std::vector<Contact>> chunkContacts;
+
+		void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> & job);
+
+		/* broadphase, a hashed uniform grid rebuilt every step so the world needs no bounds */
+		typedef Box2f Bounds;
+
+		struct GridEntry {
+			int cellX, cellY;
+			Uint32 object;	// index into the boxes the grid was built from
+			Uint32 bucket;
+		};
+
+		struct SpatialGrid {
+			std::vector<GridEntry> entries, sortedEntries;
+			std::vector<Uint32> bucketStarts, bucketCursor;
+			std::vector<Uint32> oversized;
+			Uint32 bucketMask;
+			int minX, minY, maxX, maxY;		// cells holding any entry
+
+			SpatialGrid() : bucketMask(0), minX(0), minY(0), maxX(-1), maxY(-1) {}
+		};
+
+		float cellSize;
+		std::vector<Bounds> bounds;		// sleeping bodies keep theirs from their last step
+		SpatialGrid awakeGrid;			// of the awake bodies by dense index
+		bool gridStale;		// bodies changed since the grid was built
+
+		std::vector<std::pair<Uint32, Uint32>> candidates;
+		std::vector<Contact> contacts;
+		PhysicsStats stats;
+
+		TileLayer tiles;
+
+		int cellOf(float coordinate) const;
+
+		/**
+		* @return number of occupied buckets
+		*/
+		size_t buildGrid(SpatialGrid & grid, const std::vector<Bounds> & boxes, size_t begin, size_t end);
+		void findCandidates();
+		void findCellPairs(const SpatialGrid & grid, const std::vector<Bounds> & boxes, size_t beginBucket, size_t endBucket,
+			std::vector<std::pair<Uint32, Uint32>> & pairs) const;
+		void narrowphase();
+
+		static Uint32 hashCell(int x, int y);
+
+		/* spatial queries, served by the grids of the last update() */
+		void ensureGrid();
+		Bounds bodyBox(Uint32 dense) const;
+		Uint32 gridBody(const SpatialGrid & grid, Uint32 object) const;
+		const Bounds & gridBounds(const SpatialGrid & grid, Uint32 object) const;
+		bool isSleepEntry(Uint32 object) const { return slots[sleepSlots[object]].sleepIndex == object; }
+
+		template <typename F>
+		void forEachOversized(const SpatialGrid & grid, F visit) const;
+
+		/**
+		* Entries of the sleeping grids whose body woke since are skipped
+		*/
+		template <typename F>
+		void forEachInCell(const SpatialGrid & grid, int cellX, int cellY, F visit) const;
+
+		/**
+		* Visits the cells of the grid along a ray in order with the distances the ray enters and leaves them,
+		* until visit returns false
+		*/
+		template <typename F>
+		void traceRay(const SpatialGrid & grid, const Vector2f & origin, const Vector2f & direction, float maxDistance, F visit) const;
+		bool sweep(Uint32 a, Uint32 b, float & toi, Vector2f & normal) const;
+
+		/* sweep and prune on both axes, endpoints refer to body slots so they survive removals */
+		struct Endpoint {
+			float value;
+			Uint32 slot;
+			bool min;
+		};
+
+		Broadphase broadphase;
+		std::vector<Endpoint> endpointsX, endpointsY;
+		std::unordered_set<Uint64> sweepPairs;		// slot pairs whose boxes overlap
+		std::vector<OverlapEvent> overlapEvents, removedEvents;
+		size_t sweepInserted;	// bodies appended since the last full sort
+		bool sweepDirty;
+
+		void computeBounds();
+		void sweepAndPrune();
+		void rebuildSweep();
+		void sortAxis(std::vector<Endpoint> & axis, bool xAxis);
+		void insertSweepBody(Uint32 slot);
+		void removeSweepBody(const BodyId & body);
+		void addSweepPair(Uint32 slotA, Uint32 slotB);
+		void removeSweepPair(Uint32 slotA, Uint32 slotB);
+
+		static bool before(const Endpoint & a, const Endpoint & b);
+		static Uint64 pairKey(Uint32 slotA, Uint32 slotB);
+
+		/**
+		* Sleeping, awake bodies come first in dense order so a step only walks them
+		* Bodies touching each other form an island, which falls asleep and wakes as a whole
+		*/
+		size_t awakeCount;
+		float sleepVelocity;
+		int sleepSteps;		// 0 keeps every body awake
+
+		/**
+		* Bodies that fell asleep, in sleepGrid up to snapshotSize and in the small recentGrid after,
+		* which is all that is rebuilt as bodies fall asleep until enough entries are stale to rebuild both
+		* Entries of woken bodies stay behind and are skipped
+		*/
+		std::vector<Uint32> sleepSlots;
+		std::vector<Bounds> sleepBounds;
+		size_t snapshotSize;
+		size_t staleEntries;
+		SpatialGrid sleepGrid, recentGrid;
+		std::vector<std::pair<Uint32, Uint32>> sleepPairs, recentPairs;	// overlapping entries
+		std::vector<Contact> sleepContacts;	// between sleeping bodies, they cannot change while asleep
+		bool sleepStale;		// bodies fell asleep or woke since sleepContacts were found
+		bool recentStale;
+		std::vector<Uint32> islandParent, islandRest, islandFirst, islandLast;
+		std::vector<Uint32> sleepers, wakers, touching;
+
+		void ensureSleepGrid();
+		void findSleepPairs(const SpatialGrid & grid, size_t begin, size_t end, std::vector<std::pair<Uint32, Uint32>> & pairs);
+		void updateIslands();
+		Uint32 findIsland(Uint32 dense);
+		void wakeIsland(Uint32 slot);
+
+		/**
+		* Wakes the body if it sleeps and restarts its rest count
+		* @return its dense index, which waking may change
+		*/
+		Uint32 wakeBody(Uint32 dense);
+
+		/* contact events, found by comparing the contacts of each step with the step before, in pair order */
+		std::vector<ContactEvent> contactEvents;
+		std::vector<ContactEvent> lastContacts, currentContacts;	// as CONTACT_STAY events, sorted by slot pair
+		std::vector<std::pair<Uint32, ContactListener>> listeners;
+		std::vector<ContactEvent> listenerEvents;
+
+		void findContactEvents();
+		void deliverContactEvents();
 
 	public:
 		/**
@@ -25,28 +338,214 @@ class PhysicsEngine {
 		* update interval in seconds
 		*/
 		void setGravity(float gravityValue, float worldUpdateInterval);
+
+		/**
+		* Integrates the awake bodies by one step and finds every pair that collides, see getContacts()
+		* Islands of bodies that rested for the sleep steps fall asleep at the end
+		*/
 		void update();
 
+		/**
+		* Creates a body for the object and binds the object to it
+		*/
 		void registerObject(std::shared_ptr<PhysicsObject>);
+		void unregisterObject(std::shared_ptr<PhysicsObject>);
+
+		/**
+		* Bodies are boxes given by center and half lengths
+		* @param flags - BodyFlag values, gravity is only applied with BODY_GRAVITY
+		*/
+		BodyId createBody(float x, float y, float halfLengthX, float halfLengthY, Uint32 flags = 0);
+		void destroyBody(const BodyId & body);
+		bool isBody(const BodyId & body) const;
+		size_t getBodyCount() { return posX.size(); }
+
+		Vector2f getPosition(const BodyId & body) const;
+		void setPosition(const BodyId & body, const Vector2f & position);
+		Vector2f getVelocity(const BodyId & body) const;
+		void setVelocity(const BodyId & body, const Vector2f & velocity);
+		Vector2f getHalfLengths(const BodyId & body) const;
+		void setHalfLengths(const BodyId & body, const Vector2f & halfLengths);
+		Uint32 getFlags(const BodyId & body) const;
+		void setFlags(const BodyId & body, Uint32 flags);
+
+		/**
+		* Adds an acceleration for the next step only
+		*/
+		void applyForce(const BodyId & body, const Vector2f & force);
+
+		/**
+		* Changing a body in any way above wakes it with its island,
+		* as do awake bodies touching it, BODY_STATIC bodies only wake when changed
+		*/
+		bool isAwake(const BodyId & body) const;
+		void wake(const BodyId & body);
+
+		/**
+		* @param velocity - in units per second
+		* @param steps - 0 keeps every body awake
+		*/
+		void setSleep(float velocity, int steps);
+		float getSleepVelocity() { return sleepVelocity; }
+		int getSleepSteps() { return sleepSteps; }
+		size_t getAwakeCount() { return awakeCount; }
+
+		/**
+		* @return the registered object of the body or nullptr
+		*/
+		PhysicsObject * getObject(const BodyId & body) const;
+
+		/**
+		* Any pointer the game wants to find the body's owner by, e.g. from a ContactEvent
+		* @return nullptr if none was set or the body is gone
+		*/
+		void * getUserData(const BodyId & body) const;
+		void setUserData(const BodyId & body, void * data);
+
+		/**
+		* Two bodies only collide if each is in a layer of the other's mask,
+		* pairs that do not collide are not tested and never make contacts
+		* @param layer - bits of the layers the body is in, usually one
+		*/
+		void setCollisionFilter(const BodyId & body, Uint32 layer, Uint32 mask);
+		Uint32 getCollisionLayer(const BodyId & body) const;
+		Uint32 getCollisionMask(const BodyId & body) const;
+
+		/**
+		* Queries see the bodies as they were after the last update(), created, destroyed or moved bodies
+		* are included by rebuilding the grid on the next query
+		* Results go to caller buffers, so no query allocates
+		*/
+
+		/**
+		* @param direction - does not need to be normalized
+		* @return true if a body lies on the ray, with the nearest in hit
+		*/
+		bool raycast(const Vector2f & origin, const Vector2f & direction, float maxDistance, RaycastHit & hit);
+
+		/**
+		* Finds every body on the ray, nearest first
+		* @return number of hits written, the nearest maxHits when there are more
+		*/
+		size_t raycastAll(const Vector2f & origin, const Vector2f & direction, float maxDistance, RaycastHit * hits, size_t maxHits);
+
+		/**
+		* @return number of bodies overlapping the region, of which the first maxResults are written
+		*/
+		size_t queryRegion(const Box2f & region, BodyId * results, size_t maxResults);
+
+		/**
+		* Finds the k bodies nearest to the point, nearest first
+		* @return number of bodies written, less than k only if there are fewer bodies
+		*/
+		size_t queryNearest(const Vector2f & point, NearestHit * results, size_t k);
+
+		/**
+		* Solid tiles of the level, bodies are only tested against them on request
+		*/
+		TileLayer & getTiles() { return tiles; }
+
+		/**
+		* @return true if the body overlaps a solid tile
+		*/
+		bool overlapsTiles(const BodyId & body) const;
+
+		/**
+		* Sweeps the body over its move in the last step against the solid tiles
+		* @return true on a hit, toi is the fraction of the step and normal the face of the tile hit
+		*/
+		bool sweepTiles(const BodyId & body, float & toi, Vector2f & normal) const;
+
+		/**
+		* Grid cells should be around the size of a typical object
+		*/
+		void setCellSize(float size);
+		float getCellSize() { return cellSize; }
+
+		/**
+		* Integration, grid pairs and the narrowphase are split over this many threads
+		* @param count - 0 for one thread per CPU core
+		*/
+		void setThreadCount(int count);
+		int getThreadCount() { return threads; }
+
+		/**
+		* Switching to sweep and prune sorts all bodies once on the next update()
+		*/
+		void setBroadphase(Broadphase type);
+		Broadphase getBroadphase() { return broadphase; }
+
+		const std::vector<Contact> & getContacts() { return contacts; }
+		const std::vector<OverlapEvent> & getOverlapEvents() { return overlapEvents; }
+
+		/**
+		* Contacts that began, stayed or ended in the last update(), in one buffer
+		* Valid until the next update()
+		*/
+		const std::vector<ContactEvent> & getContactEvents() { return contactEvents; }
+
+		/**
+		* Calls onContacts once at the end of every update() that has events involving a body in any of the layers
+		* of layerMask, with all of them in one buffer. Bodies may be created and destroyed from it,
+		* contacts of destroyed bodies end in the next update()
+		*/
+		void addContactListener(Uint32 layerMask, const ContactListener & onContacts);
+		void clearContactListeners();
+
+		/**
+		* @return seconds each update() advances, velocities are in units per second
+		*/
+		float getStep() { return step; }
+		PhysicsStats getStats() { return stats; }
+
+		/**
+		* @return instruction set used to integrate bodies, "AVX2", "SSE2" or "scalar"
+		*/
+		static const char * getIntegrationPath();
+
+		/**
+		* Times update() with both broadphases over slowly moving scenes of each size,
+		* spread uniformly and in clusters at the same average density,
+		* and an all-pairs pass for comparison up to bruteForceLimit objects
+		*/
+		static std::vector<PhysicsBenchResult> benchmark(const std::vector<int> & counts, int steps, int bruteForceLimit);
+
+		/**
+		* Times update() on the same scene with 1 to maxThreads threads
+		*/
+		static std::vector<PhysicsScalingResult> benchmarkThreads(int count, int steps, int maxThreads);
+
+		/**
+		* Times each spatial query on a uniform scene of count bodies,
+		* the first queries are checked against testing every body
+		*/
+		static PhysicsQueryBenchResult benchmarkQueries(int count, int queries);
 };
 
+/**
+* Thin handle over a body in the PhysicsEngine store
+* Keeps its own center and size only until it is registered
+*/
 class PhysicsObject {
 	friend class PhysicsEngine;
-	protected:
-		Point2 center;
-		float lX, lY, hlX, hlY;	// lengths and half lengths
-
-		Vector2f force;
+	private:
+		PhysicsEngine * engine;	// null until registered
+		BodyId body;
+		Vector2f center, halfLengths;
 
+	protected:
 		void applyForce(const Vector2f &);
 	public:
 		PhysicsObject(const Point2 & center, float x, float y);
 
-		Point2 getCenter() { return center; }
-		float getLengthX() { return lX; }
-		float getLengthY() { return lY; }
-		float getHalfLengthX() { return hlX; }
-		float getHalfLengthY() { return hlY; }
+		BodyId getBody() { return body; }
+
+		Vector2f getPosition() const;
+		Point2 getCenter() const;
+		float getLengthX() const { return getHalfLengthX() * 2.0f; }
+		float getLengthY() const { return getHalfLengthY() * 2.0f; }
+		float getHalfLengthX() const;
+		float getHalfLengthY() const;
 
 		bool isColliding(const PhysicsObject & other);
 		/**
@@ -57,4 +556,4 @@ class PhysicsObject {
 		virtual void applyAntiGravity(const PhysicsEngine & engine);
 };
 
-#endif
\ No newline at end of file
+#endif
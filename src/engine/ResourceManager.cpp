@@ -1,112 +1,1064 @@
 #include "ResourceManager.h"
+#include "SkylinePacker.h"
 
-std::map<std::string, SDL_Texture *> ResourceManager::textures;
-std::map<std::string, TTF_Font *> ResourceManager::fonts;
-std::map<std::string, Mix_Chunk *> ResourceManager::sounds;
-std::map<std::string, Mix_Music *> ResourceManager::mp3files;
+#include <algorithm>
+#include <sys/stat.h>
 
-SDL_Texture * ResourceManager::loadTexture(std::string file, SDL_Color trans) {
-	SDL_Texture * texture = nullptr;
+ResourcePool<TextureResource> ResourceManager::textures;
+ResourcePool<FontResource> ResourceManager::fonts;
+ResourcePool<Mix_Chunk *> ResourceManager::sounds;
+ResourcePool<Mix_Music *> ResourceManager::mp3files;
+std::vector<SDL_Texture *> ResourceManager::atlasPages;
+
+static const size_t MB = 1024 * 1024;
+size_t ResourceManager::budgets[RESOURCE_CLASS_COUNT] = {
+	DEFAULT_TEXTURE_BUDGET_MB * MB,
+	DEFAULT_FONT_BUDGET_MB * MB,
+	DEFAULT_SOUND_BUDGET_MB * MB,
+	DEFAULT_MUSIC_BUDGET_MB * MB
+};
+
+std::vector<std::unique_ptr<PackFile>> ResourceManager::packs;
+#ifdef __DEBUG
+bool ResourceManager::looseFileOverride = true;
+#else
+bool ResourceManager::looseFileOverride = false;
+#endif
+
+std::unique_ptr<ThreadPool> ResourceManager::loaderPool;
+std::mutex ResourceManager::loadMutex;
+std::condition_variable ResourceManager::loadCompleted;
+std::deque<ResourceManager::PendingLoad> ResourceManager::completedLoads;
+std::map<std::string, LoadGroupStats> ResourceManager::loadGroups;
+Uint32 ResourceManager::uploadBudgetMs = DEFAULT_UPLOAD_BUDGET_MS;
+ResourceManager::InFlightLoads ResourceManager::texturesInFlight;
+ResourceManager::InFlightLoads ResourceManager::soundsInFlight;
+LoadDedupStats ResourceManager::dedupStats = {};
+TextureDiskCache ResourceManager::diskCache;
+
+std::unique_ptr<FileWatcher> ResourceManager::watcher;
+Uint32 ResourceManager::hotReloadDebounceMs = DEFAULT_HOT_RELOAD_DEBOUNCE_MS;
+std::map<std::string, FileChangedCallback> ResourceManager::watchCallbacks;
+std::vector<TTF_Font *> ResourceManager::retiredFonts;
+
+static double elapsedMs(Uint64 start) {
+	return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// grey colours, black included, mean the image has no colour key
+static bool usesColorKey(const SDL_Color & trans) {
+	return !(trans.r == trans.g && trans.r == trans.b);
+}
+
+// only the colour matters, alpha is not part of the key
+static bool sameColorKey(const SDL_Color & a, const SDL_Color & b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static size_t textureBytes(SDL_Texture * texture) {
+	int w = 0, h = 0;
+	SDL_QueryTexture(texture, 0, 0, &w, &h);
+	return (size_t)w * h * 4;
+}
+
+/* ASSET PACKS */
+
+void ResourceManager::mountPack(const std::string & fileName) {
+	packs.push_back(std::unique_ptr<PackFile>(new PackFile(fileName)));
+
+#ifdef __DEBUG
+	debug("Mounted pack:", fileName.c_str());
+	debug("Pack entries:", (int)packs.back()->getEntryCount());
+#endif
+}
+
+SDL_RWops * ResourceManager::openAsset(const std::string & file) {
+	SDL_RWops * rw = nullptr;
+	if (looseFileOverride && (rw = SDL_RWFromFile(file.c_str(), "rb")) != nullptr)
+		return rw;
+
+	// packs mounted later take precedence
+	for (size_t i = packs.size(); i > 0; i--) {
+		if ((rw = packs[i - 1]->open(file)) != nullptr)
+			return rw;
+	}
+
+	if (!looseFileOverride)
+		rw = SDL_RWFromFile(file.c_str(), "rb");
+	return rw;
+}
+
+bool ResourceManager::statAsset(const std::string & file, Uint64 & time, Uint64 & size) {
+	// same precedence as openAsset(), packed entries are stamped with their pack
+	struct stat st;
+	if (looseFileOverride && stat(file.c_str(), &st) == 0) {
+		time = (Uint64)st.st_mtime;
+		size = (Uint64)st.st_size;
+		return true;
+	}
+
+	for (size_t i = packs.size(); i > 0; i--) {
+		const PackEntry * entry = packs[i - 1]->find(file);
+		if (entry && stat(packs[i - 1]->getFileName().c_str(), &st) == 0) {
+			time = (Uint64)st.st_mtime;
+			size = entry->size;
+			return true;
+		}
+	}
+
+	if (!looseFileOverride && stat(file.c_str(), &st) == 0) {
+		time = (Uint64)st.st_mtime;
+		size = (Uint64)st.st_size;
+		return true;
+	}
+	return false;
+}
+
+SDL_Surface * ResourceManager::loadSurface(const std::string & file, SDL_Color trans) {
+	SDL_RWops * rw = openAsset(file);
+	if (nullptr == rw)
+		throw EngineException("Asset not found", file);
 
-	SDL_Surface * surf = IMG_Load(file.c_str());
+	SDL_Surface * surf = IMG_Load_RW(rw, 1);
 	if (nullptr == surf)
 		throw EngineException(IMG_GetError(), file);
 
-	bool key = (trans.r == trans.g) && (trans.r == trans.b);
-	SDL_SetColorKey(surf, key ? SDL_FALSE : SDL_TRUE, SDL_MapRGB(surf->format, trans.r, trans.g, trans.b));
-	
-	texture = GFX::createTextureFromSurface(surf);
-	if (nullptr == texture)
+	SDL_SetColorKey(surf, usesColorKey(trans) ? SDL_TRUE : SDL_FALSE, SDL_MapRGB(surf->format, trans.r, trans.g, trans.b));
+	return surf;
+}
+
+// safe to call from loader threads
+SDL_Surface * ResourceManager::decodeTexture(const std::string & file, SDL_Color trans, bool refresh) {
+	if (!diskCache.isEnabled())
+		return loadSurface(file, trans);
+
+	TextureCacheKey key = { file, 0, 0, 0xFFFFFFFF };
+	if (usesColorKey(trans))
+		key.colorKey = ((Uint32)trans.r << 16) | ((Uint32)trans.g << 8) | trans.b;
+
+	// a refresh overwrites the entry, the mtime may not have ticked over since it was written
+	bool cacheable = statAsset(file, key.sourceTime, key.sourceSize);
+	if (cacheable && !refresh) {
+		SDL_Surface * cached = diskCache.read(key);
+		if (cached)
+			return cached;
+	}
+
+	// colour key becomes alpha, the cached pixels need no key of their own
+	SDL_Surface * loaded = loadSurface(file, trans);
+	SDL_Surface * surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(loaded);
+	if (nullptr == surf)
 		throw EngineException(SDL_GetError(), file);
 
+	if (cacheable)
+		diskCache.write(key, surf);
+	return surf;
+}
+
+SDL_Texture * ResourceManager::uploadSurface(SDL_Surface * surf) {
+	if (surf->format->format == SDL_PIXELFORMAT_ARGB8888 && !SDL_HasColorKey(surf))
+		return GFX::createTexture(surf->w, surf->h, surf->pixels, surf->pitch);
+	return GFX::createTextureFromSurface(surf);
+}
+
+SDL_Texture * ResourceManager::createStandalone(const std::string & file, SDL_Color trans) {
+	SDL_Surface * surf = decodeTexture(file, trans);
+
+	SDL_Texture * texture = uploadSurface(surf);
 	SDL_FreeSurface(surf);
+	if (nullptr == texture)
+		throw EngineException(SDL_GetError(), file);
 
-	textures[file] = texture;
 	return texture;
 }
 
-TTF_Font * ResourceManager::loadFont(std::string file, const int & pt) {
-	TTF_Font * font = TTF_OpenFont(file.c_str(), pt);
+void ResourceManager::enableTextureCache(const std::string & directory, size_t capacity) {
+	diskCache.open(directory, capacity);
+
+#ifdef __DEBUG
+	debug("Texture cache:", directory.c_str());
+	debug("Texture cache entries:", (int)diskCache.getStats().entries);
+#endif
+}
+
+TTF_Font * ResourceManager::openFont(const std::string & file, int pt, size_t & bytes) {
+	SDL_RWops * rw = openAsset(file);
+	if (nullptr == rw)
+		throw EngineException("Asset not found", file);
+
+	// the font keeps reading from rw, it is closed along with the font
+	bytes = (size_t)std::max((Sint64)0, SDL_RWsize(rw));
+	TTF_Font * font = TTF_OpenFontRW(rw, 1, pt);
 	if (nullptr == font)
 		throw EngineException(TTF_GetError(), file);
-	fonts[file] = font;
 	return font;
 }
 
-Mix_Chunk * ResourceManager::loadSound(std::string file) {
-	Mix_Chunk * sound = Mix_LoadWAV(file.c_str());
+Mix_Chunk * ResourceManager::openSound(const std::string & file) {
+	SDL_RWops * rw = openAsset(file);
+	if (nullptr == rw)
+		throw EngineException("Asset not found", file);
+
+	// long clips are streamed while playing, everything else is decoded now
+	Sint64 size = SDL_RWsize(rw);
+	if (size >= 0 && (size_t)size >= AudioEngine::getStreamThreshold()) {
+		Mix_Chunk * streamed = AudioEngine::createStreamedSound(file, rw);
+		if (streamed) {
+			SDL_RWclose(rw);
+			return streamed;
+		}
+		SDL_RWseek(rw, 0, RW_SEEK_SET);
+	}
+
+	Mix_Chunk * sound = Mix_LoadWAV_RW(rw, 1);
 	if (nullptr == sound)
 		throw EngineException(Mix_GetError(), file);
-	sounds[file] = sound;
 	return sound;
 }
 
-Mix_Music * ResourceManager::loadMP3(std::string file) {
-	Mix_Music * mp3 = Mix_LoadMUS(file.c_str());
+Mix_Music * ResourceManager::openMusic(const std::string & file, size_t & bytes) {
+	SDL_RWops * rw = openAsset(file);
+	if (nullptr == rw)
+		throw EngineException("Asset not found", file);
+
+	bytes = (size_t)std::max((Sint64)0, SDL_RWsize(rw));
+	Mix_Music * mp3 = Mix_LoadMUS_RW(rw, 1);
 	if (nullptr == mp3)
 		throw EngineException(Mix_GetError(), file);
-	mp3files[file] = mp3;
 	return mp3;
 }
 
+void ResourceManager::checkParameters(const std::string & file, bool conflict) {
+	if (!conflict)
+		return;
+
+	dedupStats.conflicts++;
+	std::cout << "Warning: " << file << " is already loaded with different parameters, keeping the first ones" << std::endl;
+}
+
+SDL_Texture * ResourceManager::loadTexture(std::string file, SDL_Color trans) {
+	waitForLoad(texturesInFlight, file);
+
+	TextureHandle handle = textures.find(file);
+	if (handle.isValid()) {
+		checkParameters(file, !sameColorKey(textures.get(handle).transparent, trans));
+		dedupStats.cached++;
+		return getTexture(handle);
+	}
+
+	SDL_Texture * texture = createStandalone(file, trans);
+
+	TextureResource resource = { texture, { texture, { 0, 0, 0, 0 } }, trans };
+	SDL_QueryTexture(texture, 0, 0, &resource.region.rect.w, &resource.region.rect.h);
+	textures.setResident(textures.add(file, resource), textureBytes(texture));
+	watchAsset(file);
+	return texture;
+}
+
+TTF_Font * ResourceManager::loadFont(std::string file, const int & pt) {
+	FontHandle handle = fonts.find(file);
+	if (handle.isValid()) {
+		checkParameters(file, fonts.get(handle).pointSize != pt);
+		dedupStats.cached++;
+		return getFont(handle);
+	}
+
+	size_t bytes = 0;
+	FontResource resource = { openFont(file, pt, bytes), pt };
+	fonts.setResident(fonts.add(file, resource), bytes);
+	watchAsset(file);
+	return resource.font;
+}
+
+Mix_Chunk * ResourceManager::loadSound(std::string file) {
+	waitForLoad(soundsInFlight, file);
+
+	// a failed async load leaves an empty slot behind, that one is loaded again
+	SoundHandle handle = sounds.find(file);
+	if (handle.isValid() && (sounds.get(handle) || sounds.isEvicted(handle))) {
+		dedupStats.cached++;
+		return getSound(handle);
+	}
+
+	Mix_Chunk * sound = openSound(file);
+	sounds.setResident(sounds.add(file, sound), sound->alen);
+	watchAsset(file);
+	return sound;
+}
+
+Mix_Music * ResourceManager::loadMP3(std::string file) {
+	MP3Handle handle = mp3files.find(file);
+	if (handle.isValid()) {
+		dedupStats.cached++;
+		return getMP3(handle);
+	}
+
+	size_t bytes = 0;
+	Mix_Music * mp3 = openMusic(file, bytes);
+	mp3files.setResident(mp3files.add(file, mp3), bytes);
+	return mp3;
+}
+
+/* MEMORY BUDGETS */
+
+void ResourceManager::update() {
+	textures.tick();
+	fonts.tick();
+	sounds.tick();
+	mp3files.tick();
+
+	if (watcher) {
+		for (auto & file : watcher->takeChanged(hotReloadDebounceMs))
+			reloadChanged(file);
+	}
+
+	processUploads();
+	evictOverBudget();
+}
+
+void ResourceManager::evictOverBudget() {
+	textures.evict(budgets[RESOURCE_TEXTURE], [](const std::string & name, TextureResource & resource) {
+		// an atlas region stays valid without the standalone copy
+		if (resource.region.texture == resource.texture)
+			resource.region = TextureRegion();
+		SDL_DestroyTexture(resource.texture);
+		resource.texture = nullptr;
+#ifdef __DEBUG
+		debug("Texture evicted:", name.c_str());
+#endif
+	});
+
+	fonts.evict(budgets[RESOURCE_FONT], [](const std::string & name, FontResource & resource) {
+		TTF_CloseFont(resource.font);
+		resource.font = nullptr;
+#ifdef __DEBUG
+		debug("Font evicted:", name.c_str());
+#endif
+	});
+
+	sounds.evict(budgets[RESOURCE_SOUND], [](const std::string & name, Mix_Chunk *& sound) {
+		AudioEngine::freeChunk(sound);	// halts any channel still playing it
+		sound = nullptr;
+#ifdef __DEBUG
+		debug("Sound evicted:", name.c_str());
+#endif
+	});
+
+	mp3files.evict(budgets[RESOURCE_MUSIC], [](const std::string & name, Mix_Music *& mp3) {
+		AudioEngine::freeMusic(mp3);
+		mp3 = nullptr;
+#ifdef __DEBUG
+		debug("MP3 evicted:", name.c_str());
+#endif
+	});
+}
+
+void ResourceManager::reloadTexture(TextureHandle handle) {
+	TextureResource & resource = textures.get(handle);
+	resource.texture = createStandalone(textures.getName(handle), resource.transparent);
+
+	if (nullptr == resource.region.texture) {
+		TextureRegion region = { resource.texture, { 0, 0, 0, 0 } };
+		SDL_QueryTexture(resource.texture, 0, 0, &region.rect.w, &region.rect.h);
+		resource.region = region;
+	}
+
+	textures.setResident(handle, textureBytes(resource.texture));
+}
+
+void ResourceManager::reloadFont(FontHandle handle) {
+	FontResource & resource = fonts.get(handle);
+	size_t bytes = 0;
+	resource.font = openFont(fonts.getName(handle), resource.pointSize, bytes);
+	fonts.setResident(handle, bytes);
+}
+
+void ResourceManager::reloadSound(SoundHandle handle) {
+	Mix_Chunk *& sound = sounds.get(handle);
+	sound = openSound(sounds.getName(handle));
+	sounds.setResident(handle, sound->alen);
+}
+
+void ResourceManager::reloadMP3(MP3Handle handle) {
+	Mix_Music *& mp3 = mp3files.get(handle);
+	size_t bytes = 0;
+	mp3 = openMusic(mp3files.getName(handle), bytes);
+	mp3files.setResident(handle, bytes);
+}
+
+void ResourceManager::setBudget(ResourceClass type, size_t bytes) {
+	budgets[type] = bytes;
+}
+
+ResourcePoolStats ResourceManager::getStats(ResourceClass type) {
+	ResourcePoolStats stats = {};
+	switch (type) {
+		case RESOURCE_TEXTURE:	stats = textures.getStats(); break;
+		case RESOURCE_FONT:		stats = fonts.getStats(); break;
+		case RESOURCE_SOUND:	stats = sounds.getStats(); break;
+		case RESOURCE_MUSIC:	stats = mp3files.getStats(); break;
+		default: break;
+	}
+	stats.budget = budgets[type];
+	return stats;
+}
+
+void ResourceManager::resetStats() {
+	textures.resetStats();
+	fonts.resetStats();
+	sounds.resetStats();
+	mp3files.resetStats();
+}
+
+size_t ResourceManager::getAtlasBytes() {
+	size_t bytes = 0;
+	for (auto texture : atlasPages)
+		bytes += textureBytes(texture);
+	return bytes;
+}
+
+/* ASYNC LOADING */
+
+TextureHandle ResourceManager::loadTextureAsync(std::string file, SDL_Color trans, const std::string & group) {
+	TextureHandle handle = textures.find(file);
+
+	auto inFlight = texturesInFlight.find(file);
+	if (inFlight != texturesInFlight.end()) {
+		checkParameters(file, !sameColorKey(textures.get(handle).transparent, trans));
+		dedupStats.coalesced++;
+		beginGroupLoad(group);
+		inFlight->second.push_back(group);
+		return handle;
+	}
+
+	if (handle.isValid()) {
+		const TextureResource & cached = textures.get(handle);
+		checkParameters(file, !sameColorKey(cached.transparent, trans));
+		if (cached.texture || cached.region.texture) {
+			dedupStats.cached++;
+			return handle;
+		}
+		// evicted or failed before, decode it again with the original colour key
+	}
+	else {
+		TextureResource resource = { nullptr, TextureRegion(), trans };
+		handle = textures.add(file, resource);
+	}
+
+	PendingLoad load;
+	load.type = PendingLoad::TEXTURE;
+	load.file = file;
+	load.group = group;
+	load.transparent = textures.get(handle).transparent;
+	beginGroupLoad(group);
+	texturesInFlight[file].push_back(group);
+	submitLoad(load);
+	watchAsset(file);
+	return handle;
+}
+
+SoundHandle ResourceManager::loadSoundAsync(std::string file, const std::string & group) {
+	SoundHandle handle = sounds.find(file);
+
+	auto inFlight = soundsInFlight.find(file);
+	if (inFlight != soundsInFlight.end()) {
+		dedupStats.coalesced++;
+		beginGroupLoad(group);
+		inFlight->second.push_back(group);
+		return handle;
+	}
+
+	if (!handle.isValid())
+		handle = sounds.add(file, nullptr);
+	else if (sounds.get(handle)) {
+		dedupStats.cached++;
+		return handle;
+	}
+
+	PendingLoad load;
+	load.type = PendingLoad::SOUND;
+	load.file = file;
+	load.group = group;
+	beginGroupLoad(group);
+	soundsInFlight[file].push_back(group);
+	submitLoad(load);
+	watchAsset(file);
+	return handle;
+}
+
+void ResourceManager::beginGroupLoad(const std::string & group) {
+	LoadGroupStats & stats = loadGroups[group];
+	if (stats.requested == stats.completed)
+		stats.startTicks = SDL_GetTicks();
+	stats.requested++;
+}
+
+void ResourceManager::submitLoad(const PendingLoad & request) {
+	if (!loaderPool)
+		loaderPool = std::unique_ptr<ThreadPool>(new ThreadPool(SDL_GetCPUCount() - 1));
+
+	PendingLoad load = request;
+	load.surface = nullptr;
+	load.sound = nullptr;
+	load.decodeMs = 0.0;
+
+	loaderPool->submit([load]() mutable {
+		decode(load);
+
+		std::lock_guard<std::mutex> lock(loadMutex);
+		completedLoads.push_back(load);
+		loadCompleted.notify_all();
+	});
+}
+
+// runs on a worker thread, must not touch the pools or the renderer
+void ResourceManager::decode(PendingLoad & load) {
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	if (load.type == PendingLoad::TEXTURE) {
+		try {
+			load.surface = decodeTexture(load.file, load.transparent, load.reload);
+		}
+		catch (EngineException & e) {
+			load.error = e.what();
+		}
+	}
+	else {
+		try {
+			load.sound = openSound(load.file);
+		}
+		catch (EngineException & e) {
+			load.error = e.what();
+		}
+	}
+
+	load.decodeMs = elapsedMs(start);
+}
+
+void ResourceManager::finishLoad(PendingLoad & load) {
+	// every group that asked for the file is done with it, timings go to the one that submitted it
+	InFlightLoads & inFlight = load.type == PendingLoad::TEXTURE ? texturesInFlight : soundsInFlight;
+	std::vector<std::string> groups = inFlight[load.file];
+	inFlight.erase(load.file);
+
+	for (auto & group : groups) {
+		LoadGroupStats & stats = loadGroups[group];
+		stats.completed++;
+		stats.endTicks = SDL_GetTicks();
+	}
+
+	LoadGroupStats & stats = loadGroups[load.group];
+	stats.decodeMs += load.decodeMs;
+
+	if (!load.error.empty()) {
+		if (load.reload) {
+			// most likely caught mid-save, the next change tries again
+			std::cout << "Hot reload failed, keeping the old version: " << load.file << std::endl;
+			return;
+		}
+		throw EngineException(load.error, load.file);
+	}
+
+	if (load.reload) {
+		bool unloaded = load.type == PendingLoad::TEXTURE ? !textures.find(load.file).isValid() : !sounds.find(load.file).isValid();
+		if (unloaded) {
+			if (load.surface) SDL_FreeSurface(load.surface);
+			if (load.sound) AudioEngine::freeChunk(load.sound);
+			return;
+		}
+	}
+
+	if (load.type == PendingLoad::TEXTURE && load.reload) {
+		TextureHandle handle = textures.find(load.file);
+		TextureResource & resource = textures.get(handle);
+
+		// packed files are redrawn in their atlas page as long as the size is the same
+		if (resource.region.texture && resource.region.texture != resource.texture) {
+			Uint64 start = SDL_GetPerformanceCounter();
+			bool updated = updateAtlasRegion(resource.region, load.surface);
+			stats.uploadMs += elapsedMs(start);
+
+			if (updated) {
+				SDL_FreeSurface(load.surface);
+				if (resource.texture) {
+					// the standalone copy is stale, it is made again on demand
+					SDL_DestroyTexture(resource.texture);
+					resource.texture = nullptr;
+					textures.setResident(handle, 0);
+				}
+				return;
+			}
+		}
+	}
+
+	if (load.type == PendingLoad::TEXTURE) {
+		Uint64 start = SDL_GetPerformanceCounter();
+		SDL_Texture * texture = uploadSurface(load.surface);
+		SDL_FreeSurface(load.surface);
+		stats.uploadMs += elapsedMs(start);
+
+		if (nullptr == texture)
+			throw EngineException(SDL_GetError(), load.file);
+
+		TextureHandle handle = textures.find(load.file);
+		if (handle.isValid() && textures.get(handle).texture)
+			SDL_DestroyTexture(textures.get(handle).texture);
+
+		TextureResource resource = { texture, { texture, { 0, 0, 0, 0 } }, load.transparent };
+		SDL_QueryTexture(texture, 0, 0, &resource.region.rect.w, &resource.region.rect.h);
+		textures.setResident(textures.add(load.file, resource), textureBytes(texture));
+	}
+	else {
+		SoundHandle handle = sounds.find(load.file);
+		if (handle.isValid() && sounds.get(handle))
+			AudioEngine::freeChunk(sounds.get(handle));
+
+		sounds.setResident(sounds.add(load.file, load.sound), load.sound->alen);
+	}
+}
+
+bool ResourceManager::updateAtlasRegion(const TextureRegion & region, SDL_Surface * surf) {
+	if (surf->w != region.rect.w || surf->h != region.rect.h)
+		return false;
+
+	Uint32 format = 0;
+	SDL_QueryTexture(region.texture, &format, 0, 0, 0);
+	SDL_Surface * converted = SDL_ConvertSurfaceFormat(surf, format, 0);
+	if (nullptr == converted)
+		return false;
+
+	// the extruded padding keeps the old edge pixels until the atlas is rebuilt
+	bool updated = SDL_UpdateTexture(region.texture, &region.rect, converted->pixels, converted->pitch) == 0;
+	SDL_FreeSurface(converted);
+	return updated;
+}
+
+void ResourceManager::processUploads() {
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	while (true) {
+		PendingLoad load;
+		{
+			std::lock_guard<std::mutex> lock(loadMutex);
+			if (completedLoads.empty())
+				return;
+
+			load = completedLoads.front();
+			completedLoads.pop_front();
+		}
+
+		finishLoad(load);
+
+		if (uploadBudgetMs > 0 && elapsedMs(start) >= uploadBudgetMs)
+			return;
+	}
+}
+
+void ResourceManager::waitForGroup(const std::string & group) {
+	LoadGroupStats & stats = loadGroups[group];
+	waitUntil([&stats] { return stats.completed >= stats.requested; });
+}
+
+void ResourceManager::waitForLoad(InFlightLoads & inFlight, const std::string & file) {
+	waitUntil([&inFlight, &file] { return inFlight.count(file) == 0; });
+}
+
+void ResourceManager::waitUntil(const std::function<bool()> & done) {
+	Uint32 budget = uploadBudgetMs;
+	uploadBudgetMs = 0;
+
+	while (!done()) {
+		{
+			std::unique_lock<std::mutex> lock(loadMutex);
+			loadCompleted.wait(lock, [] { return !completedLoads.empty(); });
+		}
+
+		try {
+			processUploads();
+		}
+		catch (...) {
+			uploadBudgetMs = budget;
+			throw;
+		}
+	}
+
+	uploadBudgetMs = budget;
+}
+
+LoadGroupStats ResourceManager::getGroupStats(const std::string & group) {
+	return loadGroups[group];
+}
+
+std::map<std::string, LoadGroupStats> ResourceManager::getAllGroupStats() {
+	return loadGroups;
+}
+
+/* HOT RELOAD */
+
+void ResourceManager::enableHotReload(bool enable) {
+	if (!enable) {
+		watcher.reset();
+		return;
+	}
+
+	if (watcher)
+		return;
+
+	watcher = std::unique_ptr<FileWatcher>(new FileWatcher());
+	textures.forEach([](const std::string & name, TextureResource &) { watcher->watch(name); });
+	fonts.forEach([](const std::string & name, FontResource &) { watcher->watch(name); });
+	sounds.forEach([](const std::string & name, Mix_Chunk *) { watcher->watch(name); });
+	for (auto & callback : watchCallbacks)
+		watcher->watch(callback.first);
+
+#ifdef __DEBUG
+	debug("Hot reload watching files:", (int)watcher->getWatchCount());
+	debug("Hot reload uses inotify:", watcher->usesNotifications() ? "yes" : "no");
+#endif
+}
+
+void ResourceManager::watchFile(const std::string & file, const FileChangedCallback & onChange) {
+	watchCallbacks[file] = onChange;
+	watchAsset(file);
+}
+
+void ResourceManager::watchAsset(const std::string & file) {
+	if (watcher)
+		watcher->watch(file);
+}
+
+void ResourceManager::reloadChanged(const std::string & file) {
+	auto callback = watchCallbacks.find(file);
+	if (callback != watchCallbacks.end())
+		callback->second(file);
+
+	// evicted resources pick up the change when they are next used,
+	// files with a load still in flight are left to it
+	TextureHandle texture = textures.find(file);
+	if (texture.isValid() && !textures.isEvicted(texture) && !texturesInFlight.count(file)) {
+		PendingLoad load;
+		load.type = PendingLoad::TEXTURE;
+		load.file = file;
+		load.group = "hotreload";
+		load.transparent = textures.get(texture).transparent;
+		load.reload = true;
+		beginGroupLoad(load.group);
+		texturesInFlight[file].push_back(load.group);
+		submitLoad(load);
+	}
+
+	SoundHandle sound = sounds.find(file);
+	if (sound.isValid() && !sounds.isEvicted(sound) && !soundsInFlight.count(file)) {
+		PendingLoad load;
+		load.type = PendingLoad::SOUND;
+		load.file = file;
+		load.group = "hotreload";
+		load.reload = true;
+		beginGroupLoad(load.group);
+		soundsInFlight[file].push_back(load.group);
+		submitLoad(load);
+	}
+
+	FontHandle font = fonts.find(file);
+	if (font.isValid() && !fonts.isEvicted(font)) {
+		FontResource & resource = fonts.get(font);
+		size_t bytes = 0;
+		try {
+			TTF_Font * reopened = openFont(file, resource.pointSize, bytes);
+			if (resource.font)
+				retiredFonts.push_back(resource.font);
+			resource.font = reopened;
+			fonts.setResident(font, bytes);
+		}
+		catch (EngineException &) {
+			// mid-save or broken, keep the old font
+		}
+	}
+
+#ifdef __DEBUG
+	debug("Hot reload:", file.c_str());
+#endif
+}
+
+// copies src into dst at (x, y) and repeats its edge pixels into the surrounding padding
+static void blitExtruded(SDL_Surface * src, SDL_Surface * dst, int x, int y, int padding) {
+	for (int row = -padding; row < src->h + padding; row++) {
+		int srcY = std::max(0, std::min(src->h - 1, row));
+		const Uint32 * srcRow = (const Uint32 *)((const Uint8 *)src->pixels + srcY * src->pitch);
+		Uint32 * dstRow = (Uint32 *)((Uint8 *)dst->pixels + (y + row) * dst->pitch);
+
+		for (int col = -padding; col < src->w + padding; col++) {
+			int srcX = std::max(0, std::min(src->w - 1, col));
+			dstRow[x + col] = srcRow[srcX];
+		}
+	}
+}
+
+void ResourceManager::buildAtlas(const std::vector<std::string> & files, const int & pageSize, const int & padding) {
+	struct Image {
+		std::string file;
+		SDL_Surface * surf;
+	};
+
+	std::vector<Image> images;
+	for (auto & file : files) {
+		TextureHandle handle = textures.find(file);
+		SDL_Surface * loaded = decodeTexture(file, handle.isValid() ? textures.get(handle).transparent : SDL_COLOR_BLACK);
+
+		// colour key becomes alpha, so pages need no key of their own
+		SDL_Surface * surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+		SDL_FreeSurface(loaded);
+		if (nullptr == surf)
+			throw EngineException(SDL_GetError(), file);
+
+		if (surf->w + padding * 2 > pageSize || surf->h + padding * 2 > pageSize) {
+#ifdef __DEBUG
+			debug("Too large for atlas, kept standalone:", file.c_str());
+#endif
+			SDL_FreeSurface(surf);
+			continue;
+		}
+
+		Image image = { file, surf };
+		images.push_back(image);
+	}
+
+	// tallest first packs noticeably tighter with a skyline
+	std::sort(images.begin(), images.end(), [](const Image & a, const Image & b) { return a.surf->h > b.surf->h; });
+
+	std::vector<SkylinePacker> packers;
+	std::vector<SDL_Surface *> pages;
+	std::vector<std::pair<size_t, SDL_Rect>> placements;
+
+	for (auto & image : images) {
+		int w = image.surf->w + padding * 2;
+		int h = image.surf->h + padding * 2;
+		int x = 0, y = 0;
+
+		size_t page = 0;
+		while (page < packers.size() && !packers[page].insert(w, h, x, y))
+			page++;
+
+		if (page == packers.size()) {
+			SDL_Surface * surf = SDL_CreateRGBSurfaceWithFormat(0, pageSize, pageSize, 32, SDL_PIXELFORMAT_ARGB8888);
+			if (nullptr == surf)
+				throw EngineException("Failed to create atlas page", SDL_GetError());
+
+			packers.push_back(SkylinePacker(pageSize, pageSize));
+			pages.push_back(surf);
+			packers[page].insert(w, h, x, y);
+		}
+
+		blitExtruded(image.surf, pages[page], x + padding, y + padding, padding);
+
+		SDL_Rect rect = { x + padding, y + padding, image.surf->w, image.surf->h };
+		placements.push_back(std::make_pair(page, rect));
+	}
+
+	size_t firstPage = atlasPages.size();
+	for (auto surf : pages) {
+		SDL_Texture * texture = GFX::createTextureFromSurface(surf);
+		SDL_FreeSurface(surf);
+		if (nullptr == texture)
+			throw EngineException("Failed to create atlas texture", SDL_GetError());
+
+		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+		atlasPages.push_back(texture);
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		SDL_FreeSurface(images[i].surf);
+
+		TextureHandle handle = textures.find(images[i].file);
+		if (!handle.isValid()) {
+			TextureResource resource = { nullptr, TextureRegion(), SDL_COLOR_BLACK };
+			handle = textures.add(images[i].file, resource);
+		}
+
+		// the atlas replaces the standalone texture, handles stay the same
+		TextureResource & resource = textures.get(handle);
+		if (resource.texture) {
+			SDL_DestroyTexture(resource.texture);
+			resource.texture = nullptr;
+		}
+
+		TextureRegion region = { atlasPages[firstPage + placements[i].first], placements[i].second };
+		resource.region = region;
+
+		// pages are not evictable, packed files only count a standalone copy if one is made
+		textures.setResident(handle, 0);
+	}
+
+#ifdef __DEBUG
+	debug("Atlas images packed:", (int)images.size());
+	debug("Atlas pages created:", (int)pages.size());
+#endif
+}
+
 void ResourceManager::freeResources() {
-	for (auto pair : fonts) {
-		if (pair.second) {
-			TTF_CloseFont(pair.second);
+	watcher.reset();
+	watchCallbacks.clear();
+
+	// let in-flight decodes finish before anything they produce is freed
+	loaderPool.reset();
+	for (auto & load : completedLoads) {
+		if (load.surface) SDL_FreeSurface(load.surface);
+		if (load.sound) AudioEngine::freeChunk(load.sound);
+	}
+	completedLoads.clear();
+	texturesInFlight.clear();
+	soundsInFlight.clear();
+
+	for (auto font : retiredFonts)
+		TTF_CloseFont(font);
+	retiredFonts.clear();
+
+	fonts.forEach([](const std::string & name, FontResource & resource) {
+		if (resource.font) {
+			TTF_CloseFont(resource.font);
 #ifdef __DEBUG
 			debug("Font freed:");
-			debug(pair.first.c_str());
+			debug(name.c_str());
 #endif
 		}
-	}
+	});
 
-	for (auto pair : textures) {
-		if (pair.second) {
-			SDL_DestroyTexture(pair.second);
+	textures.forEach([](const std::string & name, TextureResource & resource) {
+		if (resource.texture) {
+			SDL_DestroyTexture(resource.texture);
 #ifdef __DEBUG
 			debug("Texture destroyed:");
-			debug(pair.first.c_str());
+			debug(name.c_str());
 #endif
 		}
-	}
+	});
 
-	for (auto pair : sounds) {
-		if (pair.second) {
-			Mix_FreeChunk(pair.second);
+	sounds.forEach([](const std::string & name, Mix_Chunk * sound) {
+		if (sound) {
+			AudioEngine::freeChunk(sound);
 #ifdef __DEBUG
 			debug("Sound freed:");
-			debug(pair.first.c_str());
+			debug(name.c_str());
 #endif
 		}
-	}
+	});
 
-	for (auto pair : mp3files) {
-		if (pair.second) {
-			Mix_FreeMusic(pair.second);
+	mp3files.forEach([](const std::string & name, Mix_Music * mp3) {
+		if (mp3) {
+			AudioEngine::freeMusic(mp3);
 #ifdef __DEBUG
 			debug("MP3 freed:");
-			debug(pair.first.c_str());
+			debug(name.c_str());
 #endif
 		}
-	}
+	});
+
+	for (auto texture : atlasPages)
+		SDL_DestroyTexture(texture);
+	atlasPages.clear();
+
+	// fonts and music stream from their packs, so these go last
+	packs.clear();
+	diskCache.close();
+
+	fonts.clear();
+	textures.clear();
+	sounds.clear();
+	mp3files.clear();
 
 #ifdef __DEBUG
 	debug("ResourceManager::freeResources() finished");
 #endif
 }
 
+TextureRegion ResourceManager::getRegion(std::string fileName) {
+	return getRegion(textures.find(fileName));
+}
+
+TextureRegion ResourceManager::getRegion(TextureHandle handle) {
+	TextureResource & resource = textures.use(handle);
+	if (nullptr == resource.region.texture && handle.isValid() && textures.isEvicted(handle)
+		&& texturesInFlight.count(textures.getName(handle)) == 0)
+		reloadTexture(handle);
+	return resource.region;
+}
+
+SDL_Texture * ResourceManager::getTexture(TextureHandle handle) {
+	TextureResource & resource = textures.use(handle);
+
+	// evicted, or only packed into an atlas, fall back to a standalone copy
+	if (nullptr == resource.texture && handle.isValid()) {
+		waitForLoad(texturesInFlight, textures.getName(handle));
+		if (nullptr == textures.get(handle).texture)
+			reloadTexture(handle);
+	}
+
+	return textures.get(handle).texture;
+}
+
+TTF_Font * ResourceManager::getFont(FontHandle handle) {
+	FontResource & resource = fonts.use(handle);
+	if (handle.isValid() && fonts.isEvicted(handle))
+		reloadFont(handle);
+	return resource.font;
+}
+
+Mix_Chunk * ResourceManager::getSound(SoundHandle handle) {
+	Mix_Chunk * sound = sounds.use(handle);
+	if (handle.isValid() && sounds.isEvicted(handle)) {
+		reloadSound(handle);
+		sound = sounds.get(handle);
+	}
+	return sound;
+}
+
+Mix_Music * ResourceManager::getMP3(MP3Handle handle) {
+	Mix_Music * mp3 = mp3files.use(handle);
+	if (handle.isValid() && mp3files.isEvicted(handle)) {
+		reloadMP3(handle);
+		mp3 = mp3files.get(handle);
+	}
+	return mp3;
+}
+
 SDL_Texture * ResourceManager::getTexture(std::string fileName) {
-	return textures[fileName];
+	return getTexture(textures.find(fileName));
 }
 
 TTF_Font * ResourceManager::getFont(std::string fileName) {
-	return fonts[fileName];
+	return getFont(fonts.find(fileName));
 }
 
 Mix_Chunk * ResourceManager::getSound(std::string fileName) {
-	return sounds[fileName];
+	return getSound(sounds.find(fileName));
 }
 
 Mix_Music * ResourceManager::getMP3(std::string fileName) {
-	return mp3files[fileName];
+	return getMP3(mp3files.find(fileName));
+}
+
+void ResourceManager::unloadTexture(TextureHandle handle) {
+	TextureResource & resource = textures.get(handle);
+	if (resource.texture)
+		SDL_DestroyTexture(resource.texture);
+	textures.remove(handle);
 }
+
+void ResourceManager::unloadFont(FontHandle handle) {
+	if (fonts.get(handle).font)
+		TTF_CloseFont(fonts.get(handle).font);
+	fonts.remove(handle);
+}
+
+void ResourceManager::unloadSound(SoundHandle handle) {
+	if (sounds.get(handle))
+		AudioEngine::freeChunk(sounds.get(handle));
+	sounds.remove(handle);
+}
+
+void ResourceManager::unloadMP3(MP3Handle handle) {
+	if (mp3files.get(handle))
+		AudioEngine::freeMusic(mp3files.get(handle));
+	mp3files.remove(handle);
+}
\ No newline at end of file
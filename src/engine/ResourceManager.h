@@ -3,17 +3,208 @@
 
 #include <map>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "GraphicsEngine.h"
 #include "AudioEngine.h"
+#include "ResourcePool.h"
+#include "ThreadPool.h"
+#include "PackFile.h"
+#include "TextureDiskCache.h"
+#include "FileWatcher.h"
+
+static const int DEFAULT_ATLAS_SIZE = 2048;
+static const int DEFAULT_ATLAS_PADDING = 2;
+
+struct TextureResource {
+	SDL_Texture * texture;	// standalone texture, nullptr while only packed into an atlas
+	TextureRegion region;	// what to draw, an atlas region or the whole standalone texture
+	SDL_Color transparent;	// colour key it was loaded with
+};
+
+struct FontResource {
+	TTF_Font * font;
+	int pointSize;	// kept to reopen the font after it was evicted
+};
+
+/**
+* Resource classes with separate memory budgets
+*/
+enum ResourceClass {
+	RESOURCE_TEXTURE,
+	RESOURCE_FONT,
+	RESOURCE_SOUND,
+	RESOURCE_MUSIC,
+	RESOURCE_CLASS_COUNT
+};
+
+// in MB, 0 means unlimited
+static const int DEFAULT_TEXTURE_BUDGET_MB = 256;
+static const int DEFAULT_FONT_BUDGET_MB = 0;
+static const int DEFAULT_SOUND_BUDGET_MB = 64;
+static const int DEFAULT_MUSIC_BUDGET_MB = 0;
+
+struct LoadGroupStats {
+	Uint32 requested, completed;
+	double decodeMs;	// summed over all worker threads
+	double uploadMs;	// main thread texture creation
+	Uint32 startTicks, endTicks;
+};
+
+/**
+* Load calls that were served without decoding again
+*/
+struct LoadDedupStats {
+	Uint32 cached;		// the resource was already loaded
+	Uint32 coalesced;	// joined an async load of the same file still in flight
+	Uint32 conflicts;	// requested with different parameters than the first load
+};
+
+static const Uint32 DEFAULT_UPLOAD_BUDGET_MS = 2;
+
+#ifdef __DEBUG
+static const bool DEFAULT_HOT_RELOAD = true;
+#else
+static const bool DEFAULT_HOT_RELOAD = false;
+#endif
+static const Uint32 DEFAULT_HOT_RELOAD_DEBOUNCE_MS = 200;
+
+typedef std::function<void(const std::string &)> FileChangedCallback;
+
+typedef ResourceHandle<TextureResource> TextureHandle;
+typedef ResourceHandle<FontResource> FontHandle;
+typedef ResourceHandle<Mix_Music *> MP3Handle;
 
 class ResourceManager {
 	private:
-		static std::map<std::string, SDL_Texture *> textures;
-		static std::map<std::string, Mix_Chunk *> sounds;
-		static std::map<std::string, Mix_Music *> mp3files;
-		static std::map<std::string, TTF_Font *> fonts;
+		static ResourcePool<TextureResource> textures;
+		static ResourcePool<FontResource> fonts;
+		static ResourcePool<Mix_Chunk *> sounds;
+		static ResourcePool<Mix_Music *> mp3files;
+		static std::vector<SDL_Texture *> atlasPages;
+		static size_t budgets[RESOURCE_CLASS_COUNT];
+
+		static std::vector<std::unique_ptr<PackFile>> packs;
+		static bool looseFileOverride;
+
+		static TextureDiskCache diskCache;
+
+		static bool statAsset(const std::string & fileName, Uint64 & modifiedTime, Uint64 & size);
+		static SDL_Surface * loadSurface(const std::string & fileName, SDL_Color transparent);
+		static SDL_Surface * decodeTexture(const std::string & fileName, SDL_Color transparent, bool refresh = false);
+		static SDL_Texture * uploadSurface(SDL_Surface * surface);
+		static SDL_Texture * createStandalone(const std::string & fileName, SDL_Color transparent);
+		static TTF_Font * openFont(const std::string & fileName, int pointSize, size_t & bytes);
+		static Mix_Chunk * openSound(const std::string & fileName);
+		static Mix_Music * openMusic(const std::string & fileName, size_t & bytes);
+
+		/* recreate evicted resources behind their handles */
+		static void reloadTexture(TextureHandle);
+		static void reloadFont(FontHandle);
+		static void reloadSound(SoundHandle);
+		static void reloadMP3(MP3Handle);
+		static void evictOverBudget();
+
+		/* asynchronous loading */
+		struct PendingLoad {
+			enum Type { TEXTURE, SOUND } type;
+			std::string file, group;
+			SDL_Color transparent;
+			SDL_Surface * surface;
+			Mix_Chunk * sound;
+			double decodeMs;
+			std::string error;
+			bool reload = false;	// replaces a resident resource in place
+		};
+
+		static std::unique_ptr<ThreadPool> loaderPool;
+		static std::mutex loadMutex;
+		static std::condition_variable loadCompleted;
+		static std::deque<PendingLoad> completedLoads;
+		static std::map<std::string, LoadGroupStats> loadGroups;
+		static Uint32 uploadBudgetMs;
+
+		// file -> groups waiting for it, the first one submitted the decode
+		typedef std::map<std::string, std::vector<std::string>> InFlightLoads;
+		static InFlightLoads texturesInFlight, soundsInFlight;
+		static LoadDedupStats dedupStats;
+
+		static void beginGroupLoad(const std::string & group);
+		static void submitLoad(const PendingLoad &);
+		static void decode(PendingLoad &);
+		static void finishLoad(PendingLoad &);
+		static void waitUntil(const std::function<bool()> & done);
+		static void waitForLoad(InFlightLoads & inFlight, const std::string & fileName);
+		static void checkParameters(const std::string & fileName, bool conflict);
+
+		/* hot reload */
+		static std::unique_ptr<FileWatcher> watcher;
+		static Uint32 hotReloadDebounceMs;
+		static std::map<std::string, FileChangedCallback> watchCallbacks;
+		static std::vector<TTF_Font *> retiredFonts;
+
+		static void watchAsset(const std::string & fileName);
+		static void reloadChanged(const std::string & fileName);
+		static bool updateAtlasRegion(const TextureRegion & region, SDL_Surface * surface);
 	public:
+		/**
+		* Mounts a pack built by PackTool, its entries are found by the same paths
+		* that were given to PackTool
+		*
+		* @exception throws EngineException if the pack can't be mapped
+		*/
+		static void mountPack(const std::string & fileName);
+
+		/**
+		* Opens an asset from the mounted packs or as a loose file
+		* The caller owns the returned SDL_RWops, nullptr if not found
+		*/
+		static SDL_RWops * openAsset(const std::string & fileName);
+
+		/**
+		* If enabled (default in __DEBUG builds) loose files are tried first and override
+		* packed entries, otherwise they are only used for files missing from all packs
+		*/
+		static void setLooseFileOverride(bool b) { looseFileOverride = b; }
+
+		/**
+		* Decoded textures are cached on disk under given directory and read back
+		* on later runs instead of decoding the image files again
+		*
+		* @param capacity - in bytes, least recently used files are deleted beyond it
+		*/
+		static void enableTextureCache(const std::string & directory = TextureDiskCache::getDefaultDirectory(), size_t capacity = DEFAULT_TEXTURE_CACHE_MB * 1024 * 1024);
+		static void disableTextureCache() { diskCache.close(); }
+		static void setTextureCacheCapacity(size_t capacity) { diskCache.setCapacity(capacity); }
+		static void clearTextureCache() { diskCache.clear(); }
+		static bool isTextureCacheEnabled() { return diskCache.isEnabled(); }
+		static TextureDiskCacheStats getTextureCacheStats() { return diskCache.getStats(); }
+
+		/**
+		* Watches the files of loaded textures, sounds and fonts and reloads them
+		* when they change. Decoding happens on the loader threads and the new
+		* resource replaces the old one behind the same handle
+		*
+		* Fonts are reopened synchronously and the old font is kept alive until
+		* freeResources(), as raw pointers to it are usually held elsewhere
+		*/
+		static void enableHotReload(bool);
+		static bool isHotReloadEnabled() { return watcher != nullptr; }
+
+		/**
+		* @param ms - changes are reported once a file stops changing for this long
+		*/
+		static void setHotReloadDebounce(Uint32 ms) { hotReloadDebounceMs = ms; }
+
+		/**
+		* Calls onChange(fileName) on the main thread whenever the file changes,
+		* e.g. to run a script again. Replaces an earlier callback for the same file
+		*/
+		static void watchFile(const std::string & fileName, const FileChangedCallback & onChange);
 
 		/**
 		* Call to free all resource files
@@ -27,16 +218,160 @@ class ResourceManager {
 		*
 		* After load* functions, the loaded resource can also be retrieved
 		* by calling get* with appropriate filename
+		*
+		* Loading a file that is already loaded returns the cached resource, if an
+		* async load of it is in flight the call waits for it. Parameters of the
+		* first load win, a different colour key or point size prints a warning
 		*/
 		static SDL_Texture * loadTexture(std::string fileName, SDL_Color transparent = SDL_COLOR_BLACK);
 		static TTF_Font * loadFont(std::string fileName, const int & pointSize);
 		static Mix_Chunk * loadSound(std::string fileName);
 		static Mix_Music * loadMP3(std::string fileName);
 
+		/**
+		* Called once per frame by the main loop, finishes async loads
+		* and evicts unreferenced resources of classes over their budget
+		*/
+		static void update();
+
+		/**
+		* @param bytes - memory budget of the resource class, 0 means unlimited
+		*/
+		static void setBudget(ResourceClass, size_t bytes);
+		static ResourcePoolStats getStats(ResourceClass);
+		static void resetStats();
+		static size_t getAtlasBytes();
+
+		/**
+		* Referenced resources stay resident regardless of the budget, use ResourceRef
+		* rather than calling these directly
+		*
+		* Anything keeping a raw pointer from load* or get* across frames, e.g. a font
+		* given to GraphicsEngine::useFont, must hold a reference, as unreferenced
+		* resources may be freed and later reloaded at a different address
+		*/
+		static void acquire(TextureHandle handle) { textures.acquire(handle); }
+		static void acquire(FontHandle handle) { fonts.acquire(handle); }
+		static void acquire(SoundHandle handle) { sounds.acquire(handle); }
+		static void acquire(MP3Handle handle) { mp3files.acquire(handle); }
+		static void release(TextureHandle handle) { textures.release(handle); }
+		static void release(FontHandle handle) { fonts.release(handle); }
+		static void release(SoundHandle handle) { sounds.release(handle); }
+		static void release(MP3Handle handle) { mp3files.release(handle); }
+
+		/**
+		* Async load* functions return a handle right away and decode on worker threads
+		* Textures are created on the main thread by processUploads(), until then
+		* their handle resolves to nullptr / an empty region
+		*
+		* Requests for a file that is loaded or already in flight share its decode
+		*
+		* @param group - name to wait for and report timings under
+		*/
+		static TextureHandle loadTextureAsync(std::string fileName, SDL_Color transparent = SDL_COLOR_BLACK, const std::string & group = "");
+		static SoundHandle loadSoundAsync(std::string fileName, const std::string & group = "");
+
+		/**
+		* Finishes decoded loads on the main thread, called once per frame by the main loop
+		* Stops after the upload budget is used up, leaving the rest for the next frame
+		*
+		* @exception throws EngineException if a load failed to decode or upload
+		*/
+		static void processUploads();
+		static void setUploadBudget(Uint32 ms) { uploadBudgetMs = ms; }
+
+		/**
+		* Blocks until every load of given group has finished, ignoring the upload budget
+		*/
+		static void waitForGroup(const std::string & group);
+		static LoadGroupStats getGroupStats(const std::string & group);
+		static std::map<std::string, LoadGroupStats> getAllGroupStats();
+		static LoadDedupStats getDedupStats() { return dedupStats; }
+
+		/**
+		* Packs previously loaded textures into as few atlas pages as possible
+		* Each image is surrounded by padding filled with its own edge pixels to stop bleeding
+		*
+		* The standalone textures of packed files are destroyed, pointers to them become invalid
+		* getTexture() still works for packed files but loads a standalone copy on first use
+		*
+		* @param fileNames - textures to pack, images that don't fit a page stay standalone
+		* @param pageSize - width and height of each atlas page
+		* @param padding - extruded border around each image
+		*/
+		static void buildAtlas(const std::vector<std::string> & fileNames, const int & pageSize = DEFAULT_ATLAS_SIZE, const int & padding = DEFAULT_ATLAS_PADDING);
+
+		/**
+		* @return the atlas region of given file, or the whole standalone texture
+		*         if the file is not in an atlas
+		*/
+		static TextureRegion getRegion(std::string fileName);
+
+		/**
+		* Name lookups, prefer resolving a handle once and using the handle getters
+		* @return nullptr (or an empty region) if the resource was not loaded
+		*/
 		static SDL_Texture * getTexture(std::string fileName);
 		static TTF_Font * getFont(std::string fileName);
 		static Mix_Chunk * getSound(std::string fileName);
 		static Mix_Music * getMP3(std::string fileName);
+
+		/**
+		* Resolve names to handles, at load or bind time rather than per frame
+		* @return an invalid handle (which resolves to nullptr) if the resource was not loaded
+		*/
+		static TextureHandle getTextureHandle(const std::string & fileName) { return textures.find(fileName); }
+		static FontHandle getFontHandle(const std::string & fileName) { return fonts.find(fileName); }
+		static SoundHandle getSoundHandle(const std::string & fileName) { return sounds.find(fileName); }
+		static MP3Handle getMP3Handle(const std::string & fileName) { return mp3files.find(fileName); }
+
+		/**
+		* @return the file a sound was loaded from, for stats and console output, empty if the sound was freed
+		*/
+		static std::string getSoundName(SoundHandle handle) { return sounds.contains(handle) ? sounds.getName(handle) : std::string(); }
+
+		/**
+		* O(1) lookups, in debug builds a stale handle throws EngineException
+		* Evicted resources are reloaded synchronously on their next lookup
+		*/
+		static TextureRegion getRegion(TextureHandle handle);
+		static SDL_Texture * getTexture(TextureHandle handle);
+		static TTF_Font * getFont(FontHandle handle);
+		static Mix_Chunk * getSound(SoundHandle handle);
+		static Mix_Music * getMP3(MP3Handle handle);
+
+		/**
+		* Frees a single resource, its handle becomes stale
+		*/
+		static void unloadTexture(TextureHandle);
+		static void unloadFont(FontHandle);
+		static void unloadSound(SoundHandle);
+		static void unloadMP3(MP3Handle);
+};
+
+/**
+* Holds a reference to a resource for as long as it lives, keeping it resident
+*/
+template <typename H>
+class ResourceRef {
+	private:
+		H handle;
+
+	public:
+		ResourceRef() {}
+		explicit ResourceRef(H handle) : handle(handle) { ResourceManager::acquire(handle); }
+		ResourceRef(const ResourceRef & other) : handle(other.handle) { ResourceManager::acquire(handle); }
+		~ResourceRef() { ResourceManager::release(handle); }
+
+		ResourceRef & operator=(const ResourceRef & other) {
+			ResourceManager::acquire(other.handle);
+			ResourceManager::release(handle);
+			handle = other.handle;
+			return *this;
+		}
+
+		H get() const { return handle; }
+		operator H() const { return handle; }
 };
 
 #endif
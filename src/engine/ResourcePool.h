@@ -0,0 +1,310 @@
+#ifndef __RESOURCE_POOL_H__
+#define __RESOURCE_POOL_H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <SDL.h>
+
+#include "EngineCommon.h"
+
+/**
+* Typed index into a ResourcePool, issued when a resource is loaded
+*
+* The default handle refers to slot 0, which always holds an empty resource,
+* so an unbound handle behaves like the old lookup of a missing name
+*/
+template <typename T>
+struct ResourceHandle {
+	Uint32 index;
+	Uint32 generation;
+
+	ResourceHandle() : index(0), generation(0) {}
+	ResourceHandle(Uint32 index, Uint32 generation) : index(index), generation(generation) {}
+
+	bool isValid() const { return index != 0; }
+	bool operator==(const ResourceHandle & other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const ResourceHandle & other) const { return !(*this == other); }
+	bool operator<(const ResourceHandle & other) const {
+		return index < other.index || (index == other.index && generation < other.generation);
+	}
+};
+
+struct ResourcePoolStats {
+	size_t count, resident, referenced;
+	size_t bytes, budget;
+	Uint32 hits, misses, evictions;
+};
+
+/**
+* Dense storage of resources addressed by handles
+* Names are only resolved when loading or binding, lookups by handle are O(1)
+*
+* Slots also track a reference count, a size in bytes and the frame they were
+* last used in, so the owner can evict unreferenced resources and reload them later
+*/
+template <typename T>
+class ResourcePool {
+	public:
+		typedef ResourceHandle<T> Handle;
+
+	private:
+		struct Slot {
+			T resource;
+			std::string name;
+			Uint32 generation;
+			bool used;
+
+			Uint32 refCount;
+			size_t bytes;
+			Uint32 lastUsed;
+			bool evicted;
+		};
+
+		std::vector<Slot> slots;
+		std::vector<Uint32> freeSlots;
+		std::unordered_map<std::string, Uint32> names;
+
+		Uint32 clock;
+		size_t residentBytes;
+		Uint32 hits, misses, evictions;
+
+		void checkHandle(const Handle & handle) const {
+			if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation
+				|| (handle.index != 0 && !slots[handle.index].used))
+				throw EngineException("Stale resource handle", std::to_string(handle.index));
+		}
+
+		bool isCurrent(const Handle & handle) const {
+			return handle.index != 0 && handle.index < slots.size()
+				&& slots[handle.index].used && slots[handle.index].generation == handle.generation;
+		}
+
+	public:
+		ResourcePool() {
+			clear();
+		}
+
+		/**
+		* @return handle of the named resource or an invalid handle
+		*/
+		Handle find(const std::string & name) const {
+			auto iter = names.find(name);
+			if (iter == names.end())
+				return Handle();
+			return Handle(iter->second, slots[iter->second].generation);
+		}
+
+		/**
+		* Stores the resource under given name, reusing the slot (and handle) if the name exists
+		* References to an existing slot are kept
+		*/
+		Handle add(const std::string & name, const T & resource) {
+			auto iter = names.find(name);
+			Uint32 index;
+			if (iter != names.end()) {
+				index = iter->second;
+			}
+			else if (!freeSlots.empty()) {
+				index = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else {
+				index = (Uint32)slots.size();
+				slots.push_back(Slot());
+				slots[index].generation = 0;
+			}
+
+			Slot & slot = slots[index];
+			if (!slot.used) {
+				slot.refCount = 0;
+				slot.bytes = 0;
+				slot.evicted = false;
+			}
+			slot.resource = resource;
+			slot.name = name;
+			slot.used = true;
+			slot.lastUsed = clock;
+			names[name] = index;
+			return Handle(index, slot.generation);
+		}
+
+		T & get(const Handle & handle) {
+#ifdef __DEBUG
+			checkHandle(handle);
+#endif
+			return slots[handle.index].resource;
+		}
+
+		/**
+		* get() for callers that draw or play the resource, marks it as recently used
+		* Counts a hit, or a miss if the resource was evicted and has to be reloaded
+		*/
+		T & use(const Handle & handle) {
+			T & resource = get(handle);
+			if (handle.index != 0) {
+				Slot & slot = slots[handle.index];
+				slot.lastUsed = clock;
+				if (slot.evicted) misses++;
+				else hits++;
+			}
+			return resource;
+		}
+
+		/**
+		* @return false once the slot was freed, even if it has been reused since
+		*/
+		bool contains(const Handle & handle) const {
+			return isCurrent(handle);
+		}
+
+		const std::string & getName(const Handle & handle) const {
+			return slots[handle.index].name;
+		}
+
+		bool isEvicted(const Handle & handle) const {
+			return slots[handle.index].evicted;
+		}
+
+		/**
+		* Marks the resource as loaded (again) and records its size
+		* @param bytes - memory held by the resource, 0 excludes it from eviction
+		*/
+		void setResident(const Handle & handle, size_t bytes) {
+			if (handle.index == 0)
+				return;
+
+			Slot & slot = slots[handle.index];
+			if (!slot.evicted)
+				residentBytes -= slot.bytes;
+			slot.bytes = bytes;
+			slot.evicted = false;
+			residentBytes += bytes;
+		}
+
+		/**
+		* Referenced resources are never evicted
+		* Stale handles are ignored, so references may outlive the pool contents
+		*/
+		void acquire(const Handle & handle) {
+			if (isCurrent(handle))
+				slots[handle.index].refCount++;
+		}
+
+		void release(const Handle & handle) {
+			if (isCurrent(handle) && slots[handle.index].refCount > 0)
+				slots[handle.index].refCount--;
+		}
+
+		/**
+		* Advances the frame counter used for least recently used ordering
+		*/
+		void tick() { clock++; }
+
+		/**
+		* Evicts unreferenced resources, least recently used first, until the pool
+		* fits in given budget. Resources used in this or the previous frame are kept
+		*
+		* @param budget - in bytes, 0 means unlimited
+		* @param release - called as release(name, resource) to free the resource,
+		*                  the slot and handles to it stay valid
+		*/
+		template <typename F>
+		void evict(size_t budget, F release) {
+			if (budget == 0)
+				return;
+
+			while (residentBytes > budget) {
+				Uint32 victim = 0;
+				for (Uint32 i = 1; i < slots.size(); i++) {
+					const Slot & slot = slots[i];
+					if (!slot.used || slot.evicted || slot.refCount > 0 || slot.bytes == 0 || slot.lastUsed + 1 >= clock)
+						continue;
+					if (victim == 0 || slot.lastUsed < slots[victim].lastUsed)
+						victim = i;
+				}
+
+				if (victim == 0)
+					return;	// the rest is referenced or in use
+
+				Slot & slot = slots[victim];
+				release(slot.name, slot.resource);
+				slot.evicted = true;
+				residentBytes -= slot.bytes;
+				evictions++;
+			}
+		}
+
+		/**
+		* Frees the slot, handles to it become stale
+		*/
+		void remove(const Handle & handle) {
+			checkHandle(handle);
+			if (handle.index == 0)
+				return;
+
+			Slot & slot = slots[handle.index];
+			if (!slot.evicted)
+				residentBytes -= slot.bytes;
+			names.erase(slot.name);
+			slot.resource = T();
+			slot.name.clear();
+			slot.used = false;
+			slot.generation++;
+			freeSlots.push_back(handle.index);
+		}
+
+		/**
+		* Calls f(name, resource) for every stored resource
+		*/
+		template <typename F>
+		void forEach(F f) {
+			for (size_t i = 1; i < slots.size(); i++)
+				if (slots[i].used) f(slots[i].name, slots[i].resource);
+		}
+
+		void clear() {
+			slots.clear();
+			freeSlots.clear();
+			names.clear();
+
+			Slot empty;
+			empty.resource = T();
+			empty.generation = 0;
+			empty.used = false;
+			empty.refCount = 0;
+			empty.bytes = 0;
+			empty.lastUsed = 0;
+			empty.evicted = false;
+			slots.push_back(empty);
+
+			clock = 0;
+			residentBytes = 0;
+			resetStats();
+		}
+
+		void resetStats() { hits = misses = evictions = 0; }
+
+		size_t size() const { return slots.size() - 1 - freeSlots.size(); }
+
+		/**
+		* @return counts and bytes of the pool, the budget is left for the owner to fill in
+		*/
+		ResourcePoolStats getStats() const {
+			ResourcePoolStats stats = {};
+			for (size_t i = 1; i < slots.size(); i++) {
+				if (!slots[i].used) continue;
+				stats.count++;
+				if (!slots[i].evicted) stats.resident++;
+				if (slots[i].refCount > 0) stats.referenced++;
+			}
+			stats.bytes = residentBytes;
+			stats.hits = hits;
+			stats.misses = misses;
+			stats.evictions = evictions;
+			return stats;
+		}
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+/**
+* Bounded queue for exactly one producer thread and one consumer thread
+*
+* The producer only moves the tail and the consumer only moves the head,
+* so neither side ever takes a lock. The capacity is rounded up to a power of two
+*/
+template <typename T>
+class SPSCQueue {
+	private:
+		std::vector<T> items;
+		size_t mask;
+		std::atomic<size_t> head, tail;	// total items ever popped / pushed
+
+	public:
+		explicit SPSCQueue(size_t capacity) : head(0), tail(0) {
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+
+			items.resize(size);
+			mask = size - 1;
+		}
+
+		SPSCQueue(const SPSCQueue &) = delete;
+		SPSCQueue & operator=(const SPSCQueue &) = delete;
+
+		/**
+		* Producer thread only
+		* @return false if the queue is full, the item is not added
+		*/
+		bool push(const T & item) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) > mask)
+				return false;
+
+			items[t & mask] = item;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		* Consumer thread only
+		* @return false if the queue is empty
+		*/
+		bool pop(T & item) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+
+			item = items[h & mask];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		* Exact on either thread while the other is idle, otherwise a snapshot
+		*/
+		size_t size() const {
+			// head first, the tail can only have moved further since
+			size_t h = head.load(std::memory_order_acquire);
+			return tail.load(std::memory_order_acquire) - h;
+		}
+
+		size_t capacity() const { return mask + 1; }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "SkylinePacker.h"
+
+SkylinePacker::SkylinePacker(int width, int height) : width(width), height(height) {
+	Node node = { 0, 0, width };
+	skyline.push_back(node);
+}
+
+int SkylinePacker::fit(size_t i, int w, int h) {
+	int x = skyline[i].x;
+	if (x + w > width)
+		return -1;
+
+	// rectangle rests on the highest node it spans
+	int y = skyline[i].y;
+	int remaining = w;
+	while (remaining > 0) {
+		if (i >= skyline.size())
+			return -1;
+
+		if (skyline[i].y > y)
+			y = skyline[i].y;
+		if (y + h > height)
+			return -1;
+
+		remaining -= skyline[i].w;
+		i++;
+	}
+
+	return y;
+}
+
+bool SkylinePacker::insert(int w, int h, int & outX, int & outY) {
+	int bestTop = height + 1, bestW = width + 1, bestY = 0;
+	size_t bestIndex = skyline.size();
+
+	for (size_t i = 0; i < skyline.size(); i++) {
+		int y = fit(i, w, h);
+		if (y < 0)
+			continue;
+
+		// lowest placement wins, ties go to the narrowest node to limit waste
+		if (y + h < bestTop || (y + h == bestTop && skyline[i].w < bestW)) {
+			bestTop = y + h;
+			bestW = skyline[i].w;
+			bestY = y;
+			bestIndex = i;
+		}
+	}
+
+	if (bestIndex == skyline.size())
+		return false;
+
+	outX = skyline[bestIndex].x;
+	outY = bestY;
+
+	Node node = { outX, bestY + h, w };
+	skyline.insert(skyline.begin() + bestIndex, node);
+
+	// shrink or remove the nodes now covered by the new one
+	for (size_t i = bestIndex + 1; i < skyline.size(); i++) {
+		int covered = node.x + node.w - skyline[i].x;
+		if (covered <= 0)
+			break;
+
+		skyline[i].x += covered;
+		skyline[i].w -= covered;
+		if (skyline[i].w > 0)
+			break;
+
+		skyline.erase(skyline.begin() + i);
+		i--;
+	}
+
+	merge();
+	return true;
+}
+
+void SkylinePacker::merge() {
+	for (size_t i = 0; i + 1 < skyline.size(); i++) {
+		if (skyline[i].y == skyline[i + 1].y) {
+			skyline[i].w += skyline[i + 1].w;
+			skyline.erase(skyline.begin() + i + 1);
+			i--;
+		}
+	}
+}
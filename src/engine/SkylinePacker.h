@@ -0,0 +1,38 @@
+#ifndef __SKYLINE_PACKER_H__
+#define __SKYLINE_PACKER_H__
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Packs rectangles into a fixed size area using the skyline bottom-left heuristic
+ * Each packed rectangle is placed as low as possible on the current skyline
+ */
+class SkylinePacker {
+	private:
+		struct Node {
+			int x, y, w;
+		};
+
+		int width, height;
+		std::vector<Node> skyline;
+
+		/**
+		* @return y at which a w * h rectangle fits when placed on node i, or -1
+		*/
+		int fit(size_t i, int w, int h);
+		void merge();
+
+	public:
+		SkylinePacker(int width, int height);
+
+		/**
+		* @return true and the top left corner of the rectangle if it fits
+		*/
+		bool insert(int w, int h, int & x, int & y);
+
+		int getWidth() { return width; }
+		int getHeight() { return height; }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "TextCache.h"
+#include "GraphicsEngine.h"
+
+TextCache::TextCache() : bytes(0), budget(DEFAULT_TEXT_CACHE_BUDGET), hits(0), misses(0), evictions(0) {}
+
+TextCache::~TextCache() {
+	clear();
+}
+
+TextCache::Key TextCache::makeKey(const std::string & text, TTF_Font * font, const SDL_Color & color) {
+	Key key;
+	key.text = text;
+	key.font = font;
+	key.color = (color.r << 24) | (color.g << 16) | (color.b << 8) | color.a;
+	return key;
+}
+
+TextCache::Entry * TextCache::find(const Key & key) {
+	auto iter = lookup.find(key);
+	if (iter == lookup.end())
+		return nullptr;
+
+	// move to front, iterators stay valid
+	entries.splice(entries.begin(), entries, iter->second);
+	return &entries.front();
+}
+
+TextCache::Entry * TextCache::insert(const Key & key) {
+	SDL_Texture * texture = GFX::createTextureFromString(key.text, key.font, toSDLColor(key.color >> 24, key.color >> 16, key.color >> 8, key.color));
+	if (nullptr == texture)
+		return nullptr;
+
+	Entry entry;
+	entry.key = key;
+	entry.texture = texture;
+	entry.pinned = false;
+	SDL_QueryTexture(texture, 0, 0, &entry.w, &entry.h);
+	entry.bytes = (size_t)entry.w * entry.h * 4;
+
+	entries.push_front(entry);
+	lookup[key] = entries.begin();
+	bytes += entry.bytes;
+
+	evict();
+	return &entries.front();
+}
+
+void TextCache::evict() {
+	// never evict the entry that was just inserted/used
+	auto iter = entries.end();
+	while (bytes > budget && iter != entries.begin()) {
+		--iter;
+		if (iter == entries.begin())
+			break;
+
+		if (iter->pinned)
+			continue;
+
+		SDL_DestroyTexture(iter->texture);
+		bytes -= iter->bytes;
+		lookup.erase(iter->key);
+		iter = entries.erase(iter);
+		evictions++;
+	}
+}
+
+SDL_Texture * TextCache::get(const std::string & text, TTF_Font * font, const SDL_Color & color, int * w, int * h) {
+	Key key = makeKey(text, font, color);
+	Entry * entry = find(key);
+
+	if (entry != nullptr) {
+		hits++;
+	}
+	else {
+		misses++;
+		entry = insert(key);
+		if (nullptr == entry)
+			return nullptr;
+	}
+
+	if (w) *w = entry->w;
+	if (h) *h = entry->h;
+	return entry->texture;
+}
+
+void TextCache::pin(const std::string & text, TTF_Font * font, const SDL_Color & color) {
+	Key key = makeKey(text, font, color);
+	Entry * entry = find(key);
+	if (nullptr == entry)
+		entry = insert(key);
+
+	if (entry != nullptr)
+		entry->pinned = true;
+}
+
+void TextCache::unpin(const std::string & text, TTF_Font * font, const SDL_Color & color) {
+	Entry * entry = find(makeKey(text, font, color));
+	if (entry != nullptr) {
+		entry->pinned = false;
+		evict();
+	}
+}
+
+void TextCache::setBudget(size_t _budget) {
+	budget = _budget;
+	evict();
+}
+
+void TextCache::clear() {
+	for (auto & entry : entries)
+		SDL_DestroyTexture(entry.texture);
+
+	entries.clear();
+	lookup.clear();
+	bytes = 0;
+}
+
+void TextCache::resetStats() {
+	hits = misses = evictions = 0;
+}
+
+TextCacheStats TextCache::getStats() {
+	TextCacheStats stats;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	stats.entries = entries.size();
+	stats.pinned = 0;
+	for (auto & entry : entries)
+		if (entry.pinned) stats.pinned++;
+	stats.bytes = bytes;
+	stats.budget = budget;
+	return stats;
+}
@@ -0,0 +1,98 @@
+#ifndef __TEXT_CACHE_H__
+#define __TEXT_CACHE_H__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+static const size_t DEFAULT_TEXT_CACHE_BUDGET = 4 * 1024 * 1024;	// bytes
+
+struct TextCacheStats {
+	Uint32 hits, misses, evictions;
+	size_t entries, pinned;
+	size_t bytes, budget;
+};
+
+/**
+ * LRU cache of rendered text textures, keyed by (text, font, colour)
+ *
+ * Textures are owned by the cache, callers must not destroy them
+ * Pinned entries are never evicted, even if the cache is over budget
+ */
+class TextCache {
+	private:
+		struct Key {
+			std::string text;
+			TTF_Font * font;
+			Uint32 color;
+
+			bool operator==(const Key & other) const {
+				return font == other.font && color == other.color && text == other.text;
+			}
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key & key) const {
+				size_t h = std::hash<std::string>()(key.text);
+				h ^= std::hash<void *>()(key.font) + 0x9e3779b9 + (h << 6) + (h >> 2);
+				h ^= std::hash<Uint32>()(key.color) + 0x9e3779b9 + (h << 6) + (h >> 2);
+				return h;
+			}
+		};
+
+		struct Entry {
+			Key key;
+			SDL_Texture * texture;
+			int w, h;
+			size_t bytes;
+			bool pinned;
+		};
+
+		// front is the most recently used entry
+		std::list<Entry> entries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> lookup;
+
+		size_t bytes, budget;
+		Uint32 hits, misses, evictions;
+
+		static Key makeKey(const std::string &, TTF_Font *, const SDL_Color &);
+
+		Entry * find(const Key &);
+		Entry * insert(const Key &);
+		void evict();
+
+	public:
+		TextCache();
+		~TextCache();
+
+		/**
+		* @return cached texture for given text, rasterising it on a miss
+		*         or nullptr if the text could not be rendered
+		*/
+		SDL_Texture * get(const std::string & text, TTF_Font * font, const SDL_Color & color, int * w = 0, int * h = 0);
+
+		/**
+		* Pinned strings stay resident regardless of the memory budget
+		*/
+		void pin(const std::string & text, TTF_Font * font, const SDL_Color & color);
+		void unpin(const std::string & text, TTF_Font * font, const SDL_Color & color);
+
+		/**
+		* @param budget - memory budget in bytes, pinned textures count
+		*                 towards it but are never evicted
+		*/
+		void setBudget(size_t budget);
+
+		/**
+		* Destroys all textures, including pinned ones
+		*/
+		void clear();
+		void resetStats();
+
+		TextCacheStats getStats();
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "TextureDiskCache.h"
+#include "PackFile.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+TextureDiskCache::TextureDiskCache() : capacity(DEFAULT_TEXTURE_CACHE_MB * 1024 * 1024), enabled(false),
+	useCounter(0), totalBytes(0), hits(0), misses(0), stale(0), writes(0) {}
+
+std::string TextureDiskCache::getDefaultDirectory() {
+	char * prefPath = SDL_GetPrefPath(TEXTURE_CACHE_ORG, TEXTURE_CACHE_APP);
+	if (nullptr == prefPath) {
+		std::cout << "Texture cache: " << SDL_GetError() << ", using " << DEFAULT_TEXTURE_CACHE_DIR << std::endl;
+		return DEFAULT_TEXTURE_CACHE_DIR;
+	}
+
+	// SDL creates the directory and ends the path with a separator
+	std::string dir = prefPath;
+	SDL_free(prefPath);
+	if (!dir.empty() && (dir.back() == '/' || dir.back() == '\\'))
+		dir.pop_back();
+	return dir;
+}
+
+std::string TextureDiskCache::fileName(const std::string & path) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.xtex", (unsigned long long)PackFile::hashPath(path));
+	return name;
+}
+
+std::string TextureDiskCache::indexFileName() const {
+	return directory + "/index.txt";
+}
+
+void TextureDiskCache::open(const std::string & dir, size_t cap) {
+	std::lock_guard<std::mutex> lock(mutex);
+	directory = dir;
+	capacity = cap;
+
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+
+	loadIndex();
+	trim();
+	enabled = true;
+}
+
+void TextureDiskCache::close() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (enabled)
+		saveIndex();
+	enabled = false;
+}
+
+void TextureDiskCache::setCapacity(size_t cap) {
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = cap;
+	if (enabled) {
+		trim();
+		saveIndex();
+	}
+}
+
+void TextureDiskCache::loadIndex() {
+	index.clear();
+	totalBytes = 0;
+	useCounter = 0;
+
+	std::ifstream in(indexFileName());
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream ss(line);
+		std::string name;
+		IndexEntry entry;
+		if (!(ss >> name >> entry.bytes >> entry.lastUse))
+			continue;
+
+		index[name] = entry;
+		totalBytes += entry.bytes;
+		useCounter = std::max(useCounter, entry.lastUse);
+	}
+}
+
+void TextureDiskCache::saveIndex() {
+	std::ofstream out(indexFileName(), std::ios::trunc);
+	for (auto & entry : index)
+		out << entry.first << " " << entry.second.bytes << " " << entry.second.lastUse << "\n";
+}
+
+void TextureDiskCache::touch(const std::string & name, size_t bytes) {
+	auto iter = index.find(name);
+	if (iter != index.end())
+		totalBytes -= iter->second.bytes;
+
+	IndexEntry entry = { bytes, ++useCounter };
+	index[name] = entry;
+	totalBytes += bytes;
+}
+
+void TextureDiskCache::trim() {
+	if (capacity == 0 || totalBytes <= capacity)
+		return;
+
+	std::vector<std::pair<Uint64, std::string>> order;
+	for (auto & entry : index)
+		order.push_back(std::make_pair(entry.second.lastUse, entry.first));
+	std::sort(order.begin(), order.end());
+
+	for (auto & victim : order) {
+		if (totalBytes <= capacity)
+			break;
+
+		std::remove((directory + "/" + victim.second).c_str());
+		totalBytes -= index[victim.second].bytes;
+		index.erase(victim.second);
+	}
+}
+
+SDL_Surface * TextureDiskCache::read(const TextureCacheKey & key) {
+	if (!enabled)
+		return nullptr;
+
+	std::string name = fileName(key.path);
+	std::string path = directory + "/" + name;
+
+	FILE * in = fopen(path.c_str(), "rb");
+	if (nullptr == in) {
+		std::lock_guard<std::mutex> lock(mutex);
+		misses++;
+		return nullptr;
+	}
+
+	TextureCacheHeader header;
+	bool valid = fread(&header, sizeof(header), 1, in) == 1
+		&& header.magic == TEXTURE_CACHE_MAGIC && header.version == TEXTURE_CACHE_VERSION
+		&& header.pathHash == PackFile::hashPath(key.path)
+		&& header.sourceTime == key.sourceTime && header.sourceSize == key.sourceSize
+		&& header.colorKey == key.colorKey && header.format == SDL_PIXELFORMAT_ARGB8888
+		&& header.width > 0 && header.height > 0;
+
+	SDL_Surface * surf = nullptr;
+	if (valid) {
+		surf = SDL_CreateRGBSurfaceWithFormat(0, header.width, header.height, 32, SDL_PIXELFORMAT_ARGB8888);
+
+		// the pitch of a 32 bit surface is always width * 4, so pixels go straight into it
+		size_t size = (size_t)header.width * header.height * 4;
+		if (nullptr == surf || surf->pitch != header.width * 4 || fread(surf->pixels, 1, size, in) != size) {
+			if (surf) SDL_FreeSurface(surf);
+			surf = nullptr;
+		}
+	}
+	fclose(in);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (nullptr == surf) {
+		// source or parameters changed, or the file is truncated
+		std::remove(path.c_str());
+		auto iter = index.find(name);
+		if (iter != index.end()) {
+			totalBytes -= iter->second.bytes;
+			index.erase(iter);
+		}
+		stale++;
+		misses++;
+		return nullptr;
+	}
+
+	touch(name, sizeof(header) + (size_t)surf->pitch * surf->h);
+	hits++;
+	return surf;
+}
+
+void TextureDiskCache::write(const TextureCacheKey & key, SDL_Surface * surf) {
+	if (!enabled || surf->format->format != SDL_PIXELFORMAT_ARGB8888)
+		return;
+
+	TextureCacheHeader header = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, PackFile::hashPath(key.path),
+		key.sourceTime, key.sourceSize, key.colorKey, SDL_PIXELFORMAT_ARGB8888, surf->w, surf->h };
+
+	// written under a temporary name, so other threads never read a partial file
+	std::string name = fileName(key.path);
+	std::string path = directory + "/" + name;
+	std::string temp = path + "." + std::to_string((unsigned long long)SDL_ThreadID()) + ".tmp";
+
+	FILE * out = fopen(temp.c_str(), "wb");
+	if (nullptr == out) {
+		std::cout << "Failed to write texture cache: " << temp << std::endl;
+		return;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	for (int y = 0; ok && y < surf->h; y++)
+		ok = fwrite((const Uint8 *)surf->pixels + y * surf->pitch, 4, surf->w, out) == (size_t)surf->w;
+	ok = (fclose(out) == 0) && ok;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::remove(path.c_str());
+	if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::remove(temp.c_str());
+		std::cout << "Failed to write texture cache: " << path << std::endl;
+		return;
+	}
+
+	touch(name, sizeof(header) + (size_t)surf->w * surf->h * 4);
+	writes++;
+	trim();
+	saveIndex();
+}
+
+void TextureDiskCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto & entry : index)
+		std::remove((directory + "/" + entry.first).c_str());
+
+	index.clear();
+	totalBytes = 0;
+	if (enabled)
+		saveIndex();
+}
+
+TextureDiskCacheStats TextureDiskCache::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	TextureDiskCacheStats stats = { hits, misses, stale, writes, index.size(), totalBytes, capacity };
+	return stats;
+}
@@ -0,0 +1,132 @@
+#ifndef __TEXTURE_DISK_CACHE_H__
+#define __TEXTURE_DISK_CACHE_H__
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include <SDL.h>
+
+#include "EngineCommon.h"
+
+/**
+* Cache file layout (native endian, the cache is never shared between machines):
+*
+*   TextureCacheHeader
+*   width * height ARGB8888 pixels, rows tightly packed
+*/
+static const Uint32 TEXTURE_CACHE_MAGIC = 0x58455458;	// "XTEX"
+static const Uint32 TEXTURE_CACHE_VERSION = 1;
+
+// the cache lives in the per user SDL preference directory, DEFAULT_TEXTURE_CACHE_DIR
+// under the working directory is only used if that cannot be resolved
+static const char * TEXTURE_CACHE_ORG = "XCube2d";
+static const char * TEXTURE_CACHE_APP = "texcache";
+static const char * DEFAULT_TEXTURE_CACHE_DIR = "cache";
+static const int DEFAULT_TEXTURE_CACHE_MB = 256;
+
+struct TextureCacheHeader {
+	Uint32 magic;
+	Uint32 version;
+	Uint64 pathHash;
+	Uint64 sourceTime;
+	Uint64 sourceSize;
+	Uint32 colorKey;	// 0xRRGGBB, or 0xFFFFFFFF if no key was applied
+	Uint32 format;
+	Sint32 width;
+	Sint32 height;
+};
+
+/**
+* Identifies one decoded image, any change to the source or the load parameters
+* makes the cached copy stale
+*/
+struct TextureCacheKey {
+	std::string path;
+	Uint64 sourceTime;
+	Uint64 sourceSize;
+	Uint32 colorKey;
+};
+
+struct TextureDiskCacheStats {
+	Uint32 hits, misses, stale, writes;
+	size_t entries, bytes, capacity;
+};
+
+/**
+* Decoded, colour keyed textures stored on disk, so warm starts skip image decoding
+*
+* Pixels are ARGB8888 with straight alpha, the native format of the bundled
+* renderers. Files are named after the path hash, a changed source overwrites
+* its old entry. An index of sizes and last use is kept next to them and the
+* least recently used files are deleted once the cache outgrows its capacity
+*
+* read() and write() may be called from loader threads
+*/
+class TextureDiskCache {
+	private:
+		struct IndexEntry {
+			size_t bytes;
+			Uint64 lastUse;
+		};
+
+		std::string directory;
+		size_t capacity;
+		std::atomic<bool> enabled;	// read by loader threads without the mutex
+
+		std::mutex mutex;
+		std::map<std::string, IndexEntry> index;	// cache file name -> entry
+		Uint64 useCounter;
+		size_t totalBytes;
+		Uint32 hits, misses, stale, writes;
+
+		std::string fileName(const std::string & path) const;
+		std::string indexFileName() const;
+		void loadIndex();
+		void saveIndex();
+		void touch(const std::string & name, size_t bytes);
+		void trim();
+
+	public:
+		TextureDiskCache();
+
+		/**
+		* @return per user directory the cache is kept in by default
+		*/
+		static std::string getDefaultDirectory();
+
+		/**
+		* Creates the cache directory if needed and reads its index
+		*/
+		void open(const std::string & directory, size_t capacity);
+		void close();
+
+		void setEnabled(bool b) { enabled = b; }
+		bool isEnabled() const { return enabled; }
+
+		/**
+		* @param capacity - in bytes, least recently used files are deleted to stay below it
+		*/
+		void setCapacity(size_t capacity);
+
+		/**
+		* @return ARGB8888 surface owned by the caller, or nullptr on a miss
+		*         Stale files are deleted
+		*/
+		SDL_Surface * read(const TextureCacheKey & key);
+
+		/**
+		* Stores the pixels of an ARGB8888 surface, failures are reported but not fatal
+		*/
+		void write(const TextureCacheKey & key, SDL_Surface * surface);
+
+		/**
+		* Deletes every cached file
+		*/
+		void clear();
+
+		TextureDiskCacheStats getStats();
+};
+
+#endif
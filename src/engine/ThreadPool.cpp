@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) : stopping(false) {
+	if (threadCount < 1)
+		threadCount = 1;
+
+	for (int i = 0; i < threadCount; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	available.notify_all();
+
+	for (auto & worker : workers)
+		worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push(job);
+	}
+	available.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> & job) {
+	if (count == 0)
+		return;
+
+	grain = std::max((size_t)1, grain);
+	size_t chunks = (count + grain - 1) / grain;
+	if (chunks == 1) {
+		job(0, count);
+		return;
+	}
+
+	// shared with the helpers, which may only get to run after every chunk is taken
+	struct Range {
+		std::atomic<size_t> next;
+		size_t finished;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	std::shared_ptr<Range> range = std::make_shared<Range>();
+	range->next = 0;
+	range->finished = 0;
+
+	const std::function<void(size_t, size_t)> * body = &job;
+	auto runChunks = [range, body, count, grain, chunks] {
+		size_t ran = 0;
+		for (size_t chunk = range->next++; chunk < chunks; chunk = range->next++) {
+			size_t begin = chunk * grain;
+			(*body)(begin, std::min(count, begin + grain));
+			ran++;
+		}
+
+		if (ran > 0) {
+			std::lock_guard<std::mutex> lock(range->mutex);
+			range->finished += ran;
+			if (range->finished == chunks)
+				range->done.notify_all();
+		}
+	};
+
+	size_t helpers = std::min(workers.size(), chunks - 1);
+	for (size_t i = 0; i < helpers; i++)
+		submit(runChunks);
+
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(range->mutex);
+	range->done.wait(lock, [&range, chunks] { return range->finished == chunks; });
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+			if (jobs.empty())
+				return;	// stopping and nothing left to do
+
+			job = jobs.front();
+			jobs.pop();
+		}
+		job();
+	}
+}
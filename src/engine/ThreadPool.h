@@ -0,0 +1,48 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Fixed number of worker threads executing submitted jobs in FIFO order
+ * Jobs must not throw, report errors through their own results instead
+ */
+class ThreadPool {
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> jobs;
+		std::mutex mutex;
+		std::condition_variable available;
+		bool stopping;
+
+		void workerLoop();
+
+	public:
+		/**
+		* @param threadCount - number of workers, at least one is created
+		*/
+		ThreadPool(int threadCount);
+
+		/**
+		* Finishes all queued jobs, then joins the workers
+		*/
+		~ThreadPool();
+
+		void submit(std::function<void()> job);
+
+		/**
+		* Splits [0, count) into chunks of grain items and runs job(begin, end) for each,
+		* on the workers and the calling thread, returns once every chunk is done
+		* The chunks only depend on count and grain, never on the number of threads
+		*/
+		void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> & job);
+
+		int getThreadCount() { return (int)workers.size(); }
+};
+
+#endif
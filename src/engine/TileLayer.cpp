@@ -0,0 +1,173 @@
+#include "TileLayer.h"
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+static inline int lowestBit(Uint64 word) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+static inline int bitCount(Uint64 word) {
+#if defined(_MSC_VER)
+	return (int)__popcnt64(word);
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+TileLayer::TileLayer() : width(0), height(0), wordsPerRow(0), tileSize(1.0f), solidCount(0) {}
+
+void TileLayer::resize(int w, int h, float size) {
+	width = std::max(0, w);
+	height = std::max(0, h);
+	tileSize = size > 0.0f ? size : 1.0f;
+	wordsPerRow = (width + 63) / 64;
+	bits.assign((size_t)wordsPerRow * height, 0);
+	solidCount = 0;
+}
+
+void TileLayer::build(const int * tiles, int w, int h, float size) {
+	resize(w, h, size);
+
+	for (int y = 0; y < height; y++) {
+		Uint64 * row = &bits[(size_t)y * wordsPerRow];
+		for (int x = 0; x < width; x++) {
+			if (tiles[(size_t)y * width + x] != 0) {
+				row[x >> 6] |= 1ull << (x & 63);
+				solidCount++;
+			}
+		}
+	}
+}
+
+void TileLayer::setSolid(int x, int y, bool solid) {
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return;
+
+	Uint64 & word = bits[(size_t)y * wordsPerRow + (x >> 6)];
+	Uint64 bit = 1ull << (x & 63);
+	if (((word & bit) != 0) == solid)
+		return;
+
+	word ^= bit;
+	if (solid) solidCount++;
+	else solidCount--;
+}
+
+bool TileLayer::isSolid(int x, int y) const {
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return false;
+
+	return (bits[(size_t)y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+}
+
+bool TileLayer::tileRange(const Box2f & box, int & x0, int & y0, int & x1, int & y1) const {
+	// a box ending exactly on a tile edge does not reach into that tile
+	x0 = std::max(0, (int)floorf(box.minX / tileSize));
+	y0 = std::max(0, (int)floorf(box.minY / tileSize));
+	x1 = std::min(width - 1, (int)ceilf(box.maxX / tileSize) - 1);
+	y1 = std::min(height - 1, (int)ceilf(box.maxY / tileSize) - 1);
+
+	return x0 <= x1 && y0 <= y1;
+}
+
+Uint64 TileLayer::rowMask(int row, int word, int x0, int x1) const {
+	int first = std::max(x0, word * 64) - word * 64;
+	int last = std::min(x1, word * 64 + 63) - word * 64;
+
+	Uint64 mask = (~0ull << first) & (~0ull >> (63 - last));
+	return bits[(size_t)row * wordsPerRow + word] & mask;
+}
+
+bool TileLayer::overlaps(const Box2f & box) const {
+	int x0, y0, x1, y1;
+	if (!tileRange(box, x0, y0, x1, y1))
+		return false;
+
+	for (int y = y0; y <= y1; y++)
+		for (int word = x0 >> 6; word <= x1 >> 6; word++)
+			if (rowMask(y, word, x0, x1) != 0)
+				return true;
+
+	return false;
+}
+
+size_t TileLayer::countSolid(int x0, int y0, int x1, int y1) const {
+	x0 = std::max(0, x0);
+	y0 = std::max(0, y0);
+	x1 = std::min(width - 1, x1);
+	y1 = std::min(height - 1, y1);
+
+	size_t count = 0;
+	for (int y = y0; y <= y1; y++)
+		for (int word = x0 >> 6; x0 <= x1 && word <= x1 >> 6; word++)
+			count += bitCount(rowMask(y, word, x0, x1));
+
+	return count;
+}
+
+bool TileLayer::sweep(const Box2f & box, float dx, float dy, float & toi, Vector2f & normal) const {
+	Box2f path = { std::min(box.minX, box.minX + dx), std::min(box.minY, box.minY + dy),
+		std::max(box.maxX, box.maxX + dx), std::max(box.maxY, box.maxY + dy) };
+
+	int x0, y0, x1, y1;
+	if (!tileRange(path, x0, y0, x1, y1))
+		return false;
+
+	bool hit = false;
+	float best = INFINITY;
+
+	// rows in the direction of travel, so the first hit ends the walk once later rows are reached later
+	int step = dy < 0.0f ? -1 : 1;
+	for (int y = dy < 0.0f ? y1 : y0; y >= y0 && y <= y1; y += step) {
+		float rowMin = y * tileSize, rowMax = rowMin + tileSize;
+
+		// part of the move during which the box is level with this row
+		float enter = 0.0f, leave = 1.0f;
+		if (dy > 0.0f) {
+			enter = std::max(0.0f, (rowMin - box.maxY) / dy);
+			leave = std::min(1.0f, (rowMax - box.minY) / dy);
+		}
+		else if (dy < 0.0f) {
+			enter = std::max(0.0f, (rowMax - box.minY) / dy);
+			leave = std::min(1.0f, (rowMin - box.maxY) / dy);
+		}
+
+		if (enter > best)
+			break;
+		if (enter > leave)
+			continue;
+
+		// only the tiles the box passes over while level with the row
+		Box2f span = { box.minX + std::min(dx * enter, dx * leave), rowMin, box.maxX + std::max(dx * enter, dx * leave), rowMax };
+		int tx0, ty0, tx1, ty1;
+		if (!tileRange(span, tx0, ty0, tx1, ty1))
+			continue;
+
+		for (int word = tx0 >> 6; word <= tx1 >> 6; word++) {
+			for (Uint64 solid = rowMask(y, word, tx0, tx1); solid != 0; solid &= solid - 1) {
+				int x = word * 64 + lowestBit(solid);
+				Box2f tile = { x * tileSize, rowMin, x * tileSize + tileSize, rowMax };
+
+				float t;
+				Vector2f n;
+				if (box.sweep(dx, dy, tile, t, n) && t < best) {
+					best = t;
+					normal = n;
+					hit = true;
+				}
+			}
+		}
+	}
+
+	if (hit)
+		toi = best;
+	return hit;
+}
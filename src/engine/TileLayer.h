@@ -0,0 +1,72 @@
+#ifndef __TILE_LAYER_H__
+#define __TILE_LAYER_H__
+
+#include <vector>
+
+#include <SDL.h>
+
+#include "GameMath.h"
+
+/**
+* Solid tiles of a map packed one bit per tile, rows padded to whole 64 bit words
+*
+* Queries only look at the rows and words a box touches, so a 4096x4096 map
+* costs 2 MB and a query does not depend on the size of the map.
+* Tiles outside the map are never solid
+*/
+class TileLayer {
+	private:
+		int width, height;
+		int wordsPerRow;
+		float tileSize;
+		std::vector<Uint64> bits;
+		size_t solidCount;
+
+		/**
+		* Tiles whose inside the box covers, clamped to the map
+		* @return false if that is no tile at all
+		*/
+		bool tileRange(const Box2f & box, int & x0, int & y0, int & x1, int & y1) const;
+
+		Uint64 rowMask(int row, int word, int x0, int x1) const;
+
+	public:
+		TileLayer();
+
+		/**
+		* Clears the layer to width x height empty tiles
+		*/
+		void resize(int width, int height, float tileSize);
+
+		/**
+		* Rebuilds the layer from a row major tile array, any tile other than 0 is solid
+		*/
+		void build(const int * tiles, int width, int height, float tileSize);
+
+		void setSolid(int x, int y, bool solid);
+		bool isSolid(int x, int y) const;
+
+		int getWidth() const { return width; }
+		int getHeight() const { return height; }
+		float getTileSize() const { return tileSize; }
+		size_t getSolidCount() const { return solidCount; }
+
+		/**
+		* @return true if the box overlaps any solid tile
+		*/
+		bool overlaps(const Box2f & box) const;
+
+		/**
+		* @return number of solid tiles from (x0, y0) to (x1, y1), both inclusive
+		*/
+		size_t countSolid(int x0, int y0, int x1, int y1) const;
+
+		/**
+		* Moves the box by (dx, dy) and finds the first solid tile it hits,
+		* only the tiles the moving box passes over are tested
+		* @return true on a hit, with toi and normal as in Box2f::sweep()
+		*/
+		bool sweep(const Box2f & box, float dx, float dy, float & toi, Vector2f & normal) const;
+};
+
+#endif
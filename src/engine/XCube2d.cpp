@@ -1,6 +1,8 @@
 #include "XCube2d.h"
 
 std::shared_ptr<XCube2Engine> XCube2Engine::instance = nullptr;
+bool XCube2Engine::headless = false;
+bool XCube2Engine::offlineAudio = false;
 
 XCube2Engine::XCube2Engine() {
 	std::cout << "Initializing X-CUBE 2D v" << _ENGINE_VERSION_MAJOR << "." << _ENGINE_VERSION_MINOR << std::endl;
@@ -15,6 +17,23 @@ XCube2Engine::XCube2Engine() {
 	#endif
 #endif
 
+	if (offlineAudio) {
+		// the disk driver is not paced by a sound card, the mixer waits for the game clock instead
+		SDL_setenv("SDL_AUDIODRIVER", "disk", 1);
+		SDL_setenv("SDL_DISKAUDIODELAY", "0", 1);
+#ifdef _WIN32
+		SDL_setenv("SDL_DISKAUDIOFILE", "NUL", 1);
+#else
+		SDL_setenv("SDL_DISKAUDIOFILE", "/dev/null", 1);
+#endif
+	}
+
+	if (headless) {
+		// no display or sound card on CI / render farm machines
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+	}
+
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
 		throw EngineException("SDL_Init()", SDL_GetError());
 
@@ -42,15 +61,22 @@ XCube2Engine::XCube2Engine() {
 	debug("Inited srand() with", ticks);
 #endif
 
+	// packed assets, must be mounted before any subsystem loads resources
+	SDL_RWops * pack = SDL_RWFromFile(DEFAULT_PACK_FILE, "rb");
+	if (pack) {
+		SDL_RWclose(pack);
+		ResourceManager::mountPack(DEFAULT_PACK_FILE);
+	}
+
 	// init subsystems
 
-	gfxInstance = std::shared_ptr<GraphicsEngine>(new GraphicsEngine());
+	gfxInstance = std::shared_ptr<GraphicsEngine>(new GraphicsEngine(headless));
 
 #ifdef __DEBUG
 	debug("GraphicsEngine() successful");
 #endif
 
-	audioInstance = std::shared_ptr<AudioEngine>(new AudioEngine());
+	audioInstance = std::shared_ptr<AudioEngine>(new AudioEngine(offlineAudio));
 
 #ifdef __DEBUG
 	debug("AudioEngine() successful");
@@ -86,6 +112,24 @@ XCube2Engine::~XCube2Engine() {
 #endif
 }
 
+void XCube2Engine::setHeadless(bool b) {
+	if (instance) {
+		std::cout << "XCube2Engine::setHeadless() must be called before getInstance()" << std::endl;
+		return;
+	}
+
+	headless = b;
+}
+
+void XCube2Engine::setOfflineAudio(bool b) {
+	if (instance) {
+		std::cout << "XCube2Engine::setOfflineAudio() must be called before getInstance()" << std::endl;
+		return;
+	}
+
+	offlineAudio = b;
+}
+
 void XCube2Engine::quit() {
 	if (instance)
 		instance.reset();
@@ -16,9 +16,14 @@
 const int _ENGINE_VERSION_MAJOR = 0;
 const int _ENGINE_VERSION_MINOR = 1;
 
+// mounted at init if present, build it with PackTool
+static const char * DEFAULT_PACK_FILE = "res.pak";
+
 class XCube2Engine {
 	private:
 		static std::shared_ptr<XCube2Engine> instance;
+		static bool headless;
+		static bool offlineAudio;
 		std::shared_ptr<GraphicsEngine> gfxInstance;
 		std::shared_ptr<AudioEngine> audioInstance;
 		std::shared_ptr<EventEngine> eventInstance;
@@ -42,6 +47,21 @@ class XCube2Engine {
 		*/
 		static void quit();
 
+		/**
+		* Runs the engine without a window or audio device, rendering offscreen
+		* Must be called before the first call to getInstance()
+		*/
+		static void setHeadless(bool);
+		static bool isHeadless() { return headless; }
+
+		/**
+		* Mixes audio in step with the game clock instead of playing it on a device,
+		* see AudioEngine::advanceRender()
+		* Must be called before the first call to getInstance()
+		*/
+		static void setOfflineAudio(bool);
+		static bool isOfflineAudio() { return offlineAudio; }
+
 		/**
 		* Subsystems can only be accessed via the following accessors
 		* @return approriate subsystem of the engine
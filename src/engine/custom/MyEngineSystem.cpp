@@ -9,7 +9,8 @@ using namespace std;
 const int CONSOLE_MAX_BUFFER = 128;
 
 MyEngineSystem::MyEngineSystem() {
-    consoleFnt = ResourceManager::loadFont("res/fonts/ubuntumono.ttf", 16);
+    ResourceManager::loadFont("res/fonts/ubuntumono.ttf", 16);
+    consoleFntRef = ResourceRef<FontHandle>(ResourceManager::getFontHandle("res/fonts/ubuntumono.ttf"));
 
     print_direct("Sol's Console v1 for XCube2d", LINETYPE_SYSTEM);
     print_direct("by Sol Williams for CI517");
@@ -37,7 +38,7 @@ MyEngineSystem::MyEngineSystem() {
 
 void MyEngineSystem::cmd_playSound(const std::string& s) {
     if (empty(s)) return;
-    XCube2Engine::getInstance()->getAudioEngine()->playSound(ResourceManager::getSound(s));
+    XCube2Engine::getInstance()->getAudioEngine()->playSound(ResourceManager::getSoundHandle(s));
 }
 
 void MyEngineSystem::cmd_quit(const std::string&) {
@@ -94,6 +95,8 @@ void MyEngineSystem::render(shared_ptr<GraphicsEngine> gfx) {
     gfx->setDrawColor(SDL_COLOR_BLACK);
     gfx->fillRect(5, consoleY - 30, curWindowSize.w - 10, 24);
 
+    // looked up every frame so a hot reloaded font shows at once
+    TTF_Font* consoleFnt = ResourceManager::getFont(consoleFntRef);
     gfx->useFont(consoleFnt);
 
     // wrap lines around screen
@@ -712,5 +715,11 @@ void MyEngineSystem::cmd_exec(const std::string& command) {
             }
         }
         file.close();
+
+        // edits to the script are applied while the game runs
+        ResourceManager::watchFile(command, [this](const std::string& script) {
+            print("reloading " + script, LINETYPE_SYSTEM);
+            cmd_exec(script);
+        });
     }
 }
\ No newline at end of file
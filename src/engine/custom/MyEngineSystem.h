@@ -4,6 +4,7 @@
 #include "../EngineCommon.h"
 #include "../GraphicsEngine.h"
 #include "../EventEngine.h"
+#include "../ResourceManager.h"
 #include <functional>
 #include <unordered_map>
 #include <queue>
@@ -51,7 +52,7 @@ class MyEngineSystem {
 
 		std::string inputString;
 
-		TTF_Font* consoleFnt;
+		ResourceRef<FontHandle> consoleFntRef;	// keeps the console font resident
 
 		bool isOpen = false;
 		int consoleY = 0;
@@ -0,0 +1,45 @@
+#include <fstream>
+
+#include "../src/engine/PackFile.h"
+
+/**
+* Builds an asset pack for ResourceManager::mountPack()
+*
+* Usage: PackTool OUTPUT.pak FILE... | @LISTFILE
+* Files are stored under the path given, so run it from the directory the game runs in,
+* e.g. PackTool res.pak res/textures/player.png res/sounds/fire.wav
+*/
+int main(int argc, char * args[]) {
+	if (argc < 3) {
+		std::cout << "Usage: PackTool OUTPUT.pak FILE... | @LISTFILE" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; i++) {
+		std::string arg = args[i];
+		if (arg[0] != '@') {
+			files.push_back(arg);
+			continue;
+		}
+
+		// one path per line
+		std::ifstream list(arg.substr(1));
+		std::string line;
+		while (std::getline(list, line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (!line.empty()) files.push_back(line);
+		}
+	}
+
+	try {
+		PackFile::build(args[1], files);
+	}
+	catch (EngineException & e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cout << "Packed " << files.size() << " files into " << args[1] << std::endl;
+	return 0;
+}